@@ -17,6 +17,7 @@
 #   define open _open
 #   define write _write
 #   define close _close
+#   define fsync _commit
 # else
 #   include <unistd.h>
 # endif
@@ -3,6 +3,7 @@
 # include <mtc/iStream.h>
 # include <mtc/iBuffer.h>
 # include <functional>
+# include <future>
 # include "mtc/span.hpp"
 
 namespace DelphiX
@@ -21,15 +22,6 @@ namespace DelphiX
     EntityId( const std::string& s, api i = nullptr ): std::string_view( s.data(), s.size() ), api( i ) {}
   };
 
-  struct IEntity: mtc::Iface
-  {
-    virtual auto  GetId() const -> EntityId = 0;
-    virtual auto  GetIndex() const -> uint32_t = 0;
-    virtual auto  GetExtra() const -> mtc::api<const mtc::IByteBuffer> = 0;
-    virtual auto  GetBundle() const -> mtc::api<const mtc::IByteBuffer> = 0;
-    virtual auto  GetVersion() const -> uint64_t = 0;
-  };
-
   struct IStorage: mtc::Iface
   {
     struct IIndexStore;       // interface to write indices
@@ -48,6 +40,24 @@ namespace DelphiX
     virtual auto  Linkages() -> mtc::api<mtc::IByteStream> = 0;
     virtual auto  Packages() -> mtc::api<IDumpStore> = 0;
 
+   /*
+    * Spillage()
+    *
+    * Provides the temporary dump store for the data spilled from memory while
+    * the index is built; the data is never committed.  Returns nullptr if the
+    * storage does not support spilling.
+    */
+    virtual auto  Spillage() -> mtc::api<IDumpStore> {  return nullptr;  }
+
+   /*
+    * Supersede( serial )
+    *
+    * Declares the index stored to replace the serialized index of the same storage,
+    * i.e. the merge source; the storage keeping the list of indices publishes the
+    * index committed and drops the superseded ones at once.
+    */
+    virtual void  Supersede( mtc::api<ISerialized> ) {}
+
     virtual auto  Commit() -> mtc::api<ISerialized> = 0;
     virtual void  Remove() = 0;
   };
@@ -83,6 +93,40 @@ namespace DelphiX
   {
     virtual auto  Get( int64_t ) const -> mtc::api<const mtc::IByteBuffer> = 0;
     virtual auto  Put( const void*, size_t ) -> int64_t = 0;
+
+   /*
+    * Copy( source, pos )
+    *
+    * Appends the record of the source store and returns its position in this
+    * store with the length of the record, or -1 if there is no record.  The
+    * stores of the same kind copy the records without reading them to memory.
+    */
+    virtual auto  Copy( const IDumpStore* source, int64_t pos ) -> std::pair<int64_t, size_t>
+    {
+      auto  record = source->Get( pos );
+
+      if ( record == nullptr )
+        return { -1, 0 };
+      return { Put( record->GetPtr(), record->GetLen() ), record->GetLen() };
+    }
+  };
+
+  struct IEntity: mtc::Iface
+  {
+    virtual auto  GetId() const -> EntityId = 0;
+    virtual auto  GetIndex() const -> uint32_t = 0;
+    virtual auto  GetExtra() const -> mtc::api<const mtc::IByteBuffer> = 0;
+    virtual auto  GetBundle() const -> mtc::api<const mtc::IByteBuffer> = 0;
+    virtual auto  GetVersion() const -> uint64_t = 0;
+
+   /*
+    * GetPackage()
+    *
+    * Returns the dump store keeping the bundle as is with the position of the
+    * bundle in the store, or nullptr for the bundles not kept so.
+    */
+    virtual auto  GetPackage() const -> std::pair<mtc::api<IStorage::IDumpStore>, int64_t>
+      {  return { nullptr, -1 };  }
   };
 
   struct IContentsIndex: mtc::Iface
@@ -101,6 +145,16 @@ namespace DelphiX
       uint32_t    nCount;
     };
 
+   /*
+    * index size statistics used to schedule merges
+    */
+    struct IndexStats
+    {
+      uint32_t    nCount;       // entities in the index
+      uint32_t    nDeleted;     // entities deleted, still stored
+      uint64_t    cbStored;     // size of the serialized index, 0 if unknown
+    };
+
    /*
     * GetEntity()
     *
@@ -182,6 +236,50 @@ namespace DelphiX
     * Defined for static indices.
     */
     virtual void  Stash( EntityId ) = 0;
+
+   /*
+    * Snapshot()
+    *
+    * Returns read-only view of the index pinned to its current state: entities
+    * set or deleted after the call are not visible through the view, and the
+    * view's GetMaxIndex() does not change.
+    *
+    * Indices not changing the contents return themselves.
+    */
+    virtual auto  Snapshot() -> mtc::api<IContentsIndex> {  return this;  }
+
+   /*
+    * GetIndexStats()
+    *
+    * Returns the count of entities, the count of deleted entities still stored
+    * and the size of the serialized index.
+    */
+    virtual auto  GetIndexStats() const -> IndexStats {  return { GetMaxIndex(), 0, 0 };  }
+
+   /*
+    * ForceMerge( maxSegments )
+    *
+    * Requests the background merges until the index has no more than maxSegments
+    * static segments; the future is ready when the merges are finished.
+    *
+    * Indices having no segments to merge return the ready future.
+    */
+    virtual auto  ForceMerge( uint32_t ) -> std::future<void> {  return Ready();  }
+
+   /*
+    * ExpungeDeletes( minDeletedRatio )
+    *
+    * Requests the background rewrite of each segment having the deleted entities
+    * ratio not less than minDeletedRatio.
+    */
+    virtual auto  ExpungeDeletes( double ) -> std::future<void> {  return Ready();  }
+
+  protected:
+    static  auto  Ready() -> std::future<void>
+    {
+      auto  result = std::promise<void>();
+      return result.set_value(), result.get_future();
+    }
   };
 
  /*
@@ -205,6 +303,14 @@ namespace DelphiX
     virtual auto  Find( uint32_t ) -> Reference = 0;
     virtual auto  Size() const -> uint32_t = 0;
     virtual auto  Type() const -> uint32_t = 0;
+
+   /*
+    * GetBlock()
+    *
+    * Returns the serialized block listing the same entities as Find() does, or
+    * the empty view if the block is not stored in the serialized form.
+    */
+    virtual auto  GetBlock() const -> std::string_view {  return {};  }
   };
 
   struct IContentsIndex::IEntitiesList: Iface
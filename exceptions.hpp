@@ -5,6 +5,7 @@
 namespace DelphiX {
 
   class index_overflow: public std::runtime_error {  using runtime_error::runtime_error;  };
+  class index_busy: public std::runtime_error {  using runtime_error::runtime_error;  };
 
 }
 
@@ -1,6 +1,8 @@
 # if !defined( __DelphiX_indexer_dynamic_contents_hpp__ )
 # define __DelphiX_indexer_dynamic_contents_hpp__
 # include "../contents.hpp"
+# include <functional>
+# include <chrono>
 
 namespace DelphiX {
 namespace indexer {
@@ -9,23 +11,37 @@ namespace dynamic {
   struct Settings
   {
     uint32_t  maxEntities = 2000;                 /* */
-    uint32_t  maxAllocate = 256 * 1024 * 1024;    /* 256 meg */
+    uint32_t  maxAllocate = 256 * 1024 * 1024;    /* 256 meg, the hard mark */
+    uint32_t  softPercent = 75;                   /* soft mark, % of maxEntities and maxAllocate */
+    uint32_t  spillPercent = 0;                   /* spill mark, % of maxAllocate, 0 - never spill */
+    uint32_t  maxCommits = 0;                     /* full indices being committed, 0 - unlimited */
+
+    std::chrono::milliseconds hardMarkWait = std::chrono::milliseconds( 250 );
+    std::chrono::milliseconds commitWait = std::chrono::seconds( 60 );   /* wait for commit slot, 0 - fail at once */
 
   public:
     auto  SetMaxEntities( uint32_t value ) -> Settings& {  maxEntities = value; return *this;  }
     auto  SetMaxAllocate( uint32_t value ) -> Settings& {  maxAllocate = value; return *this;  }
+    auto  SetSoftPercent( uint32_t value ) -> Settings& {  softPercent = value; return *this;  }
+    auto  SetSpillPercent( uint32_t value ) -> Settings& {  spillPercent = value; return *this;  }
+    auto  SetMaxCommits( uint32_t value ) -> Settings& {  maxCommits = value; return *this;  }
+    auto  SetHardMarkWait( std::chrono::milliseconds value ) -> Settings& {  hardMarkWait = value; return *this;  }
+    auto  SetCommitWait( std::chrono::milliseconds value ) -> Settings& {  commitWait = value; return *this;  }
   };
 
   class Index
   {
     using Storage = mtc::api<IStorage::IIndexStore>;
+    using OnFilled = std::function<void(void*)>;
 
     Settings  openOptions;
     Storage   storageSink;
+    OnFilled  notifyOwner;
 
   public:
     auto  Set( const Settings& ) -> Index&;
     auto  Set( mtc::api<IStorage::IIndexStore> ) -> Index&;
+    auto  Set( OnFilled ) -> Index&;
 
   public:
     auto  Create() const -> mtc::api<IContentsIndex>;
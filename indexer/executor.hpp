@@ -0,0 +1,105 @@
+# if !defined( __DelphiX_indexer_executor_hpp__ )
+# define __DelphiX_indexer_executor_hpp__
+# include <condition_variable>
+# include <functional>
+# include <chrono>
+# include <thread>
+# include <vector>
+# include <mutex>
+# include <list>
+# include <map>
+
+namespace DelphiX {
+namespace indexer {
+
+ /*
+  * Executor runs the background work of the indexes (commits, merges, keys
+  * indexing and the layered index monitor) on the shared pool of threads.
+  *
+  * The tasks are run by priority classes, commit first; the merges, being the
+  * longest ones, never take the last thread of the pool, so the commits and
+  * the housekeeping are not stalled by the merges run.
+  *
+  * The threads are started on demand up to the count set; the tasks are tagged
+  * by the owner object to be cancelled before the owner is destroyed.
+  */
+  class Executor
+  {
+  public:
+    enum Priority: unsigned
+    {
+      commit = 0,
+      merge = 1,
+      housekeeping = 2
+    };
+
+    using Task = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
+
+  public:
+    Executor( unsigned nthreads = 0 );
+   ~Executor();
+
+   /*
+    * Get()
+    *
+    * Returns the library-wide executor used by all the indexes.
+    */
+    static  auto  Get() -> Executor&;
+
+   /*
+    * SetThreads( nthreads )
+    *
+    * Sets the count of threads, 0 means the default one; the threads above the
+    * count are stopped after the tasks run by them complete.
+    */
+    auto  SetThreads( unsigned ) -> Executor&;
+    auto  GetThreads() const -> unsigned;
+
+   /*
+    * Run( priority, owner, task[, delay] )
+    *
+    * Queues the task to be run in the priority class, or after the delay.  The
+    * tasks are expected to handle their own exceptions.
+    */
+    void  Run( Priority, const void*, Task );
+    void  Run( Priority, const void*, Task, Clock::duration );
+
+   /*
+    * Cancel( owner )
+    *
+    * Removes the tasks of the owner not started yet and returns their count;
+    * the tasks already run are not affected.
+    */
+    auto  Cancel( const void* ) -> size_t;
+
+  protected:
+    struct Queued
+    {
+      Priority    prio;
+      const void* owner;
+      Task        task;
+    };
+
+    void  Worker( size_t );
+    bool  GetNext( Queued&, bool );
+    auto  Pending() const -> size_t;
+    auto  Workers() const -> unsigned;
+    void  Spawn( size_t );
+
+  protected:
+    mutable std::mutex                  mxLock;
+    std::condition_variable             mxWait;
+    std::list<Queued>                   queues[3];      // by priority
+    std::multimap<Clock::time_point,
+      Queued>                           timers;         // delayed tasks
+    std::vector<std::thread>            workers;
+    unsigned                            nthreads;
+    unsigned                            nidle = 0;      // workers not running tasks
+    unsigned                            nmerges = 0;    // merges running
+
+  };
+
+}}
+
+# endif   // !__DelphiX_indexer_executor_hpp__
@@ -2,26 +2,60 @@
 # define __DelphiX_indexer_layered_contents_hpp__
 # include "../contents.hpp"
 # include "dynamic-contents.hpp"
+# include "merge-policy.hpp"
+# include "rate-limiter.hpp"
 # include <functional>
 
 namespace DelphiX {
 namespace indexer {
 namespace layered {
 
+ /*
+  * StartupStats is reported when the index is opened: the wall time of the
+  * opening and the time each static layer was opened, in the layers order.
+  */
+  struct StartupStats
+  {
+    std::chrono::microseconds               tmTotal;
+    std::vector<std::chrono::microseconds>  tmLayers;
+  };
+
   class Index
   {
+    using OnStartup = std::function<void(const StartupStats&)>;
+
     mtc::api<IStorage>    contentsStorage;
     dynamic::Settings     dynamicSettings;
+    mtc::api<IMergePolicy>  mergePolicy;
+    merge::Schedule       mergeSchedule;
+    io::Limits            ioLimits;
     std::chrono::seconds  runMonitorDelay = std::chrono::seconds( 0 );
+    OnStartup             startupReport;
 
   public:
     auto  Set( const dynamic::Settings& ) -> Index&;
     auto  Set( mtc::api<IStorage> ) -> Index&;
+    auto  Set( mtc::api<IMergePolicy> ) -> Index&;
+    auto  Set( const merge::Schedule& ) -> Index&;
+    auto  Set( const io::Limits& ) -> Index&;
+    auto  Set( OnStartup ) -> Index&;
     auto  Create() -> mtc::api<IContentsIndex>;
 
     static  auto  Create( const mtc::api<IContentsIndex>*, size_t ) -> mtc::api<IContentsIndex>;
     static  auto  Create( const std::vector<mtc::api<IContentsIndex>>& ) -> mtc::api<IContentsIndex>;
 
+   /*
+    * Partition( index, nparts )
+    *
+    * Splits the layered index to up to nparts read-only views, each one searching
+    * the key blocks of the group of adjacent layers, so the query may be run by the
+    * views in parallel.  The views keep the entity indices, the entities and the key
+    * statistics of the whole index, so the results are comparable.
+    *
+    * The other indices are returned as is.
+    */
+    static  auto  Partition( const mtc::api<IContentsIndex>&, unsigned ) -> std::vector<mtc::api<IContentsIndex>>;
+
   };
 
 }}}
@@ -0,0 +1,105 @@
+# if !defined( __DelphiX_indexer_merge_policy_hpp__ )
+# define __DelphiX_indexer_merge_policy_hpp__
+# include "../contents.hpp"
+# include <utility>
+
+namespace DelphiX {
+namespace indexer {
+
+ /*
+  * IMergePolicy selects the adjacent layers of the layered index to be merged
+  * into one.
+  */
+  struct IMergePolicy: mtc::Iface
+  {
+    struct Layer
+    {
+      IContentsIndex::IndexStats  stats;
+      bool                        canMerge;     // static layer, neither dynamic nor being merged
+    };
+
+   /*
+    * Select( layers, count )
+    *
+    * Returns the range [first, last) of adjacent layers to be merged, or empty
+    * range if nothing is to be merged.  The single layer range means the layer
+    * is rewritten to reclaim the deleted entities.
+    */
+    virtual auto  Select( const Layer*, size_t ) const -> std::pair<size_t, size_t> = 0;
+
+   /*
+    * WriteAmplification()
+    *
+    * Returns the expected count of writes of each entity, the commit included.
+    */
+    virtual auto  WriteAmplification() const -> double = 0;
+  };
+
+namespace merge {
+
+ /*
+  * Tiered policy merges the segments of similar size when there are too many
+  * of them; the tier sizes grow by maxSegments times.
+  */
+  struct Tiered
+  {
+    uint32_t  maxSegments = 10;                   /* segments in a tier before merging */
+    uint32_t  maxMergeAtOnce = 10;                /* segments merged at once */
+    uint64_t  targetSize = 4ULL * 1024 * 1024 * 1024;   /* 4 gig, merged segment size limit */
+    uint64_t  floorSize = 2 * 1024 * 1024;        /* 2 meg, smaller segments are counted as this size */
+    uint32_t  deletedPercent = 20;                /* % of deleted entities to reclaim the segment, 0 - never */
+
+  public:
+    auto  SetMaxSegments( uint32_t value ) -> Tiered& {  maxSegments = value; return *this;  }
+    auto  SetMaxMergeAtOnce( uint32_t value ) -> Tiered& {  maxMergeAtOnce = value; return *this;  }
+    auto  SetTargetSize( uint64_t value ) -> Tiered& {  targetSize = value; return *this;  }
+    auto  SetFloorSize( uint64_t value ) -> Tiered& {  floorSize = value; return *this;  }
+    auto  SetDeletedPercent( uint32_t value ) -> Tiered& {  deletedPercent = value; return *this;  }
+
+  public:
+    auto  Create() const -> mtc::api<IMergePolicy>;
+  };
+
+ /*
+  * Leveled policy keeps each segment at least fanout times larger than all the
+  * smaller segments together and merges the smaller ones into the larger one
+  * when violated; up to maxSegments of the smallest segments are tolerated.
+  */
+  struct Leveled
+  {
+    uint32_t  fanout = 10;                        /* size ratio of the adjacent levels */
+    uint32_t  maxSegments = 4;                    /* segments of the first level before merging */
+    uint64_t  targetSize = 4ULL * 1024 * 1024 * 1024;   /* 4 gig, merged segment size limit */
+    uint64_t  floorSize = 2 * 1024 * 1024;        /* 2 meg, smaller segments are counted as this size */
+    uint32_t  deletedPercent = 20;                /* % of deleted entities to reclaim the segment, 0 - never */
+
+  public:
+    auto  SetFanout( uint32_t value ) -> Leveled& {  fanout = value; return *this;  }
+    auto  SetMaxSegments( uint32_t value ) -> Leveled& {  maxSegments = value; return *this;  }
+    auto  SetTargetSize( uint64_t value ) -> Leveled& {  targetSize = value; return *this;  }
+    auto  SetFloorSize( uint64_t value ) -> Leveled& {  floorSize = value; return *this;  }
+    auto  SetDeletedPercent( uint32_t value ) -> Leveled& {  deletedPercent = value; return *this;  }
+
+  public:
+    auto  Create() const -> mtc::api<IMergePolicy>;
+  };
+
+ /*
+  * Schedule limits the merges run by the layered index concurrently and the
+  * threads taken by each of them.
+  */
+  struct Schedule
+  {
+    uint32_t  maxMerges = 2;                      /* merges run at once */
+    uint64_t  maxBytes = 0;                       /* total size of the layers being merged, 0 - unlimited */
+    uint32_t  maxThreads = 1;                     /* threads merging the keys of each merge */
+
+  public:
+    auto  SetMaxMerges( uint32_t value ) -> Schedule& {  maxMerges = value; return *this;  }
+    auto  SetMaxBytes( uint64_t value ) -> Schedule& {  maxBytes = value; return *this;  }
+    auto  SetMaxThreads( uint32_t value ) -> Schedule& {  maxThreads = value; return *this;  }
+  };
+
+}}}
+
+# endif   // !__DelphiX_indexer_merge_policy_hpp__
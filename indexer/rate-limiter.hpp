@@ -0,0 +1,90 @@
+# if !defined( __DelphiX_indexer_rate_limiter_hpp__ )
+# define __DelphiX_indexer_rate_limiter_hpp__
+# include "../contents.hpp"
+# include <chrono>
+
+namespace DelphiX {
+namespace indexer {
+
+ /*
+  * IRateLimiter limits the bandwidth of the background i/o, i.e. the merges
+  * and the commits, to leave the disk to the foreground queries.
+  */
+  struct IRateLimiter: mtc::Iface
+  {
+    struct Stats
+    {
+      uint64_t  cbTotal;          // bytes passed
+      uint64_t  cbPerSec;         // throughput measured for the last second
+      uint64_t  cbLimit;          // current limit, bytes per second, 0 - unlimited
+    };
+
+   /*
+    * Acquire( cbsize )
+    *
+    * Blocks the caller until the budget allows to read or write cbsize bytes.
+    */
+    virtual void  Acquire( size_t ) = 0;
+
+   /*
+    * Feedback( latency )
+    *
+    * Reports the latency of the foreground operation; the adaptive limiter backs
+    * off while the latency is above the target and restores the rate after.
+    */
+    virtual void  Feedback( std::chrono::microseconds ) = 0;
+
+    virtual auto  GetStats() const -> Stats = 0;
+  };
+
+namespace io {
+
+ /*
+  * TokenBucket limiter passes bytesPerSec with bursts up to burstSize; with
+  * target latency set, the rate is halved down to minBytesPerSec each time the
+  * averaged latency reported is above the target, and grows back by 1/16 of
+  * bytesPerSec each 100 milliseconds while below or while no latency is reported.
+  */
+  struct TokenBucket
+  {
+    uint64_t  bytesPerSec = 0;                    /* 0 - unlimited, the throughput is counted only */
+    uint64_t  burstSize = 1024 * 1024;            /* 1 meg */
+    uint64_t  minBytesPerSec = 0;                 /* back off limit, 0 - bytesPerSec / 16 */
+    std::chrono::microseconds targetLatency{ 0 }; /* 0 - not adaptive */
+
+  public:
+    auto  SetBytesPerSec( uint64_t value ) -> TokenBucket& {  bytesPerSec = value; return *this;  }
+    auto  SetBurstSize( uint64_t value ) -> TokenBucket& {  burstSize = value; return *this;  }
+    auto  SetMinBytesPerSec( uint64_t value ) -> TokenBucket& {  minBytesPerSec = value; return *this;  }
+    auto  SetTargetLatency( std::chrono::microseconds value ) -> TokenBucket& {  targetLatency = value; return *this;  }
+
+  public:
+    auto  Create() const -> mtc::api<IRateLimiter>;
+  };
+
+ /*
+  * Limits are the separate budgets of the merges (both the source reads and
+  * the output) and of the commits of the dynamic indices.
+  */
+  struct Limits
+  {
+    mtc::api<IRateLimiter>  merge;
+    mtc::api<IRateLimiter>  commit;
+
+  public:
+    auto  SetMerge( mtc::api<IRateLimiter> value ) -> Limits& {  merge = value; return *this;  }
+    auto  SetCommit( mtc::api<IRateLimiter> value ) -> Limits& {  commit = value; return *this;  }
+  };
+
+ /*
+  * Throttle( store, limiter )
+  *
+  * Returns the store writing the index streams through the limiter, or the
+  * store itself if no limiter is set.  The bundles and spilled pages are
+  * written by the foreground indexing and are passed as is.
+  */
+  auto  Throttle( mtc::api<IStorage::IIndexStore>, mtc::api<IRateLimiter> ) -> mtc::api<IStorage::IIndexStore>;
+
+}}}
+
+# endif   // !__DelphiX_indexer_rate_limiter_hpp__
@@ -0,0 +1,44 @@
+# if !defined( __DelphiX_queries_parallel_hpp__ )
+# define __DelphiX_queries_parallel_hpp__
+# include "../indexer/executor.hpp"
+# include "../contents.hpp"
+# include "../queries.hpp"
+# include <functional>
+# include <vector>
+
+namespace DelphiX {
+namespace queries {
+
+  struct Scored
+  {
+    uint32_t  uEntity;
+    double    fRange;
+  };
+
+  using MakeQuery = std::function<mtc::api<IQuery>( const mtc::api<IContentsIndex>& )>;
+  using RankQuery = std::function<double( uint32_t, const Abstract& )>;
+
+ /*
+  * SearchTopK( parts, make, rank, topK[, executor] )
+  *
+  * Builds and runs the query for each part of the index independently, and
+  * merges the best topK entities of each part ranked by the function passed.
+  * The calling thread and the executor take the parts not started one by one,
+  * so the search is not stalled by the executor being busy.
+  *
+  * The parts are expected to be got by layered::Index::Partition(), and the
+  * queries to be built with the terms ranked by the whole index, so the ranks
+  * of the parts are comparable.  The rank function is called concurrently.
+  *
+  * The results are ordered by the rank decreasing, then by the entity index.
+  */
+  auto  SearchTopK(
+    const std::vector<mtc::api<IContentsIndex>>&  parts,
+    const MakeQuery&                              make,
+    const RankQuery&                              rank,
+    size_t                                        topK,
+    indexer::Executor&                            executor = indexer::Executor::Get() ) -> std::vector<Scored>;
+
+}}
+
+# endif   // !__DelphiX_queries_parallel_hpp__
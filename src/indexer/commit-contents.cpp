@@ -1,4 +1,5 @@
 # include "../../indexer/static-contents.hpp"
+# include "../../indexer/executor.hpp"
 # include "commit-contents.hpp"
 # include "override-entities.hpp"
 # include "dynamic-bitmap.hpp"
@@ -7,7 +8,6 @@
 # include <mtc/recursive_shared_mutex.hpp>
 # include <condition_variable>
 # include <stdexcept>
-# include <thread>
 
 namespace DelphiX {
 namespace indexer {
@@ -40,10 +40,8 @@ namespace commit  {
     auto  GetKeyBlock( const std::string_view& ) const -> mtc::api<IEntities> override;
     auto  GetKeyStats( const std::string_view& ) const -> BlockInfo override;
 
-    auto  ListEntities( EntityId ) -> mtc::api<IEntitiesList> override
-      {  throw std::runtime_error( "not implemented @" __FILE__ ":" LINE_STRING );  }
-    auto  ListEntities( uint32_t ) -> mtc::api<IEntitiesList> override
-      {  throw std::runtime_error( "not implemented @" __FILE__ ":" LINE_STRING );  }
+    auto  ListEntities( EntityId ) -> mtc::api<IEntitiesList> override;
+    auto  ListEntities( uint32_t ) -> mtc::api<IEntitiesList> override;
     auto  ListContents( const std::string_view& ) -> mtc::api<IContentsList> override;
 
     auto  Commit() -> mtc::api<IStorage::ISerialized> override;
@@ -51,8 +49,10 @@ namespace commit  {
     void  Remove() override;
     void  Stash( EntityId ) override  {}
 
+    auto  GetIndexStats() const -> IndexStats override;
+
   protected:
-    void  CommitThreadFunc();
+    void  CommitTask();
 
   protected:
     mutable std::shared_mutex     swLock;   // switch mutex
@@ -67,7 +67,7 @@ namespace commit  {
     Bitmap<>                      banset;
     mutable PatchTable<>          hpatch;
 
-    std::thread                   commit;
+    bool                          active = false;   // the commit task is queued or run
     std::exception_ptr            except;
 
   };
@@ -82,20 +82,27 @@ namespace commit  {
 
   ContentsIndex::~ContentsIndex()
   {
-    if ( commit.joinable() )
-      commit.join();
+    auto  exlock = mtc::make_unique_lock( s_lock );
+
+    if ( Executor::Get().Cancel( this ) == 0 )
+      s_wait.wait( exlock, [&](){  return !active;  } );
   }
 
   auto  ContentsIndex::StartCommit() -> mtc::api<IContentsIndex>
   {
-    commit = std::thread( &ContentsIndex::CommitThreadFunc, this );
+    active = true;
+    Executor::Get().Run( Executor::commit, this, [this](){  CommitTask();  } );
     return this;
   }
 
-  void  ContentsIndex::CommitThreadFunc()
+ /*
+  * CommitTask()
+  *
+  * Serializes the source index and opens the static one in the executor thread;
+  * the task is marked finished after the owner is notified.
+  */
+  void  ContentsIndex::CommitTask()
   {
-    pthread_setname_np( pthread_self(), "commit::Flush()" );
-
   // first commit index to the storage
   // then try open the new static index from the storage
     try
@@ -122,6 +129,12 @@ namespace commit  {
       if ( notify != nullptr )
         notify( this, Notify::Event::Failed );
     }
+
+    mtc::interlocked( mtc::make_unique_lock( s_lock ), [&]()
+      {
+        active = false;
+        s_wait.notify_all();
+      } );
   }
 
   auto  ContentsIndex::GetEntity( EntityId id ) const -> mtc::api<const IEntity>
@@ -263,6 +276,42 @@ namespace commit  {
     return (output != nullptr ? output : source)->GetKeyStats( key );
   }
 
+  auto  ContentsIndex::GetIndexStats() const -> IndexStats
+  {
+    auto  shlock = mtc::make_shared_lock( swLock );
+
+    if ( except != nullptr )
+      std::rethrow_exception( except );
+
+    return (output != nullptr ? output : source)->GetIndexStats();
+  }
+
+  auto  ContentsIndex::ListEntities( EntityId id ) -> mtc::api<IEntitiesList>
+  {
+    auto  shlock = mtc::make_shared_lock( swLock );
+
+    if ( except != nullptr )
+      std::rethrow_exception( except );
+
+    if ( output != nullptr )
+      return output->ListEntities( id );
+
+    return new Override::EntitiesList<PatchTable<>>( source->ListEntities( id ), hpatch, this );
+  }
+
+  auto  ContentsIndex::ListEntities( uint32_t ix ) -> mtc::api<IEntitiesList>
+  {
+    auto  shlock = mtc::make_shared_lock( swLock );
+
+    if ( except != nullptr )
+      std::rethrow_exception( except );
+
+    if ( output != nullptr )
+      return output->ListEntities( ix );
+
+    return new Override::EntitiesList<PatchTable<>>( source->ListEntities( ix ), hpatch, this );
+  }
+
   auto  ContentsIndex::ListContents( const std::string_view& key ) -> mtc::api<IContentsList>
   {
     return interlocked( mtc::make_shared_lock( swLock ), [&]()
@@ -283,8 +332,9 @@ namespace commit  {
   auto  ContentsIndex::Reduce() -> mtc::api<IContentsIndex>
   {
   // wait until the commit completes
-    if ( commit.joinable() )
-      commit.join();
+    auto  exlock = mtc::make_unique_lock( s_lock );
+      s_wait.wait( exlock, [&](){  return !active;  } );
+    exlock.unlock();
 
     if ( except != nullptr )
       std::rethrow_exception( except );
@@ -1,8 +1,15 @@
 # include "contents-index-merger.hpp"
 # include "dynamic-entities.hpp"
+# include "io-throttle.hpp"
+# include "loser-tree.hpp"
+# include "../../indexer/executor.hpp"
 # include "../../compat.hpp"
+# include <mtc/recursive_shared_mutex.hpp>
 # include <mtc/radix-tree.hpp>
 # include <stdexcept>
+# include <algorithm>
+# include <memory>
+# include <deque>
 
 namespace DelphiX {
 namespace indexer {
@@ -49,6 +56,11 @@ namespace fusion {
       {  return curValue;  }
     auto  Next() -> const std::string&
       {  return curValue = iterator->Next();  }
+    auto  Take() -> std::string
+      {
+        auto  prev = std::move( curValue );
+        return curValue = iterator->Next(), prev;
+      }
 
   };
 
@@ -56,8 +68,214 @@ namespace fusion {
   {
     mtc::api<IContentsIndex::IEntities> entityBlock;
     const std::vector<uint32_t>*        mapEntities;
+    bool                                isMonotone;   // the mapping keeps the order of entities
+    uint32_t                            rebaseId;     // the shift of the entities renumbered contiguously, or -1
+  };
+
+ /*
+  * RawBlock is the serialized block of the source renumbered contiguously; it
+  * is copied to the output with only the first delta rewritten.
+  */
+  struct RawBlock
+  {
+    uint32_t          uFirst = uint32_t(-1);    // the first and the last entities remapped
+    uint32_t          uLast = 0;
+    uint32_t          nCount = 0;
+    std::string_view  trailer;                  // the block following the first delta
+  };
+
+ /*
+  * ScanBlock( block )
+  *
+  * Returns the raw block of the source renumbered contiguously; the deltas are
+  * skipped through to get the last entity, the references are not decoded.
+  */
+  static  auto  ScanBlock( const MapEntities& block ) -> RawBlock
+  {
+    auto  serial = std::string_view();
+    auto  output = RawBlock();
+    auto  uEntity = uint32_t(0);
+
+    if ( block.rebaseId == uint32_t(-1) || (serial = block.entityBlock->GetBlock()).empty() )
+      return output;
+
+    for ( auto ptrtop = serial.data(), ptrend = ptrtop + serial.size(); ptrtop != ptrend; ++output.nCount )
+    {
+      unsigned  udelta;
+      unsigned  ublock;
+
+      if ( (ptrtop = ::FetchFrom( ptrtop, udelta )) == nullptr || ptrtop > ptrend )
+        return RawBlock();
+
+      if ( output.nCount == 0 )
+      {
+        output.uFirst = udelta + 1 + block.rebaseId;
+        output.trailer = { ptrtop, size_t(ptrend - ptrtop) };
+      }
+
+      uEntity += udelta + 1;
+
+      if ( block.entityBlock->Type() != 0 )
+      {
+        if ( (ptrtop = ::FetchFrom( ptrtop, ublock )) == nullptr || ublock > size_t(ptrend - ptrtop) )
+          return RawBlock();
+        ptrtop += ublock;
+      }
+    }
+
+    return output.uLast = uEntity + block.rebaseId, output;
+  }
+
+ /*
+  * CopyBlock( output, block, uOldId )
+  *
+  * Writes the raw block following the entity uOldId and returns its length.
+  */
+  static  auto  CopyBlock( mtc::IByteStream* output, const RawBlock& block, uint32_t uOldId ) -> size_t
+  {
+    auto  diffId = block.uFirst - uOldId - 1;
+
+    if ( ::Serialize( ::Serialize( output,
+      diffId ), block.trailer.data(), block.trailer.size() ) == nullptr )
+    {
+      throw std::runtime_error( "Failed to serialize entities" );
+    }
+    return ::GetBufLen( diffId ) + block.trailer.size();
+  }
+
+ /*
+  * BlockCursor lists the references of the source block with the entities
+  * remapped, or the references buffered and sorted, or the raw block as one
+  * item keyed by its first entity.
+  */
+  class BlockCursor
+  {
+    const MapEntities*      mapBlock = nullptr;
+    const EntityReference*  pointer = nullptr;
+    const EntityReference*  pointEnd = nullptr;
+    EntityReference         curValue;
+    RawBlock                rawBlock;
+
+  public:
+    BlockCursor( const MapEntities& block ): mapBlock( &block )
+      {  Search( block.entityBlock->Find( 0 ) );  }
+    BlockCursor( const std::vector<EntityReference>& sorted ):
+      pointer( sorted.data() ), pointEnd( sorted.data() + sorted.size() )
+      {  curValue = pointer != pointEnd ? *pointer : EntityReference{ uint32_t(-1), {} };  }
+    BlockCursor( const RawBlock& block ): curValue{ block.uFirst, {} }, rawBlock( block ) {}
+
+  public:
+    auto  Curr() const -> const EntityReference&  {  return curValue;  }
+    auto  Raw() const -> const RawBlock&  {  return rawBlock;  }
+    void  Next()
+      {
+        if ( mapBlock != nullptr )
+          return Search( mapBlock->entityBlock->Find( 1 + lastFind ) );
+        if ( rawBlock.nCount != 0 )
+          return (void)(curValue = { uint32_t(-1), {} }, rawBlock = RawBlock());
+        curValue = ++pointer < pointEnd ? *pointer : EntityReference{ uint32_t(-1), {} };
+      }
+
+  protected:
+    void  Search( EntityReference entry )
+      {
+        for ( ; entry.uEntity != uint32_t(-1); entry = mapBlock->entityBlock->Find( 1 + entry.uEntity ) )
+        {
+          auto  mapped = mapBlock->mapEntities->at( entry.uEntity );
+
+          if ( mapped != 0 && mapped != uint32_t(-1) )
+          {
+            lastFind = entry.uEntity;
+            curValue = { mapped, entry.details };
+            return;
+          }
+        }
+        curValue = { uint32_t(-1), {} };
+      }
+
+  protected:
+    uint32_t  lastFind = 0;
+
   };
 
+ /*
+  * MergeBlocks( buffer, blocks, serialize, copy )
+  *
+  * Passes the references of the blocks to serialize() ordered by the entities
+  * remapped.  The blocks of the sources with the monotone mapping are merged
+  * as is, and only the references of the other ones are buffered and sorted.
+  *
+  * The blocks of the sources renumbered contiguously cover the ranges of the
+  * entities not intersected by the other sources, and are passed to copy() as
+  * the raw blocks.
+  */
+  template <class Serialize, class Copy>
+  auto  MergeBlocks(
+    std::vector<EntityReference>&   buffer,
+    const std::vector<MapEntities>& blocks,
+    Serialize                       serialize,
+    Copy                            copy ) -> uint32_t
+  {
+    auto      cursors = std::vector<BlockCursor>();
+    auto      rawBlock = RawBlock();
+    uint32_t  ncount = 0;
+
+    for ( auto& block: blocks )
+    {
+      if ( (rawBlock = ScanBlock( block )).nCount != 0 )
+      {
+        cursors.emplace_back( rawBlock );
+        continue;
+      }
+
+      if ( block.isMonotone )
+      {
+        cursors.emplace_back( block );
+        continue;
+      }
+
+      // list all the references in the block
+      for ( auto entry = block.entityBlock->Find( 0 ); entry.uEntity != uint32_t(-1); entry = block.entityBlock->Find( 1 + entry.uEntity ) )
+      {
+        uint32_t  mapped;
+
+        if ( (mapped = block.mapEntities->at( entry.uEntity )) != 0 && mapped != uint32_t(-1) )
+        {
+          if ( buffer.size() == buffer.capacity() )
+            buffer.reserve( buffer.capacity() + 0x10000 );
+          buffer.push_back( { mapped, entry.details } );
+        }
+      }
+    }
+
+    // check if any objects in a buffer, resort and merge with the other blocks
+    if ( !buffer.empty() )
+    {
+      std::sort( buffer.begin(), buffer.end(), []( const EntityReference& a, const EntityReference& b )
+        {  return a.uEntity < b.uEntity; } );
+      cursors.emplace_back( buffer );
+    }
+
+    if ( cursors.empty() )
+      return 0;
+
+    auto  selector = LoserTree( cursors.size(), [&]( size_t a, size_t b )
+      {  return cursors[a].Curr().uEntity < cursors[b].Curr().uEntity;  } );
+
+    for ( auto ptop = &cursors[selector.Top()]; ptop->Curr().uEntity != uint32_t(-1); ptop = &cursors[selector.Top()] )
+    {
+      if ( ptop->Raw().nCount != 0 )
+        copy( ptop->Raw() ), ncount += ptop->Raw().nCount;
+      else
+        serialize( ptop->Curr() ), ++ncount;
+
+      ptop->Next();
+        selector.Update();
+    }
+
+    return ncount;
+  }
+
   struct RadixLink
   {
     uint32_t  bkType;
@@ -87,40 +305,24 @@ namespace fusion {
   {
     uint64_t  length = 0;
     uint32_t  uOldId = 0;
-
-    for ( auto& block: blocks )
-    {
-      uint32_t  mapped;
-
-      // list all the references in the block
-      for ( auto entry = block.entityBlock->Find( 0 ); entry.uEntity != uint32_t(-1); entry = block.entityBlock->Find( 1 + entry.uEntity ) )
+    uint32_t  ncount = MergeBlocks( buffer, blocks, [&]( const EntityReference& reference )
       {
-        if ( (mapped = block.mapEntities->at( entry.uEntity )) != uint32_t(-1) )
-        {
-          if ( buffer.size() == buffer.capacity() )
-            buffer.reserve( buffer.capacity() + 0x10000 );
-          buffer.push_back( { mapped, entry.details } );
-        }
-      }
-    }
-
-    // check if any objects in a buffer, resort, serialize and return the length
-    std::sort( buffer.begin(), buffer.end(), []( const EntityReference& a, const EntityReference& b )
-      {  return a.uEntity < b.uEntity; } );
-
-    for ( auto& reference: buffer )
-    {
-      auto  diffId = reference.uEntity - uOldId - 1;
+        auto  diffId = reference.uEntity - uOldId - 1;
 
-      if ( ::Serialize( output.ptr(), diffId ) == nullptr )
-        throw std::runtime_error( "Failed to serialize entities" );
+        if ( ::Serialize( output.ptr(), diffId ) == nullptr )
+          throw std::runtime_error( "Failed to serialize entities" );
 
-      if ( (length += ::GetBufLen( diffId )) >= uint32_t(-1) )
-        throw std::logic_error( "index block too long @" __FILE__ ":" LINE_STRING );
-      uOldId = reference.uEntity;
-    }
+        if ( (length += ::GetBufLen( diffId )) >= uint32_t(-1) )
+          throw std::logic_error( "index block too long @" __FILE__ ":" LINE_STRING );
+        uOldId = reference.uEntity;
+      }, [&]( const RawBlock& block )
+      {
+        if ( (length += CopyBlock( output.ptr(), block, uOldId )) >= uint32_t(-1) )
+          throw std::logic_error( "index block too long @" __FILE__ ":" LINE_STRING );
+        uOldId = block.uLast;
+      } );
 
-    return { uint32_t(buffer.size()), uint32_t(length) };
+    return { ncount, uint32_t(length) };
   }
 
   auto  MergeChains(
@@ -130,44 +332,67 @@ namespace fusion {
   {
     uint32_t  length = 0;
     uint32_t  uOldId = 0;
-
-    for ( auto& block: blocks )
-    {
-      uint32_t  mapped;
-
-      // list all the references in the block
-      for ( auto entry = block.entityBlock->Find( 0 ); entry.uEntity != uint32_t(-1); entry = block.entityBlock->Find( 1 + entry.uEntity ) )
+    uint32_t  ncount = MergeBlocks( buffer, blocks, [&]( const EntityReference& reference )
       {
-        if ( (mapped = block.mapEntities->at( entry.uEntity )) != uint32_t(-1) )
+        auto  diffId = reference.uEntity - uOldId - 1;
+        auto  nbytes = reference.details.size();
+
+        if ( ::Serialize( ::Serialize( ::Serialize( output.ptr(),
+          diffId ),
+          nbytes ), reference.details.data(), nbytes )  == nullptr )
         {
-          if ( buffer.size() == buffer.capacity() )
-            buffer.reserve( buffer.capacity() + 0x10000 );
-          buffer.push_back( { mapped, entry.details } );
+          throw std::runtime_error( "Failed to serialize entities" );
         }
-      }
-    }
 
-    // check if any objects in a buffer, resort, serialize and return the length
-    std::sort( buffer.begin(), buffer.end(), []( const EntityReference& a, const EntityReference& b )
-      {  return a.uEntity < b.uEntity; } );
+        length += uint32_t(::GetBufLen( diffId ) + ::GetBufLen( nbytes ) + nbytes);
+        uOldId = reference.uEntity;
+      }, [&]( const RawBlock& block )
+      {
+        length += uint32_t(CopyBlock( output.ptr(), block, uOldId ));
+        uOldId = block.uLast;
+      } );
 
-    for ( auto& reference: buffer )
-    {
-      auto  diffId = reference.uEntity - uOldId - 1;
-      auto  nbytes = reference.details.size();
+    return { ncount, length };
+  }
+
+ /*
+  * IsMonotone( mapping )
+  *
+  * Checks if the entities kept are renumbered in the same order, which is true
+  * for the sources merged before, having the entities ordered by the ids; zero
+  * is left for the entities not listed, i.e. deleted.
+  */
+  static  bool  IsMonotone( const std::vector<uint32_t>& mapping )
+  {
+    auto  uLast = uint32_t(0);
 
-      if ( ::Serialize( ::Serialize( ::Serialize( output.ptr(),
-        diffId ),
-        nbytes ), reference.details.data(), nbytes )  == nullptr )
+    for ( auto mapped: mapping )
+      if ( mapped != 0 && mapped != uint32_t(-1) )
       {
-        throw std::runtime_error( "Failed to serialize entities" );
+        if ( mapped <= uLast )
+          return false;
+        uLast = mapped;
       }
+    return true;
+  }
 
-      length += uint32_t(::GetBufLen( diffId ) + ::GetBufLen( nbytes ) + nbytes);
-      uOldId = reference.uEntity;
-    }
+ /*
+  * GetRebase( mapping )
+  *
+  * Returns the shift of the entities if all of them are kept and renumbered
+  * to the contiguous range, i.e. the source has neither deleted nor outdated
+  * entities, or -1 otherwise.
+  */
+  static  auto  GetRebase( const std::vector<uint32_t>& mapping ) -> uint32_t
+  {
+    if ( mapping.size() < 3 || mapping[1] == 0 || mapping[1] == uint32_t(-1) )
+      return uint32_t(-1);
 
-    return { uint32_t(buffer.size()), length };
+    for ( size_t i = 1; i + 1 < mapping.size(); ++i )
+      if ( mapping[i] != mapping[1] + i - 1 )
+        return uint32_t(-1);
+
+    return mapping[1] - 1;
   }
 
   void  ContentsMerger::MergeEntities()
@@ -175,9 +400,10 @@ namespace fusion {
     using Entity = dynamic::EntityTable<std::allocator<char>>::Entity;
 
     auto  iterators = std::vector<EntityIterator>();
-    auto  selectSet = std::vector<size_t>( indices.size() );
+    auto  selectSet = std::vector<std::pair<size_t, mtc::api<const IEntity>>>();
     auto  entityStm = storage->Entities();
     auto  bundleStm = storage->Packages();
+    auto  ioCharge = io::Charger( limiter );
 
   // create iterators list
     for ( auto& next: indices )
@@ -187,128 +413,493 @@ namespace fusion {
     if ( Entity( std::allocator<char>() ).Serialize( entityStm.ptr() ) == nullptr )
       throw std::runtime_error( "Failed to serialize entities" );
 
-    for ( auto entityId = uint32_t(1); ; )
+    if ( iterators.empty() )
+      return;
+
+    auto  selector = LoserTree( iterators.size(), [&]( size_t a, size_t b )
+      {
+        return !iterators[a].Curr().empty()
+          && (iterators[b].Curr().empty() || iterators[a].Curr().compare( iterators[b].Curr() ) < 0);
+      } );
+
+    for ( auto entityId = uint32_t(1); !iterators[selector.Top()].Curr().empty(); )
     {
-      auto  nCount = size_t(0);
-      auto  iFresh = size_t(-1);
+      auto  select = iterators[selector.Top()].Curr();    // the entity is held by selectSet
+      auto  iFresh = size_t(0);
 
-    // find entity with minimal id and select the one with bigger Version
-      for ( size_t i = 0; i != iterators.size(); ++i )
+    // take the entities with minimal id from all the sources and select the one
+    // with bigger version
+      for ( selectSet.clear(); ; )
       {
-        if ( iterators[i].Curr().empty() )
-          continue;
+        auto  itop = selector.Top();
 
-        if ( nCount == 0 || iterators[selectSet[nCount - 1]].Curr().compare( iterators[i].Curr() ) > 0 )
-        {
-          selectSet[(nCount = 1), 0] = iFresh = i;
-        }
-          else
-        if ( iterators[selectSet[nCount - 1]].Curr().compare( iterators[i].Curr() ) == 0 )
-        {
-          selectSet[nCount++] = i;
+        selectSet.emplace_back( itop, iterators[itop].operator->() );
 
-          if ( iterators[i]->GetVersion() > iterators[iFresh]->GetVersion() )
-            iFresh = i;
-        }
+        if ( selectSet.back().second->GetVersion() > selectSet[iFresh].second->GetVersion() )
+          iFresh = selectSet.size() - 1;
+
+        iterators[itop].Next();
+          selector.Update();
+
+        if ( iterators[selector.Top()].Curr().empty() || iterators[selector.Top()].Curr().compare( select ) != 0 )
+          break;
       }
 
-    // check if no more entities
-      if ( nCount != 0 )
+      auto  bundlePos = int64_t(-1);
+      auto  bundlePtr = mtc::api<const mtc::IByteBuffer>();
+      auto  freshPtr = selectSet[iFresh].second;
+      auto  extrasPtr = freshPtr->GetExtra();
+      auto  packaged = freshPtr->GetPackage();
+
+    // the bundles kept by the dump stores are copied store to store, without
+    // being read to memory
+      if ( bundleStm != nullptr && packaged.first != nullptr )
       {
-        auto  bundlePos = int64_t(-1);
-        auto  bundlePtr = mtc::api<const mtc::IByteBuffer>();
-
-        if ( bundleStm != nullptr && (bundlePtr = iterators[iFresh]->GetBundle()) != nullptr )
-          bundlePos = bundleStm->Put( bundlePtr->GetPtr(), bundlePtr->GetLen() );
-
-        if ( Entity( std::allocator<char>() )
-          .SetId( iterators[iFresh].Curr() )
-          .SetIndex( entityId )
-          .SetExtra( make_view( iterators[iFresh]->GetExtra() ) )
-          .SetPackPos( bundlePos )
-          .SetVersion( iterators[iFresh]->GetVersion() ).Serialize( entityStm.ptr() ) == nullptr )
-        {
-          throw std::runtime_error( "Failed to serialize entities" );
-        }
+        auto  copied = bundleStm->Copy( packaged.first.ptr(), packaged.second );
 
-      // fill renumbering maps and request next documents
-        for ( size_t i = 0; i != nCount; ++i )
-        {
-          if ( selectSet[i] == iFresh )
-            remapId[selectSet[i]][iterators[selectSet[i]]->GetIndex()] = entityId++;
-          else
-            remapId[selectSet[i]][iterators[selectSet[i]]->GetIndex()] = uint32_t(-1);
+        ioCharge( copied.second * 2 );          // the bundle is both read and written
+        bundlePos = copied.first;
+      }
+        else
+      if ( bundleStm != nullptr && (bundlePtr = freshPtr->GetBundle()) != nullptr )
+      {
+        ioCharge( bundlePtr->GetLen() * 2 );
+        bundlePos = bundleStm->Put( bundlePtr->GetPtr(), bundlePtr->GetLen() );
+      }
 
-          iterators[selectSet[i]].Next();
-        }
-      } else break;
+      ioCharge( select.size() + make_view( extrasPtr ).size() );
+
+      if ( Entity( std::allocator<char>() )
+        .SetId( select )
+        .SetIndex( entityId )
+        .SetExtra( make_view( extrasPtr ) )
+        .SetPackPos( bundlePos )
+        .SetVersion( freshPtr->GetVersion() ).Serialize( entityStm.ptr() ) == nullptr )
+      {
+        throw std::runtime_error( "Failed to serialize entities" );
+      }
+
+    // fill renumbering maps
+      for ( size_t i = 0; i != selectSet.size(); ++i )
+      {
+        remapId[selectSet[i].first][selectSet[i].second->GetIndex()] = i == iFresh ?
+          entityId++ : uint32_t(-1);
+      }
+    }
+
+  // check the sources keeping the order of entities, i.e. the ones merged before
+    for ( size_t i = 0; i != remapId.size(); ++i )
+    {
+      monotone[i] = IsMonotone( remapId[i] );
+      rebaseId[i] = GetRebase( remapId[i] );
+    }
+  }
+
+  constexpr size_t rangeSize = 0x1000;     // the keys merged by a worker at once
+  constexpr size_t rangeBytes = 0x100000;  // the estimated chunk merged by a worker at once
+  constexpr size_t queueBytes = 0x2000000; // the estimated chunks queued and not emitted
+
+ /*
+  * EstimateKey( stats )
+  *
+  * Roughly estimates the length of the merged block of the key by the count of
+  * the entities, so the ranges are cut by the size of the chunks.
+  */
+  static  auto  EstimateKey( const IContentsIndex::BlockInfo& stats ) -> size_t
+  {
+    return size_t(stats.nCount) * (stats.bkType == 0 ? 2 : 8);
+  }
+
+  // ContentsMerger::KeyRange
+
+ /*
+  * KeyRange is the run of the keys merged by one worker: the keys with the
+  * sources holding them, and the linkage chunk merged with the records of the
+  * keys pointing into the chunk.
+  */
+  struct ContentsMerger::KeyRange
+  {
+    enum: unsigned
+    {
+      queued = 0,
+      merging = 1,
+      merged = 2
+    };
+
+    std::vector<std::string>                    keys;
+    std::vector<uint32_t>                       ksrcs;    // the sources of the keys
+    std::vector<uint32_t>                       kends;    // the end of the sources of each key in ksrcs
+    std::string                                 linkage;
+    std::vector<std::pair<uint32_t, RadixLink>> records;  // the index of the key and the record
+    uint64_t                                    length = 0;   // the chunk merged
+    size_t                                      cbsize = 0;   // the chunk estimated
+    unsigned                                    state = queued;
+  };
+
+  // ContentsMerger::KeyRanges
+
+ /*
+  * KeyRanges runs the key ranges through the workers and passes the chunks
+  * merged to the linkages output and the radix tree in the order of keys.
+  *
+  * The caller thread does the same work as the workers when the count or the
+  * estimated size of the ranges queued reaches the limit, so the merge is never
+  * stalled by the pool being busy; the chunks are emitted by the caller thread
+  * only.
+  *
+  * With no workers, the ranges are merged by the caller straight to the linkages
+  * output, and the chunks are not buffered.
+  */
+  class ContentsMerger::KeyRanges
+  {
+    using RangePtr = std::unique_ptr<KeyRange>;
+
+    class ChunkStream final: public mtc::IByteStream
+    {
+      implement_lifetime_stub
+
+    public:
+      ChunkStream( std::string& out ): output( out ) {}
+
+      uint32_t  Get( void*, uint32_t ) override {  return 0;  }
+      uint32_t  Put( const void* p, uint32_t l ) override
+        {  return output.append( (const char*)p, l ), l;  }
+
+    protected:
+      std::string&  output;
+    };
+
+  public:
+    KeyRanges( const ContentsMerger&, mtc::api<mtc::IByteStream>, mtc::radix::tree<RadixLink>&, unsigned );
+   ~KeyRanges();
+
+    void  Put( RangePtr&& );
+    void  Finish();
+
+    static  void  Merge( const ContentsMerger&, KeyRange&, mtc::api<mtc::IByteStream> );
+
+  protected:
+    auto  GetQueued() const -> KeyRange*;
+    bool  MergeNext( std::unique_lock<std::mutex>& );
+    void  WaitFront( std::unique_lock<std::mutex>& );
+    void  Flush( std::unique_lock<std::mutex>& );
+    void  Emit( const KeyRange& );
+    void  Worker();
+
+  protected:
+    const ContentsMerger&           merger;
+    mtc::api<mtc::IByteStream>      chains;
+    mtc::radix::tree<RadixLink>&    radixTree;
+    uint64_t                        offset = 0;
+    size_t                          maxQueue;
+
+    std::mutex                      mxlock;
+    std::condition_variable         mxwait;
+    std::deque<RangePtr>            pending;        // in the order of keys
+    size_t                          cbqueue = 0;    // the chunks pending estimated
+    std::exception_ptr              except;
+    bool                            stopped = false;
+    size_t                          nstarted = 0;   // the workers scheduled
+    size_t                          nstopped = 0;   // the workers finished
+
+  };
+
+  ContentsMerger::KeyRanges::KeyRanges(
+    const ContentsMerger&         merge,
+    mtc::api<mtc::IByteStream>    output,
+    mtc::radix::tree<RadixLink>&  rtree,
+    unsigned                      nthreads ):
+      merger( merge ),
+      chains( output ),
+      radixTree( rtree ),
+      maxQueue( 2 * std::max( nthreads, 1U ) )
+  {
+    for ( ; nstarted + 1 < nthreads; ++nstarted )
+      Executor::Get().Run( Executor::merge, this, [this](){  Worker();  } );
+  }
+
+  ContentsMerger::KeyRanges::~KeyRanges()
+  {
+    mtc::interlocked( mtc::make_unique_lock( mxlock ), [&]()
+      {
+        stopped = true;
+        mxwait.notify_all();
+      } );
+
+  // the workers not started are removed, the others are waited for
+    auto  ncancel = Executor::Get().Cancel( this );
+    auto  exwait = mtc::make_unique_lock( mxlock );
+
+    mxwait.wait( exwait, [&](){  return nstopped + ncancel == nstarted;  } );
+  }
+
+ /*
+  * Put( range )
+  *
+  * Queues the range to be merged, emitting the ranges already merged before;
+  * the caller merges the ranges itself while the queue is full.  With no workers,
+  * the range is merged and emitted at once.
+  */
+  void  ContentsMerger::KeyRanges::Put( RangePtr&& range )
+  {
+    if ( nstarted == 0 )
+    {
+      Merge( merger, *range, chains );
+      return Emit( *range );
+    }
+
+    auto  exlock = mtc::make_unique_lock( mxlock );
+
+    for ( Flush( exlock ); !pending.empty() && (pending.size() >= maxQueue
+      || cbqueue + range->cbsize > queueBytes); Flush( exlock ) )
+    {
+      if ( !MergeNext( exlock ) )
+        WaitFront( exlock );
     }
+
+    cbqueue += range->cbsize;
+    pending.push_back( std::move( range ) );
+      mxwait.notify_one();
+  }
+
+ /*
+  * Finish()
+  *
+  * Merges and emits all the ranges queued.
+  */
+  void  ContentsMerger::KeyRanges::Finish()
+  {
+    auto  exlock = mtc::make_unique_lock( mxlock );
+
+    for ( Flush( exlock ); !pending.empty(); Flush( exlock ) )
+      if ( !MergeNext( exlock ) )
+        WaitFront( exlock );
+  }
+
+  auto  ContentsMerger::KeyRanges::GetQueued() const -> KeyRange*
+  {
+    for ( auto& next: pending )
+      if ( next->state == KeyRange::queued )
+        return next.get();
+    return nullptr;
+  }
+
+ /*
+  * MergeNext( exlock )
+  *
+  * Merges the first range queued out of the lock; returns false if there is
+  * no range to merge.
+  */
+  bool  ContentsMerger::KeyRanges::MergeNext( std::unique_lock<std::mutex>& exlock )
+  {
+    auto  range = GetQueued();
+    auto  error = std::exception_ptr();
+
+    if ( range == nullptr || except != nullptr )
+      return false;
+
+    auto  output = ChunkStream( range->linkage );
+
+    range->state = KeyRange::merging;
+      exlock.unlock();
+
+    try
+      {  Merge( merger, *range, &output );  }
+    catch ( ... )
+      {  error = std::current_exception();  }
+
+    exlock.lock();
+
+    if ( error != nullptr && except == nullptr )
+      except = error;
+    range->state = KeyRange::merged;
+      mxwait.notify_all();
+
+    return true;
+  }
+
+ /*
+  * WaitFront( exlock )
+  *
+  * Waits for the first range to be merged by the workers and rethrows the
+  * exception caught by any of them.
+  */
+  void  ContentsMerger::KeyRanges::WaitFront( std::unique_lock<std::mutex>& exlock )
+  {
+    mxwait.wait( exlock, [&]()
+      {  return except != nullptr || pending.empty() || pending.front()->state == KeyRange::merged;  } );
   }
 
+  void  ContentsMerger::KeyRanges::Flush( std::unique_lock<std::mutex>& exlock )
+  {
+    while ( except == nullptr && !pending.empty() && pending.front()->state == KeyRange::merged )
+    {
+      auto  range = std::move( pending.front() );
+
+      cbqueue -= range->cbsize;
+      pending.pop_front();
+        exlock.unlock();
+      Emit( *range );
+        exlock.lock();
+    }
+    if ( except != nullptr )
+      std::rethrow_exception( except );
+  }
+
+ /*
+  * Emit( range )
+  *
+  * Appends the chunk to the linkages and inserts the records of the keys with
+  * the offsets shifted by the length of the chunks emitted before; the chunk
+  * merged straight to the linkages is empty.
+  */
+  void  ContentsMerger::KeyRanges::Emit( const KeyRange& range )
+  {
+    for ( size_t ofs = 0; ofs != range.linkage.size(); )
+    {
+      auto  len = uint32_t(std::min( range.linkage.size() - ofs, size_t(0x40000000) ));
+
+      if ( chains->Put( range.linkage.data() + ofs, len ) != len )
+        throw std::runtime_error( "Failed to serialize entities" );
+      ofs += len;
+    }
+
+    for ( auto& next: range.records )
+    {
+      auto  keyRecord = next.second;
+
+      keyRecord.offset += offset;
+        radixTree.Insert( range.keys[next.first], keyRecord );
+    }
+
+    offset += range.length;
+  }
+
+  void  ContentsMerger::KeyRanges::Worker()
+  {
+    auto  exlock = mtc::make_unique_lock( mxlock );
+
+    for ( ; ; )
+    {
+      mxwait.wait( exlock, [&](){  return stopped || except != nullptr || GetQueued() != nullptr;  } );
+
+      if ( stopped || !MergeNext( exlock ) )
+        break;
+    }
+
+    ++nstopped;
+      mxwait.notify_all();
+  }
+
+ /*
+  * Merge( merger, range )
+  *
+  * Merges the blocks of the keys of the range to the output passed, with the
+  * record offsets relative to the chunk of the range.
+  */
+  void  ContentsMerger::KeyRanges::Merge( const ContentsMerger& merger, KeyRange& range, mtc::api<mtc::IByteStream> output )
+  {
+    auto  blockList = std::vector<MapEntities>();
+    auto  refVector = std::vector<EntityReference>();
+    auto  keyRecord = RadixLink{ 0, 0, 0, 0 };
+    auto  ioCharge = io::Charger( merger.limiter );
+
+    for ( size_t i = 0, src = 0; i != range.keys.size(); ++i )
+    {
+      auto& select = range.keys[i];
+      auto  mergeStat = std::pair<uint32_t, uint32_t>{};
+
+    // collect the blocks of the key from the sources listed
+      for ( blockList.clear(); src != range.kends[i]; ++src )
+      {
+        auto  isrc = range.ksrcs[src];
+
+        blockList.push_back( { merger.indices[isrc]->GetKeyBlock( select ),
+          &merger.remapId[isrc], merger.monotone[isrc], merger.rebaseId[isrc] } );
+      }
+
+      refVector.resize( 0 );
+
+      mergeStat = blockList.front().entityBlock->Type() == 0 ?
+        MergeSimple( output, refVector, blockList ) :
+        MergeChains( output, refVector, blockList );
+
+    // the source blocks read are counted by the size of the merged one
+      ioCharge( select.size() + mergeStat.second );
+
+      if ( mergeStat.second != 0 )
+      {
+        keyRecord.bkType = blockList.front().entityBlock->Type();
+        keyRecord.uCount = mergeStat.first;
+        keyRecord.length = mergeStat.second;
+
+        range.records.emplace_back( uint32_t(i), keyRecord );
+
+        keyRecord.offset += mergeStat.second;
+      }
+    }
+    range.length = keyRecord.offset;
+  }
+
+  // ContentsMerger implementation
+
+ /*
+  * MergeContents()
+  *
+  * Lists the keys of the sources in order and cuts them to the ranges merged
+  * by the workers in parallel; the chunks merged are concatenated with the
+  * offsets of the records corrected.
+  */
   void  ContentsMerger::MergeContents()
   {
     auto  contents  = storage->Contents();
-    auto  chains    = storage->Linkages();
     auto  iterators = std::vector<LexemeIterator>();
-    auto  selectSet = std::vector<size_t>( indices.size() );
-    auto  refVector = std::vector<EntityReference>( 0x100000 );
     auto  radixTree = mtc::radix::tree<RadixLink>();
-    auto  keyRecord = RadixLink{ 0, 0, 0, 0 };
+    auto  keyRange = std::make_unique<KeyRange>();
 
   // create iterators list
     for ( auto& next : indices )
       iterators.emplace_back( next );
 
-  // list all the keys and select merge lists
-    for ( ; ; )
-    {
-      auto  nCount = size_t(0);
-      auto  select = (const std::string*)nullptr;
+    if ( iterators.empty() )
+      return (void)radixTree.Serialize( contents.ptr() );
 
-    // select lower key
-      for ( size_t i = 0; i != iterators.size(); ++i )
-        if ( !iterators[i].Curr().empty() )
-        {
-          int   rescmp;
+    auto  selector = LoserTree( iterators.size(), [&]( size_t a, size_t b )
+      {
+        return !iterators[a].Curr().empty()
+          && (iterators[b].Curr().empty() || iterators[a].Curr() < iterators[b].Curr());
+      } );
+    auto  keyRanges = KeyRanges( *this, storage->Linkages(), radixTree, nthreads );
 
-          if ( nCount == 0 || (rescmp = select->compare( iterators[i].Curr() )) >= 0 )
-          {
-            if ( rescmp > 0 )
-              nCount = 0;
-            select = &iterators[selectSet[nCount++] = i].Curr();
-          }
-        }
+  // list all the keys with the sources holding them
+    while ( !iterators[selector.Top()].Curr().empty() )
+    {
+      auto  itop = selector.Top();
 
-    // check if key is available
-      if ( nCount != 0 )
+      for ( keyRange->keys.push_back( iterators[itop].Take() ); ; iterators[itop].Next() )
       {
-        auto  blockList = std::vector<MapEntities>( nCount );
-        auto  mergeStat = std::pair<uint32_t, uint32_t>{};
+        keyRange->ksrcs.push_back( uint32_t(itop) );
 
-        for ( size_t i = 0; i != nCount; ++i )
-          blockList[i] = { indices[selectSet[i]]->GetKeyBlock( *select ), &remapId[selectSet[i]] };
+      // the ranges merged in parallel are cut by the size estimated
+        if ( nthreads > 1 )
+          keyRange->cbsize += EstimateKey( indices[itop]->GetKeyStats( keyRange->keys.back() ) );
 
-        refVector.resize( 0 );
+        selector.Update();
 
-        mergeStat = blockList.front().entityBlock->Type() == 0 ?
-          MergeSimple( chains, refVector, blockList ) :
-          MergeChains( chains, refVector, blockList );
+        if ( iterators[itop = selector.Top()].Curr() != keyRange->keys.back() )
+          break;
+      }
 
-        if ( mergeStat.second != 0 )
-        {
-          keyRecord.bkType = blockList.front().entityBlock->Type();
-          keyRecord.uCount = mergeStat.first;
-          keyRecord.length = mergeStat.second;
+      keyRange->kends.push_back( uint32_t(keyRange->ksrcs.size()) );
 
-          radixTree.Insert( *select, keyRecord );
+      if ( keyRange->keys.size() == rangeSize || keyRange->cbsize >= rangeBytes )
+        keyRanges.Put( std::exchange( keyRange, std::make_unique<KeyRange>() ) );
+    }
 
-          keyRecord.offset += mergeStat.second;
-        }
+    if ( !keyRange->keys.empty() )
+      keyRanges.Put( std::move( keyRange ) );
 
-        for ( size_t i = 0; i != nCount; ++i )
-          iterators[selectSet[i]].Next();
-      } else break;
-    }
+    keyRanges.Finish();
 
     radixTree.Serialize( contents.ptr() );
   }
@@ -317,6 +908,8 @@ namespace fusion {
   {
     indices.emplace_back( index );
     remapId.emplace_back( index->GetMaxIndex() + 2 );
+    monotone.push_back( false );
+    rebaseId.push_back( uint32_t(-1) );
     return *this;
   }
 
@@ -332,6 +925,12 @@ namespace fusion {
     return *this;
   }
 
+  auto  ContentsMerger::Set( mtc::api<IRateLimiter> rl ) -> ContentsMerger&
+  {
+    limiter = rl;
+    return *this;
+  }
+
   auto  ContentsMerger::Set( const mtc::api<IContentsIndex>* pi, size_t cc ) -> ContentsMerger&
   {
     for ( auto pe = pi + cc; pi != pe; ++pi )
@@ -353,6 +952,12 @@ namespace fusion {
     return *this;
   }
 
+  auto  ContentsMerger::SetThreads( unsigned nt ) -> ContentsMerger&
+  {
+    nthreads = std::max( nt, 1U );
+    return *this;
+  }
+
   auto  ContentsMerger::operator()() -> mtc::api<IStorage::ISerialized>
   {
     MergeEntities();
@@ -1,6 +1,7 @@
 # if !defined( __DelphiX_src_indexer_merger_hpp__ )
 # define __DelphiX_src_indexer_merger_hpp__
 # include "../../contents.hpp"
+# include "../../indexer/rate-limiter.hpp"
 # include <functional>
 
 namespace DelphiX {
@@ -17,20 +18,29 @@ namespace fusion {
     auto  Add( mtc::api<IContentsIndex> ) -> ContentsMerger&;
     auto  Set( std::function<bool()> ) -> ContentsMerger&;
     auto  Set( mtc::api<IStorage::IIndexStore> ) -> ContentsMerger&;
+    auto  Set( mtc::api<IRateLimiter> ) -> ContentsMerger&;
     auto  Set( const mtc::api<IContentsIndex>*, size_t ) -> ContentsMerger&;
     auto  Set( const std::vector<mtc::api<IContentsIndex>>& ) -> ContentsMerger&;
     auto  Set( const std::initializer_list<const mtc::api<IContentsIndex>>& ) -> ContentsMerger&;
+    auto  SetThreads( unsigned ) -> ContentsMerger&;
 
     auto  operator()() -> mtc::api<IStorage::ISerialized>;
 
   protected:
+    struct KeyRange;
+    class  KeyRanges;
+
     void  MergeEntities();
     void  MergeContents();
 
   protected:
     mtc::api<IStorage::IIndexStore>       storage;
+    mtc::api<IRateLimiter>                limiter;      // source reads budget
     std::vector<mtc::api<IContentsIndex>> indices;
     std::vector<std::vector<uint32_t>>    remapId;
+    std::vector<bool>                     monotone;     // remapId keeps the order
+    std::vector<uint32_t>                 rebaseId;     // the shift of remapId contiguous, or -1
+    unsigned                              nthreads = 1; // the workers merging the key ranges
 
   };
 
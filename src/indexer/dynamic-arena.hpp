@@ -0,0 +1,228 @@
+# if !defined( __DelphiX_src_indexer_dynamic_arena_hxx__ )
+# define __DelphiX_src_indexer_dynamic_arena_hxx__
+# include <mtc/arena.hpp>
+# include <cstddef>
+# include <atomic>
+# include <memory>
+# include <mutex>
+
+namespace DelphiX {
+namespace indexer {
+namespace dynamic {
+
+ /*
+  * SlabArena is the allocation arena for dynamic index writers.
+  *
+  * Each writer thread carves the slab from the shared arena and allocates
+  * small objects from the slab without any synchronization; the shared arena
+  * is locked only to get the next slab or to allocate the large block.
+  *
+  * The memory is never released until the arena is destroyed.  The size of
+  * blocks allocated from the slab is counted by the thread and added to the
+  * shared counter in portions, so memusage() is aggregated lazily: the other
+  * threads' counts may fall behind by less than the portion each.
+  *
+  * The thread slab keeps the shared counter of its arena, so the counts are
+  * flushed to the arena when the slab is evicted by another arena or the
+  * thread exits; the space left in the slabs replaced is counted as used.
+  */
+  class SlabArena
+  {
+    using Counter = std::shared_ptr<std::atomic<size_t>>;
+
+    struct LocalSlab
+    {
+      Counter   counter;            // the counter of the arena, identifies the arena
+      char*     ptrTop = nullptr;
+      char*     ptrEnd = nullptr;
+      size_t    nbytes = 0;         // allocated, but not counted yet
+
+    public:
+      void  Flush();
+    };
+
+    enum: size_t
+    {
+      local_slab_count = 4,
+      count_portion = 0x1000
+    };
+
+  public:
+    template <class T>
+    class allocator;
+
+  public:
+    SlabArena( size_t slabSize = 0x40000 );
+    SlabArena( const SlabArena& ) = delete;
+    SlabArena& operator=( const SlabArena& ) = delete;
+
+    auto  allocate( size_t size, size_t align ) -> void*;
+    auto  memusage() const -> size_t;
+
+    template <class T>
+    auto  get_allocator() -> allocator<T>  {  return allocator<T>( this );  }
+
+  protected:
+    auto  reserve( size_t, bool ) -> char*;
+
+    static  auto  LocalSlabs() -> LocalSlab*;
+
+  protected:
+    const Counter       reserved;     // counted allocations, shared with the thread slabs
+    const size_t        slabLen;
+
+    mtc::Arena          backing;
+    std::mutex          mxLocks;
+
+  };
+
+  template <class T>
+  class SlabArena::allocator
+  {
+    template <class U>
+    friend class allocator;
+
+    SlabArena*  arena;
+
+  public:
+    using value_type = T;
+
+    template <class U>
+    struct rebind {  using other = allocator<U>;  };
+
+  public:
+    allocator( SlabArena* pa ): arena( pa ) {}
+    template <class U>
+    allocator( const allocator<U>& al ): arena( al.arena ) {}
+
+    auto  allocate( size_t n ) -> T*
+      {  return (T*)arena->allocate( n * sizeof(T), alignof(T) );  }
+    void  deallocate( T*, size_t ) {}
+
+    template <class U>
+    bool  operator == ( const allocator<U>& al ) const  {  return arena == al.arena;  }
+    template <class U>
+    bool  operator != ( const allocator<U>& al ) const  {  return !(*this == al);  }
+  };
+
+  // SlabArena implementation
+
+  inline  SlabArena::SlabArena( size_t slabSize ):
+    reserved( std::make_shared<std::atomic<size_t>>( 0 ) ),
+    slabLen( slabSize )
+  {
+  }
+
+ /*
+  * SlabArena::allocate( size, align )
+  *
+  * Allocates small blocks from the thread slab of this arena and large ones
+  * directly from the shared arena.  The thread keeps a few slabs of different
+  * arenas, so writing to several indices does not throw the slabs away.
+  */
+  inline  auto  SlabArena::allocate( size_t size, size_t align ) -> void*
+  {
+    auto  slabs = LocalSlabs();
+    auto  local = slabs;
+    auto  palloc = (char*)nullptr;
+
+    if ( size > slabLen / 8 )
+      return reserve( size, true );
+
+  // find the slab of this arena or the free one, or evict the last one with
+  // its counts flushed to the owner arena; the slab found is moved to the
+  // first place to be found at once next time
+    while ( local != slabs + local_slab_count - 1 && local->counter != reserved && local->counter != nullptr )
+      ++local;
+
+    if ( local->counter != reserved )
+    {
+      local->Flush();
+      local->counter = reserved;
+    }
+
+    if ( local != slabs )
+      std::swap( *local, *slabs ), local = slabs;
+
+  // align the top pointer and check the free space
+    if ( local->ptrTop != nullptr )
+      palloc = local->ptrTop + (align - size_t(local->ptrTop) % align) % align;
+
+  // the space left in the slab replaced is never used, so it is counted
+    if ( palloc == nullptr || palloc + size > local->ptrEnd )
+    {
+      local->nbytes += local->ptrEnd - local->ptrTop;
+      local->ptrEnd = (palloc = reserve( slabLen, false )) + slabLen;
+    }
+
+  // count the allocation
+    if ( (local->nbytes += size) >= count_portion )
+      *reserved += local->nbytes, local->nbytes = 0;
+
+    return local->ptrTop = palloc + size, palloc;
+  }
+
+ /*
+  * SlabArena::memusage()
+  *
+  * Returns the memory counted by all the threads and not counted yet by the
+  * calling one, so the thread checking the limit sees its own allocations.
+  */
+  inline  auto  SlabArena::memusage() const -> size_t
+  {
+    auto  slabs = LocalSlabs();
+    auto  local = slabs;
+
+    while ( local != slabs + local_slab_count && local->counter != reserved )
+      ++local;
+
+    return reserved->load() + (local != slabs + local_slab_count ? local->nbytes : 0);
+  }
+
+  inline  auto  SlabArena::reserve( size_t size, bool count ) -> char*
+  {
+    auto  ncells = (size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+    auto  exlock = std::unique_lock<std::mutex>( mxLocks );
+    auto  palloc = (char*)backing.get_allocator<std::max_align_t>().allocate( ncells );
+
+    if ( count )
+      *reserved += ncells * sizeof(std::max_align_t);
+    return palloc;
+  }
+
+ /*
+  * SlabArena::LocalSlab::Flush()
+  *
+  * Adds the allocations not counted yet and the space left in the slab to the
+  * counter of the arena and releases the slab; the counter outlives the arena
+  * while it is kept by the slab.
+  */
+  inline  void  SlabArena::LocalSlab::Flush()
+  {
+    if ( counter != nullptr )
+      *counter += nbytes + (ptrEnd - ptrTop);
+
+    counter = nullptr;
+    ptrTop = ptrEnd = nullptr;
+    nbytes = 0;
+  }
+
+  inline  auto  SlabArena::LocalSlabs() -> LocalSlab*
+  {
+    thread_local struct Slabs
+    {
+      LocalSlab slabs[local_slab_count];
+
+     ~Slabs()
+      {
+        for ( auto& next: slabs )
+          next.Flush();
+      }
+    } local;
+
+    return local.slabs;
+  }
+
+}}}
+
+# endif   // !__DelphiX_src_indexer_dynamic_arena_hxx__
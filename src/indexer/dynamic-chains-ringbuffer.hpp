@@ -39,6 +39,10 @@ namespace dynamic {
         }
       }
     }
+    bool  Empty() const
+    {
+      return mtc::ptr::clean( buftop.load() ) == mtc::ptr::clean( bufend.load() );
+    }
     bool  Get( T& tvalue )
     {
       for ( auto  pfetch = mtc::ptr::clean( buftop.load() ); ; pfetch = mtc::ptr::clean( pfetch ) )
@@ -2,13 +2,16 @@
 # define __DelphiX_src_indexer_dynamic_chains_hxx__
 # include "../../contents.hpp"
 # include "../../compat.hpp"
+# include "../../indexer/executor.hpp"
 # include "dynamic-chains-ringbuffer.hpp"
 # include "dynamic-bitmap.hpp"
 # include "strmatch.hpp"
 # include <mtc/recursive_shared_mutex.hpp>
 # include <mtc/radix-tree.hpp>
 # include <condition_variable>
-# include <thread>
+# include <functional>
+# include <algorithm>
+# include <mutex>
 # include <atomic>
 
 # if defined( VERIFY_KEY_COUNT )
@@ -28,12 +31,20 @@ namespace dynamic {
   class BlockChains
   {
     struct ChainLink;
+    struct ChainPage;
+    struct ChainSpill;
     struct ChainHook;
+    struct PagePool;
+    struct Retired;
 
     using AtomicLink = std::atomic<ChainLink*>;
+    using AtomicPage = std::atomic<ChainPage*>;
+    using AtomicSpill = std::atomic<ChainSpill*>;
     using AtomicHook = std::atomic<ChainHook*>;
 
     using LinkAllocator = AllocatorCast<Allocator, ChainLink>;
+    using PageAllocator = AllocatorCast<Allocator, ChainPage>;
+    using SpillAllocator = AllocatorCast<Allocator, ChainSpill>;
     using HookAllocator = AllocatorCast<Allocator, AtomicHook>;
 
     enum: size_t
@@ -41,6 +52,13 @@ namespace dynamic {
       hash_table_size = 40013
     };
 
+    enum: uint32_t
+    {
+      min_page_size = 0x20,
+      max_page_size = 0x1000,
+      min_spill_size = max_page_size * 4
+    };
+
   /*
    * ChainLink represents one entity identified by virtual index iEnt data block
    * linked in a chain of blocks in increment order of entity indices
@@ -63,8 +81,85 @@ namespace dynamic {
     };
 
   /*
-   * ChainHook holds key body and reference to the first element in the chain
-   * of blocks indexed by incremental virtual entity indices
+   * ChainPage is the write buffer of the key holding the entities appended in
+   * increment order, packed as delta-encoded indices followed by the length
+   * and the body of the block for the block types with data.
+   *
+   * The page is appended under the key lock only and published by the used
+   * size, so readers decode it without any locks.
+   */
+    struct ChainPage
+    {
+      AtomicPage            p_next = nullptr;
+      uint32_t              uprior;               // the entity before the first one
+      std::atomic_uint32_t  cbused = 0;
+      uint32_t              cbsize;
+
+    public:
+      ChainPage( uint32_t prior, uint32_t size ):
+        uprior( prior ),
+        cbsize( size )  {}
+
+    public:
+      auto  data() const -> const char*  {  return (const char*)(this + 1);  }
+      auto  data() ->             char*  {  return (      char*)(this + 1);  }
+
+    };
+
+  /*
+   * ChainSpill references the pages of the key written to the dump store with
+   * the spill, in the same format; the spilled runs of the key follow in the
+   * increment order of entities and precede the pages in memory.
+   */
+    struct ChainSpill
+    {
+      AtomicSpill                 p_next = nullptr;
+      const IStorage::IDumpStore* pstore;
+      int64_t                     offset;
+      uint32_t                    uprior;         // the entity before the first one
+      uint32_t                    ulast;          // the last entity spilled
+
+    public:
+      ChainSpill( const IStorage::IDumpStore* ps, int64_t po, uint32_t prior, uint32_t last ):
+        pstore( ps ),
+        offset( po ),
+        uprior( prior ),
+        ulast( last ) {}
+
+    };
+
+  /*
+   * PagePool keeps the full-size pages of the spilled chains for reuse by the
+   * keys appended later, so the spilled memory is not allocated twice.
+   */
+    struct PagePool
+    {
+      std::mutex            mxlock;
+      ChainPage*            pfirst = nullptr;
+      std::atomic<size_t>   nbytes = 0;
+
+    public:
+      auto  Get() -> ChainPage*;
+      void  Put( ChainPage* );
+
+    };
+
+  /*
+   * Retired is the list of the pages detached by the spill; the list stays
+   * linked to the pages of the key not spilled, so it ends with pstop.
+   */
+    struct Retired
+    {
+      const ChainHook*  pchain;
+      ChainPage*        pfirst;
+      ChainPage*        pstop;
+      uint32_t          cbsize;
+    };
+
+  /*
+   * ChainHook holds key body and references to the pages of entities appended
+   * in increment order and to the chain of blocks inserted out of order by the
+   * concurrent writers, both indexed by incremental virtual entity indices
    */
     struct ChainHook
     {
@@ -80,9 +175,19 @@ namespace dynamic {
       LinkAllocator         malloc;
       AtomicHook            pchain;               // collisions
 
+      AtomicPage            ppages = nullptr;     // first page
+      AtomicPage            plast = nullptr;      // last page, locked with dirty bit
+      std::atomic_uint32_t  ulast = 0;            // last entity in pages
+      std::atomic_uint32_t  cbpages = 0;          // pages size
+      PagePool&             pgpool;               // pages for reuse
+
+      AtomicSpill           pspill = nullptr;     // spilled runs
+      mutable std::atomic_uint32_t  readers = 0;  // cursors holding the pages
+
       AtomicLink            pfirst = nullptr;     // first in chain
       AtomicLink*           points[cache_size];   // points cache
       LastAnchor            ppoint = points - 1;  // invalid value
+      std::atomic_uint32_t  nlinks = 0;
       std::atomic_uint32_t  ncount = 0;
 
       size_t                cchkey;               // key length
@@ -92,16 +197,23 @@ namespace dynamic {
       auto  data() -> char* {  return (char*)(this + 1);  }
 
     public:
-      ChainHook( const std::string_view& key, unsigned blockType, ChainHook*, Allocator );
+      ChainHook( const std::string_view& key, unsigned blockType, ChainHook*, Allocator, PagePool& );
      ~ChainHook();
 
     public:
       bool  operator == ( const std::string_view& s ) const
         {  return cchkey == s.size() && memcmp( data(), s.data(), s.size() ) == 0;  }
 
+    public:
+      bool  Empty() const
+        {  return ppages.load() == nullptr && pfirst.load() == nullptr && pspill.load() == nullptr;  }
+
     public:
       void  Insert( uint32_t entity, const std::string_view& block );
+      bool  Append( uint32_t entity, const std::string_view& block );
+      void  Link( uint32_t entity, const std::string_view& block );
       void  Markup();
+      auto  Spill( IStorage::IDumpStore* ) -> Retired;
      /*
       * bool  Verify() const;
       *
@@ -117,6 +229,7 @@ namespace dynamic {
 
   public:
     class KeyLister;
+    class Cursor;
 
     BlockChains( Allocator alloc = Allocator() );
    ~BlockChains();
@@ -129,6 +242,16 @@ namespace dynamic {
 
     auto  KeySet( const std::string_view& ) const -> KeyLister;
 
+   /*
+    * Spill( store, cbneed )
+    *
+    * Writes the pages of the largest chains to the dump store until at least
+    * cbneed bytes are spilled; returns the count of bytes spilled.  The pages
+    * are moved to the pool for reuse once no cursor holds them.
+    */
+    auto  Spill( IStorage::IDumpStore*, size_t ) -> size_t;
+    auto  GetPooled() const -> size_t {  return pagePool.nbytes.load();  }
+
    /*
     * bool  Verify() const;
     *
@@ -143,6 +266,7 @@ namespace dynamic {
 
   protected:
     void  KeysIndexer();
+    void  Reclaim();
 
   protected:
     struct RadixLink
@@ -168,15 +292,21 @@ namespace dynamic {
 
     std::vector<AtomicHook, HookAllocator>      hashTable;
     AllocatorCast<Allocator, ChainHook>         hookAlloc;
+    std::function<bool(uint32_t)>               isRemoved;    // entities removed from pages
+
+    PagePool                                    pagePool;     // spilled pages for reuse
+    std::mutex                                  spillLock;    // one spill at a time
+    std::vector<Retired>                        retiredPages; // spilled, but may be read
 
     mtc::radix::tree<RadixLink,
       AllocatorCast<Allocator, RadixLink>>      radixTree;    // parallel radix tree
     mutable std::shared_mutex                   radixLock;    // locker to access
 
     RingBuffer<ChainHook*, ring_buffer_size>    keysQueue;    // queue for keys indexing
-    std::condition_variable_any                 keySyncro;    // syncro for shadow indexing keys
-    std::thread                                 keyThread;    // shadow keys indexer
-    volatile bool                               runThread = false;
+    std::mutex                                  keyMutex;     // syncro for shadow indexing keys
+    std::condition_variable                     keySyncro;
+    std::atomic<bool>                           keyActive = false;  // indexer task is queued or run
+    std::atomic<bool>                           keyStopped = false;
 
   };
 
@@ -201,17 +331,58 @@ namespace dynamic {
 
   };
 
+  /*
+   * Cursor lists the entities of the key in increment order merging the pages
+   * and the chain of blocks inserted out of order.  The spilled runs are read
+   * from the dump store and listed before the pages.
+   *
+   * The cursor is registered as the reader of the key, so the pages spilled
+   * while listed are not reused until the cursor is destroyed.
+   */
+  template <class Allocator>
+  class BlockChains<Allocator>::Cursor
+  {
+    using Reference = IContentsIndex::IEntities::Reference;
+
+  public:
+    Cursor( const ChainHook* );
+    Cursor( const Cursor& );
+    Cursor& operator = ( const Cursor& ) = delete;
+   ~Cursor();
+
+    auto  Curr() const -> Reference;
+    auto  Next() -> Reference;
+
+  protected:
+    void  NextPage();
+    void  NextLink();
+    void  LoadRun();
+    auto  Decode( const char* ) -> const char*;
+
+  protected:
+    const ChainHook*  pchain;
+    unsigned          bkType;
+    const ChainPage*  ppage;
+    uint32_t          offset = 0;     // next page entry offset
+    Reference         inpage;         // current page entry
+    const ChainLink*  plink;
+
+    const ChainSpill* pspill;
+    const ChainSpill* pslast = nullptr;   // the last run when created
+    uint32_t          usplit = 0;     // the last entity spilled, skipped in pages
+    const char*       runtop = nullptr;
+    const char*       runend = nullptr;
+    mtc::api<const mtc::IByteBuffer>  runbuf;
+
+  };
+
 // KeyBlockChains template implementation
 
   template <class Allocator>
   BlockChains<Allocator>::BlockChains( Allocator alloc ):
     hashTable( hash_table_size, alloc ),
     hookAlloc( alloc ),
-    radixTree( alloc )
-  {
-    for ( keyThread = std::thread( &BlockChains<Allocator>::KeysIndexer, this ); !runThread; )
-      std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
-  }
+    radixTree( alloc ) {}
 
   template <class Allocator>
   BlockChains<Allocator>::~BlockChains()
@@ -225,6 +396,23 @@ namespace dynamic {
           tofree->~ChainHook();
         hookAlloc.deallocate( tofree, 0 );
       }
+
+  // release the spilled pages and the pool
+    auto  palloc = PageAllocator( hookAlloc );
+    auto  pgfree = [&]( ChainPage* pfree, ChainPage* pstop )
+      {
+        for ( auto pnext = pfree; pfree != pstop; pfree = pnext )
+        {
+          pnext = pfree->p_next.load();
+            pfree->~ChainPage();
+          palloc.deallocate( pfree, 0 );
+        }
+      };
+
+    for ( auto& next: retiredPages )
+      pgfree( next.pfirst, next.pstop );
+
+    pgfree( pagePool.pfirst, nullptr );
   }
 
   template <class Allocator>
@@ -268,12 +456,14 @@ namespace dynamic {
     try
     {
       new( hvalue = hookAlloc.allocate( (sizeof(ChainHook) * 2 + key.size() - 1) / sizeof(ChainHook) ) )
-        ChainHook( key, bkType, mtc::ptr::clean( hentry->load() ), hookAlloc );
+        ChainHook( key, bkType, mtc::ptr::clean( hentry->load() ), hookAlloc, pagePool );
 
       hentry->store( hvalue );
 
       keysQueue.Put( hvalue );
-      keySyncro.notify_one();
+
+      if ( !keyStopped && !keyActive.exchange( true ) )
+        Executor::Get().Run( Executor::housekeeping, this, [this](){  KeysIndexer();  } );
     }
     catch ( ... )
     {
@@ -298,17 +488,29 @@ namespace dynamic {
     return nullptr;
   }
 
+ /*
+  * StopIt()
+  *
+  * Stops scheduling the keys indexer, waits for the indexer task run and then
+  * indexes the keys left in the queue.
+  */
   template <class Allocator>
   auto  BlockChains<Allocator>::StopIt() -> BlockChains&
   {
-    if ( keyThread.joinable() )
+    if ( !keyStopped.exchange( true ) )
     {
-      while ( !runThread )
-        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+      auto  exlock = mtc::make_unique_lock( keyMutex );
+
+      if ( Executor::Get().Cancel( this ) != 0 )
+        keyActive = false;
 
-      runThread = false;
-      keySyncro.notify_one();
-      keyThread.join();
+      keySyncro.wait( exlock, [&](){  return !keyActive.load();  } );
+
+      mtc::interlocked( mtc::make_unique_lock( radixLock ), [&]()
+        {
+          for ( ChainHook* addkey; keysQueue.Get( addkey ); )
+            radixTree.Insert( { addkey->data(), addkey->cchkey }, { addkey, 0, 0 } );
+        } );
     }
     return *this;
   }
@@ -337,6 +539,8 @@ namespace dynamic {
   template <class OtherAllocator>
   auto  BlockChains<Allocator>::Remove( const Bitmap<OtherAllocator>& deleted ) -> BlockChains&
   {
+    isRemoved = [deleted]( uint32_t entity ){  return deleted.Get( entity );  };
+
     for ( auto it = radixTree.begin(); it != radixTree.end(); )
     {
       if ( it->second.blocksChain->Remove( deleted ).ncount == 0 )
@@ -346,6 +550,74 @@ namespace dynamic {
     return *this;
   }
 
+  template <class Allocator>
+  auto  BlockChains<Allocator>::Spill( IStorage::IDumpStore* store, size_t cbneed ) -> size_t
+  {
+    auto  exlock = mtc::make_unique_lock( spillLock );
+    auto  chains = std::vector<ChainHook*>();
+    auto  nbytes = size_t(0);
+
+  // select the chains large enough to be spilled, the largest first
+    for ( auto& next: hashTable )
+      for ( auto hvalue = mtc::ptr::clean( next.load() ); hvalue != nullptr; hvalue = hvalue->pchain.load() )
+        if ( hvalue->cbpages.load() >= min_spill_size )
+          chains.push_back( hvalue );
+
+    std::sort( chains.begin(), chains.end(), []( const ChainHook* a, const ChainHook* b )
+      {  return a->cbpages.load() > b->cbpages.load();  } );
+
+  // spill the chains and retire the pages
+    for ( auto next = chains.begin(); next != chains.end() && nbytes < cbneed; ++next )
+    {
+      auto  retire = (*next)->Spill( store );
+
+      if ( retire.pfirst != nullptr )
+      {
+        retiredPages.push_back( retire );
+        nbytes += retire.cbsize;
+      }
+    }
+
+    return Reclaim(), nbytes;
+  }
+
+ /*
+  * Reclaim()
+  *
+  * Moves the pages of the spilled chains not read by any cursor to the pool;
+  * the pages smaller than the full size are released to the allocator.
+  */
+  template <class Allocator>
+  void  BlockChains<Allocator>::Reclaim()
+  {
+    auto  palloc = PageAllocator( hookAlloc );
+
+    for ( auto next = retiredPages.begin(); next != retiredPages.end(); )
+    {
+      if ( next->pchain->readers.load() != 0 )
+      {
+        ++next;
+        continue;
+      }
+
+      for ( auto pnext = next->pfirst, pfree = pnext; pfree != next->pstop; pfree = pnext )
+      {
+        pnext = pfree->p_next.load();
+
+        if ( pfree->cbsize >= max_page_size )
+        {
+          pagePool.Put( pfree );
+        }
+          else
+        {
+          pfree->~ChainPage();
+          palloc.deallocate( pfree, 0 );
+        }
+      }
+      next = retiredPages.erase( next );
+    }
+  }
+
   template <class Allocator>
   bool  BlockChains<Allocator>::Verify() const
   {
@@ -388,29 +660,29 @@ namespace dynamic {
     //  * blocks with coordinates
       if ( next->value.blocksChain->bkType == 0 )
       {
-        for ( auto p = next->value.blocksChain->pfirst.load(); p != nullptr; p = p->p_next.load() )
-          if ( p->entity != uint32_t(-1) )
+        for ( auto p = Cursor( next->value.blocksChain ); p.Curr().uEntity != uint32_t(-1); p.Next() )
+          if ( isRemoved == nullptr || !isRemoved( p.Curr().uEntity ) )
           {
-            auto  diffId = p->entity - lastId - 1;
+            auto  diffId = p.Curr().uEntity - lastId - 1;
 
             length += uint32_t(::GetBufLen( diffId ));
               chain = ::Serialize( chain, diffId );
-            lastId = p->entity;
+            lastId = p.Curr().uEntity;
           }
       }
         else
       {
-        for ( auto p = next->value.blocksChain->pfirst.load(); p != nullptr; p = p->p_next.load() )
-          if ( p->entity != uint32_t(-1) )
+        for ( auto p = Cursor( next->value.blocksChain ); p.Curr().uEntity != uint32_t(-1); p.Next() )
+          if ( isRemoved == nullptr || !isRemoved( p.Curr().uEntity ) )
           {
-            auto  diffId = p->entity - lastId - 1;
-            auto  blkLen = p->lblock;
+            auto  diffId = p.Curr().uEntity - lastId - 1;
+            auto  blkLen = uint32_t(p.Curr().details.size());
 
-            length += uint32_t(::GetBufLen( diffId ) + p->lblock + ::GetBufLen( blkLen ));
+            length += uint32_t(::GetBufLen( diffId ) + blkLen + ::GetBufLen( blkLen ));
               chain = ::Serialize( ::Serialize( ::Serialize( chain,
                 diffId ),
-                blkLen ), p->data(), blkLen );
-            lastId = p->entity;
+                blkLen ), p.Curr().details.data(), blkLen );
+            lastId = p.Curr().uEntity;
           }
       }
 
@@ -427,8 +699,8 @@ namespace dynamic {
     // store all the index chains saving offset, count and length to the tree
     for ( auto next = radixTree.begin(), stop = radixTree.end(); next != stop; ++next )
     {
-      for ( auto p = next->value.blocksChain->pfirst.load(); p != nullptr; p = p->p_next.load() )
-        if ( p->entity != uint32_t(-1) && p->entity > maxIndex )
+      for ( auto p = Cursor( next->value.blocksChain ); p.Curr().uEntity != uint32_t(-1); p.Next() )
+        if ( p.Curr().uEntity > maxIndex )
           return false;
     }
     return true;
@@ -437,31 +709,37 @@ namespace dynamic {
  /*
   * Shadow keys indexer
   *
-  * Wakes up on signals, indexes all the new keys from the queue, stops after
-  * all the keys are indexed and runThread is false.
+  * The executor task scheduled by the first new key inserted; indexes all the
+  * keys from the queue and finishes if no more keys are queued.  The keys put
+  * to the queue after it is checked schedule the next task.
   */
   template <class Allocator>
   void  BlockChains<Allocator>::KeysIndexer()
   {
-    auto        locker = mtc::make_unique_lock( radixLock );
-    ChainHook*  addkey;
-
-    pthread_setname_np( pthread_self(), "KeysIndexer" );
-
-    for ( runThread = true; runThread; )
+    for ( auto exlock = mtc::make_unique_lock( keyMutex, std::defer_lock ); ; exlock.unlock() )
     {
-      if ( keySyncro.wait_for( locker, std::chrono::milliseconds( 100 ) ) == std::cv_status::timeout )
-        continue;
-      while ( keysQueue.Get( addkey ) )
-        radixTree.Insert( { addkey->data(), addkey->cchkey }, { addkey, 0, 0 } );
+      mtc::interlocked( mtc::make_unique_lock( radixLock ), [&]()
+        {
+          for ( ChainHook* addkey; keysQueue.Get( addkey ); )
+            radixTree.Insert( { addkey->data(), addkey->cchkey }, { addkey, 0, 0 } );
+        } );
+
+    // finish under the lock, so StopIt() does not release the object until
+    // the task releases the lock
+      exlock.lock();
+      keyActive = false;
+
+      if ( keysQueue.Empty() || keyActive.exchange( true ) )
+        return keySyncro.notify_all();
     }
   }
 
   template <class Allocator>
-  BlockChains<Allocator>::ChainHook::ChainHook( const std::string_view& key, unsigned b, ChainHook* p, Allocator m ):
+  BlockChains<Allocator>::ChainHook::ChainHook( const std::string_view& key, unsigned b, ChainHook* p, Allocator m, PagePool& pp ):
     bkType( b ),
     malloc( m ),
-    pchain( p )
+    pchain( p ),
+    pgpool( pp )
   {
     memcpy( data(), key.data(), cchkey = key.size() );
   }
@@ -469,16 +747,106 @@ namespace dynamic {
   template <class Allocator>
   BlockChains<Allocator>::ChainHook::~ChainHook()
   {
+    auto  palloc = PageAllocator( malloc );
+    auto  salloc = SpillAllocator( malloc );
+
     for ( auto pnext = pfirst.load(), pfree = pnext; pfree != nullptr; pfree = pnext )
     {
       pnext = pfree->p_next.load();
         pfree->~ChainLink();
       malloc.deallocate( pfree, 0 );
     }
+    for ( auto pnext = ppages.load(), pfree = pnext; pfree != nullptr; pfree = pnext )
+    {
+      pnext = pfree->p_next.load();
+        pfree->~ChainPage();
+      palloc.deallocate( pfree, 0 );
+    }
+    for ( auto pnext = pspill.load(), pfree = pnext; pfree != nullptr; pfree = pnext )
+    {
+      pnext = pfree->p_next.load();
+        pfree->~ChainSpill();
+      salloc.deallocate( pfree, 0 );
+    }
   }
 
   template <class Allocator>
   void  BlockChains<Allocator>::ChainHook::Insert( uint32_t entity, const std::string_view& block )
+  {
+    if ( entity <= ulast.load() || !Append( entity, block ) )
+      Link( entity, block );
+  }
+
+ /*
+  * ChainHook::Append( entity, block )
+  *
+  * Appends the entity to the last page under the key lock if the entity is
+  * above the last one appended; else returns false, and the entity has to be
+  * linked to the chain.
+  */
+  template <class Allocator>
+  bool  BlockChains<Allocator>::ChainHook::Append( uint32_t entity, const std::string_view& block )
+  {
+    auto  ptail = mtc::ptr::clean( plast.load() );
+
+  // lock the last page pointer
+    while ( !plast.compare_exchange_weak( ptail, mtc::ptr::dirty( ptail ) ) )
+      ptail = mtc::ptr::clean( ptail );
+
+  // check if the entity is still above the last one appended
+    if ( entity <= ulast.load() )
+      return plast.store( ptail ), false;
+
+    try
+    {
+      auto  diffId = entity - ulast.load() - 1;
+      auto  blkLen = uint32_t(block.size());
+      auto  cbneed = ::GetBufLen( diffId ) + (bkType != 0 ? ::GetBufLen( blkLen ) + blkLen : 0);
+      auto  ptrtop = (char*)nullptr;
+
+    // allocate next page if no space; the pages grow twice up to the limit,
+    // the full-size pages are taken from the pool of spilled pages first
+      if ( ptail == nullptr || ptail->cbused.load() + cbneed > ptail->cbsize )
+      {
+        auto  cbpage = std::max( ptail != nullptr ? std::min( ptail->cbsize * 2, uint32_t(max_page_size) ) :
+          uint32_t(min_page_size), uint32_t(cbneed) );
+        auto  ncells = (sizeof(ChainPage) * 2 + cbpage - 1) / sizeof(ChainPage);
+        auto  palloc = PageAllocator( malloc );
+        auto  pfresh = cbpage == max_page_size ? pgpool.Get() : nullptr;
+
+        if ( pfresh != nullptr )
+          new( pfresh ) ChainPage( ulast.load(), pfresh->cbsize );
+        else
+          pfresh = new( palloc.allocate( ncells ) ) ChainPage( ulast.load(), uint32_t((ncells - 1) * sizeof(ChainPage)) );
+
+        if ( ptail != nullptr ) ptail->p_next.store( pfresh );
+          else ppages.store( pfresh );
+
+        cbpages += pfresh->cbsize;
+        ptail = pfresh;
+      }
+
+    // write the entity and publish it
+      ptrtop = ::Serialize( ptail->data() + ptail->cbused.load(), diffId );
+
+      if ( bkType != 0 )
+        ptrtop = ::Serialize( ::Serialize( ptrtop, blkLen ), block.data(), blkLen );
+
+      ulast.store( entity );
+      ptail->cbused.store( uint32_t(ptrtop - ptail->data()) );
+      ++ncount;
+    }
+    catch ( ... )
+    {
+      plast.store( ptail );
+      throw;
+    }
+
+    return plast.store( ptail ), true;
+  }
+
+  template <class Allocator>
+  void  BlockChains<Allocator>::ChainHook::Link( uint32_t entity, const std::string_view& block )
   {
     auto          newptr = new( malloc.allocate( (sizeof(ChainLink) * 2 + block.size() - 1) / sizeof(ChainLink) ) )
       ChainLink( entity, block );
@@ -489,7 +857,7 @@ namespace dynamic {
   // check if no elements available and try write first element;
   // if succeeded, increment element count and return
     if ( pfirst.compare_exchange_strong( pentry = nullptr, newptr ) )
-      return (void)++ncount;
+      return (void)++ncount, (void)++nlinks;
 
   // now pentry has the value != nullptr that was stored in pfirst
   // on the moment of a call
@@ -518,7 +886,7 @@ namespace dynamic {
 
     // если найденный элемент больше добавляемого и не изменился, заместить его на новый
       if ( (pentry == nullptr || pentry->entity > entity) && pstore->compare_exchange_strong( pentry, newptr ) )
-        return (++ncount % cache_step) == 0 ? Markup() : (void)NULL;
+        return ++ncount, (++nlinks % cache_step) == 0 ? Markup() : (void)NULL;
 
     // если изменился, проверить, не стал ли он меньше вставляемого и не надо ли сделать
     // шаг дальше по списку
@@ -530,7 +898,7 @@ namespace dynamic {
   template <class Allocator>
   void  BlockChains<Allocator>::ChainHook::Markup()
   {
-    auto  n_gran = ncount.load() / cache_size;
+    auto  n_gran = nlinks.load() / cache_size;
     auto  pstore = &pfirst;
     auto  pentry = pstore->load();
     auto  pcache = ppoint.load();
@@ -539,7 +907,8 @@ namespace dynamic {
     if ( ppoint.compare_exchange_strong( pcache, points - 1 ) ) pcache = points;
       else return;
 
-    for ( size_t nindex = 0; pentry != nullptr; pentry = (pstore = &pentry->p_next)->load() )
+  // the chain may grow while marked up, so the cache size is checked
+    for ( size_t nindex = 0; pentry != nullptr && pcache != points + cache_size; pentry = (pstore = &pentry->p_next)->load() )
       if ( nindex++ == n_gran )
       {
         *pcache++ = pstore;
@@ -548,19 +917,88 @@ namespace dynamic {
     ppoint = pcache - 1;
   }
 
+ /*
+  * ChainHook::Spill( store )
+  *
+  * Writes the pages of the key but the last one to the dump store as the run
+  * and detaches them; returns the pages detached, or the empty list if there
+  * are no pages to spill.
+  *
+  * The pages before the last one are not changed by the writers, so they are
+  * copied and written without locks; the key is locked only to publish the run
+  * and to detach the pages.  The run is published before the pages are detached,
+  * so the cursor created in between skips the entities in pages up to the last
+  * one spilled.
+  */
+  template <class Allocator>
+  auto  BlockChains<Allocator>::ChainHook::Spill( IStorage::IDumpStore* store ) -> Retired
+  {
+    auto  phead = ppages.load();
+    auto  pstop = mtc::ptr::clean( plast.load() );
+    auto  ptail = pstop;
+    auto  buffer = std::string();
+    auto  salloc = SpillAllocator( malloc );
+    auto  ptrun = (ChainSpill*)nullptr;
+    auto  ppend = &pspill;
+    auto  offset = int64_t(0);
+    auto  cbsize = uint32_t(0);
+
+  // the first page may be linked while the last page is not set yet
+    if ( phead == nullptr || pstop == nullptr || phead == pstop )
+      return { this, nullptr, nullptr, 0 };
+
+    for ( auto page = phead; page != pstop; page = page->p_next.load() )
+    {
+      buffer.append( page->data(), page->cbused.load() );
+      cbsize += page->cbsize;
+    }
+
+    offset = store->Put( buffer.data(), buffer.size() );
+    ptrun = new( salloc.allocate( 1 ) ) ChainSpill( store, offset, phead->uprior, pstop->uprior );
+
+  // lock the last page pointer to publish the run and detach the pages
+    while ( !plast.compare_exchange_weak( ptail, mtc::ptr::dirty( ptail ) ) )
+      ptail = mtc::ptr::clean( ptail );
+
+    while ( ppend->load() != nullptr )
+      ppend = &ppend->load()->p_next;
+
+    ppend->store( ptrun );
+
+    ppages.store( pstop );
+    cbpages -= cbsize;
+
+    return plast.store( ptail ), Retired{ this, phead, pstop, cbsize };
+  }
+
   template <class Allocator>
   bool  BlockChains<Allocator>::ChainHook::Verify() const
   {
     auto  entity = uint32_t(0);
+    auto  nfound = uint32_t(0);
 
     for ( auto pentry = pfirst.load(); pentry != nullptr; pentry = pentry->p_next.load() )
       if ( pentry->entity <= entity )
         return false;
       else entity = pentry->entity;
 
-    return true;
+    entity = 0;
+
+    for ( auto cursor = Cursor( this ); cursor.Curr().uEntity != uint32_t(-1); cursor.Next(), ++nfound )
+      if ( cursor.Curr().uEntity <= entity )
+        return false;
+      else entity = cursor.Curr().uEntity;
+
+    return nfound == ncount.load();
   }
 
+ /*
+  * ChainHook::Remove( deleted )
+  *
+  * Marks the deleted entities in the chain and excludes the deleted entities
+  * in the pages and spilled runs from the count; the pages are not changed,
+  * the entities are skipped on serialization.
+  */
   template <class Allocator>
   template <class OtherAllocator>
   auto  BlockChains<Allocator>::ChainHook::Remove( const Bitmap<OtherAllocator>& deleted ) -> ChainHook&
@@ -571,9 +1009,188 @@ namespace dynamic {
         p->entity = uint32_t(-1);
         --ncount;
       }
+
+  // the marked links are skipped by the cursor, so only the entities in the
+  // spilled runs and pages are left to be checked
+    for ( auto cursor = Cursor( this ); cursor.Curr().uEntity != uint32_t(-1); cursor.Next() )
+      if ( deleted.Get( cursor.Curr().uEntity ) )
+        --ncount;
+
     return *this;
   }
 
+  // BlockChains::PagePool implementation
+
+  template <class Allocator>
+  auto  BlockChains<Allocator>::PagePool::Get() -> ChainPage*
+  {
+    auto  exlock = mtc::make_unique_lock( mxlock, std::defer_lock );
+    auto  pfetch = (ChainPage*)nullptr;
+
+    if ( nbytes.load() == 0 )
+      return nullptr;
+
+    exlock.lock();
+
+    if ( (pfetch = pfirst) != nullptr )
+    {
+      pfirst = pfetch->p_next.load();
+      nbytes -= sizeof(ChainPage) + pfetch->cbsize;
+    }
+    return pfetch;
+  }
+
+  template <class Allocator>
+  void  BlockChains<Allocator>::PagePool::Put( ChainPage* page )
+  {
+    auto  exlock = mtc::make_unique_lock( mxlock );
+
+    page->p_next.store( pfirst );
+      pfirst = page;
+    nbytes += sizeof(ChainPage) + page->cbsize;
+  }
+
+  // BlockChains::Cursor implementation
+
+  template <class Allocator>
+  BlockChains<Allocator>::Cursor::Cursor( const ChainHook* chain ):
+    pchain( chain ),
+    bkType( chain->bkType ),
+    inpage{ 0, {} }
+  {
+  // register the reader before the pages are loaded; the pages are loaded
+  // before the runs, see ChainHook::Spill()
+    ++pchain->readers;
+
+    ppage = pchain->ppages.load();
+    plink = pchain->pfirst.load();
+
+    for ( auto prun = pspill = pchain->pspill.load(); prun != nullptr; prun = prun->p_next.load() )
+      usplit = (pslast = prun)->ulast;
+
+    if ( pspill != nullptr )  LoadRun();
+      else inpage.uEntity = ppage != nullptr ? ppage->uprior : 0;
+
+    NextPage();
+    NextLink();
+  }
+
+  template <class Allocator>
+  BlockChains<Allocator>::Cursor::Cursor( const Cursor& cursor ):
+    pchain( cursor.pchain ),
+    bkType( cursor.bkType ),
+    ppage( cursor.ppage ),
+    offset( cursor.offset ),
+    inpage( cursor.inpage ),
+    plink( cursor.plink ),
+    pspill( cursor.pspill ),
+    pslast( cursor.pslast ),
+    usplit( cursor.usplit ),
+    runtop( cursor.runtop ),
+    runend( cursor.runend ),
+    runbuf( cursor.runbuf )
+  {
+    ++pchain->readers;
+  }
+
+  template <class Allocator>
+  BlockChains<Allocator>::Cursor::~Cursor()
+  {
+    --pchain->readers;
+  }
+
+  template <class Allocator>
+  auto  BlockChains<Allocator>::Cursor::Curr() const -> Reference
+  {
+    if ( plink != nullptr && plink->entity < inpage.uEntity )
+      return { plink->entity, { plink->data(), plink->lblock } };
+    return inpage;
+  }
+
+  template <class Allocator>
+  auto  BlockChains<Allocator>::Cursor::Next() -> Reference
+  {
+    if ( plink != nullptr && plink->entity < inpage.uEntity )
+      plink = plink->p_next.load(), NextLink();
+    else
+    if ( inpage.uEntity != uint32_t(-1) )
+      NextPage();
+
+    return Curr();
+  }
+
+ /*
+  * Cursor::NextPage()
+  *
+  * Decodes the next entity in the spilled runs and then in the pages; the
+  * entities are published by the used size of the page, so the pages may
+  * grow while listed.
+  *
+  * The runs spilled after the cursor was created are not listed, and the
+  * entities in pages up to the last one spilled are skipped, so each entity
+  * is listed once whatever the spill the cursor races with.
+  */
+  template <class Allocator>
+  void  BlockChains<Allocator>::Cursor::NextPage()
+  {
+    while ( pspill != nullptr )
+    {
+      if ( runtop != runend )
+        return (void)(runtop = Decode( runtop ));
+
+      if ( (pspill = pspill != pslast ? pspill->p_next.load() : nullptr) != nullptr )  LoadRun();
+        else inpage.uEntity = ppage != nullptr ? ppage->uprior : 0;
+    }
+
+    for ( ; ppage != nullptr; offset = 0 )
+    {
+      while ( offset < ppage->cbused.load() )
+      {
+        offset = uint32_t(Decode( ppage->data() + offset ) - ppage->data());
+
+        if ( inpage.uEntity > usplit )
+          return;
+      }
+      if ( (ppage = ppage->p_next.load()) != nullptr )
+        inpage.uEntity = ppage->uprior;
+    }
+    inpage = { uint32_t(-1), {} };
+  }
+
+  template <class Allocator>
+  void  BlockChains<Allocator>::Cursor::NextLink()
+  {
+    while ( plink != nullptr && plink->entity == uint32_t(-1) )
+      plink = plink->p_next.load();
+  }
+
+  template <class Allocator>
+  void  BlockChains<Allocator>::Cursor::LoadRun()
+  {
+    if ( (runbuf = pspill->pstore->Get( pspill->offset )) == nullptr )
+      throw std::runtime_error( "could not read the spilled chain" );
+
+    runtop = runbuf->GetPtr();
+    runend = runtop + runbuf->GetLen();
+    inpage.uEntity = pspill->uprior;
+  }
+
+  template <class Allocator>
+  auto  BlockChains<Allocator>::Cursor::Decode( const char* ptrtop ) -> const char*
+  {
+    auto  diffId = uint32_t{};
+    auto  blkLen = uint32_t{};
+
+    ptrtop = ::FetchFrom( ptrtop, diffId );
+
+    if ( bkType != 0 )
+      ptrtop = ::FetchFrom( ptrtop, blkLen );
+
+    inpage = { inpage.uEntity + diffId + 1, { ptrtop, blkLen } };
+
+    return ptrtop + blkLen;
+  }
+
   // BlockChains::KeyLister implementation
 
   template <class Allocator>
@@ -2,8 +2,8 @@
 # include "override-entities.hpp"
 # include "dynamic-entities.hpp"
 # include "dynamic-chains.hpp"
+# include "dynamic-arena.hpp"
 # include "../../exceptions.hpp"
-# include <mtc/arena.hpp>
 
 namespace DelphiX {
 namespace indexer {
@@ -11,7 +11,7 @@ namespace dynamic {
 
   class ContentsIndex final: public IContentsIndex
   {
-    using Allocator = mtc::Arena::allocator<char>;
+    using Allocator = SlabArena::allocator<char>;
 
     using EntTable = EntityTable<Allocator>;
     using Contents = BlockChains<Allocator>;
@@ -22,12 +22,14 @@ namespace dynamic {
     class Entities;
     class EntitiesList;
     class ContentsList;
+    class PinnedView;
 
   public:
     ContentsIndex(
-      uint32_t maxEntities,
-      uint32_t maxAllocate, mtc::api<IStorage::IIndexStore> outputStorage );
-   ~ContentsIndex() {  contents.StopIt();  }
+      const Settings&                 openOptions,
+      mtc::api<IStorage::IIndexStore> outputStorage,
+      std::function<void(void*)>      notifyFilled );
+   ~ContentsIndex();
 
   public:
     auto  GetEntity( EntityId ) const -> mtc::api<const IEntity> override;
@@ -53,16 +55,53 @@ namespace dynamic {
 
     void  Stash( EntityId ) override  {  throw std::logic_error( "not implemented @" __FILE__ ":" LINE_STRING );  }
 
+    auto  Snapshot() -> mtc::api<IContentsIndex> override;
+
+  protected:
+    auto  MemUsage() const -> size_t;
+    void  CheckSpillMark();
+    void  SpillTask();
+    void  StopSpills();
+    void  CheckSoftMark();
+    void  SetIndexed( uint32_t );
+    void  SetDeleted( uint32_t );
+    bool  IsVisible( uint32_t, uint32_t, uint32_t ) const;
+
   protected:
-    const uint32_t                  memLimit;
-    mtc::Arena                      memArena;
+    const uint32_t                  memLimit;       // hard mark, entities are refused
+    const uint32_t                  memSoftMk;      // soft mark, the owner is notified
+    const uint32_t                  memSpillMk;     // spill mark, the largest chains are spilled
+    const uint32_t                  entSoftMk;
+    SlabArena                       memArena;       // thread slabs, shared budget
+
+    std::function<void(void*)>      notifyOn;
+    std::atomic_bool                isFilled = false;
+
+  // the spill task is queued or run; the spills are stopped by the commit or
+  // by the first failure, which is kept and thrown to the next writer
+    std::atomic_bool                isSpilling = false;
+    std::atomic_bool                spillStop = false;
+    std::atomic_bool                spillThrow = false;
+    std::exception_ptr              spillError;
+    std::mutex                      spillMutex;
+    std::condition_variable         spillEvent;
 
     mtc::api<IStorage::IIndexStore> pStorage;
+    mtc::api<IStorage::IDumpStore>  pSpilled;
 
     EntTable                        entities;
     Contents                        contents;
     Bitmap<Allocator>               shadowed;
 
+  // snapshot support: the watermark is the index all the entities below are
+  // completely indexed, and each deleted entity keeps the deletion epoch
+    using EpochVector = std::vector<std::atomic_uint32_t, AllocatorCast<Allocator, std::atomic_uint32_t>>;
+
+    Bitmap<Allocator>               indexed;
+    std::atomic_uint32_t            stable = 0;
+    EpochVector                     dropped;
+    std::atomic_uint32_t            delEpoch = 0;
+
   };
 
   class ContentsIndex::KeyValue: public IIndexAPI
@@ -85,19 +124,20 @@ namespace dynamic {
   class ContentsIndex::Entities final: public IEntities
   {
     friend class ContentsIndex;
+    friend class PinnedView;
 
     using ChainHook = std::remove_pointer<decltype((
       contents.Lookup({})))>::type;
-    using ChainLink = std::remove_pointer<decltype((
-      contents.Lookup({})->pfirst.load()))>::type;
 
     implement_lifetime_control
 
   protected:
-    Entities( ChainHook* chain, const ContentsIndex* owner ):
+    Entities( ChainHook* chain, const ContentsIndex* owner, uint32_t upper = uint32_t(-1), uint32_t epoch = uint32_t(-1) ):
       pwhere( chain ),
-      pchain( mtc::ptr::clean( chain->pfirst.load() ) ),
-      parent( owner ) {}
+      pchain( chain ),
+      parent( owner ),
+      maxIndex( upper ),
+      delEpoch( epoch ) {}
 
   public:     // IEntities overridables
     auto  Find( uint32_t ) -> Reference override;
@@ -106,8 +146,10 @@ namespace dynamic {
 
   protected:
     ChainHook*                    pwhere;
-    ChainLink*                    pchain;
+    Contents::Cursor              pchain;
     mtc::api<const ContentsIndex> parent;
+    uint32_t                      maxIndex;
+    uint32_t                      delEpoch;
 
   };
 
@@ -149,17 +191,92 @@ namespace dynamic {
 
   };
 
+  /*
+   * PinnedView is the read-only snapshot of the dynamic index pinned to the
+   * entity index watermark and the deletion epoch: entities set after the
+   * snapshot was taken are not visible, the ones deleted or replaced later
+   * are still visible.  Key statistics and lists are the live ones.
+   */
+  class ContentsIndex::PinnedView final: public IContentsIndex
+  {
+    implement_lifetime_control
+
+  public:
+    PinnedView( ContentsIndex* ix ):
+      contents( ix ),
+      maxIndex( ix->stable.load() ),
+      delEpoch( ix->delEpoch.load() ) {}
+
+  public:
+    auto  GetEntity( EntityId ) const -> mtc::api<const IEntity> override;
+    auto  GetEntity( uint32_t ) const -> mtc::api<const IEntity> override;
+
+    bool  DelEntity( EntityId ) override
+      {  throw std::logic_error( "index snapshot is read-only" );  }
+    auto  SetEntity( EntityId, mtc::api<const IContents>,
+      const std::string_view&, const std::string_view& ) -> mtc::api<const IEntity> override
+      {  throw std::logic_error( "index snapshot is read-only" );  }
+    auto  SetExtras( EntityId, const std::string_view& ) -> mtc::api<const IEntity> override
+      {  throw std::logic_error( "index snapshot is read-only" );  }
+
+    auto  GetMaxIndex() const -> uint32_t override  {  return maxIndex;  }
+    auto  GetKeyBlock( const std::string_view& ) const -> mtc::api<IEntities> override;
+    auto  GetKeyStats( const std::string_view& key ) const -> BlockInfo override
+      {  return contents->GetKeyStats( key );  }
+
+    auto  ListEntities( EntityId id ) -> mtc::api<IEntitiesList> override
+      {  return contents->ListEntities( id );  }
+    auto  ListEntities( uint32_t ix ) -> mtc::api<IEntitiesList> override
+      {  return contents->ListEntities( ix );  }
+    auto  ListContents( const std::string_view& key ) -> mtc::api<IContentsList> override
+      {  return contents->ListContents( key );  }
+
+    auto  Commit() -> mtc::api<IStorage::ISerialized> override
+      {  throw std::logic_error( "index snapshot is read-only" );  }
+    auto  Reduce() -> mtc::api<IContentsIndex> override  {  return this;  }
+    void  Remove() override
+      {  throw std::logic_error( "index snapshot is read-only" );  }
+
+    void  Stash( EntityId ) override
+      {  throw std::logic_error( "index snapshot is read-only" );  }
+
+    auto  Snapshot() -> mtc::api<IContentsIndex> override  {  return this;  }
+
+  protected:
+    auto  GetPinned( uint32_t ) const -> mtc::api<const IEntity>;
+
+  protected:
+    mtc::api<ContentsIndex> contents;
+    const uint32_t          maxIndex;
+    const uint32_t          delEpoch;
+
+  };
+
   // ContentsIndex implementation
 
-  ContentsIndex::ContentsIndex( uint32_t maxEntities, uint32_t maxAllocate, mtc::api<IStorage::IIndexStore> storageSink  ):
-    memLimit( maxAllocate ),
-    pStorage( storageSink ),
-    entities( maxEntities, this, pStorage != nullptr ? pStorage->Packages() : nullptr, memArena.get_allocator<char>() ),
-    contents( memArena.get_allocator<char>() ),
-    shadowed( maxEntities, memArena.get_allocator<char>() )
+  ContentsIndex::ContentsIndex( const Settings& openOptions, mtc::api<IStorage::IIndexStore> storageSink,
+    std::function<void(void*)> notifyFilled ):
+      memLimit( openOptions.maxAllocate ),
+      memSoftMk( uint32_t(uint64_t(openOptions.maxAllocate) * std::min( openOptions.softPercent, 100U ) / 100) ),
+      memSpillMk( uint32_t(uint64_t(openOptions.maxAllocate) * std::min( openOptions.spillPercent, 100U ) / 100) ),
+      entSoftMk( uint32_t(uint64_t(openOptions.maxEntities) * std::min( openOptions.softPercent, 100U ) / 100) ),
+      notifyOn( notifyFilled ),
+      pStorage( storageSink ),
+      pSpilled( memSpillMk != 0 && pStorage != nullptr ? pStorage->Spillage() : nullptr ),
+      entities( openOptions.maxEntities, this, pStorage != nullptr ? pStorage->Packages() : nullptr, memArena.get_allocator<char>() ),
+      contents( memArena.get_allocator<char>() ),
+      shadowed( openOptions.maxEntities, memArena.get_allocator<char>() ),
+      indexed( openOptions.maxEntities, memArena.get_allocator<char>() ),
+      dropped( openOptions.maxEntities, memArena.get_allocator<char>() )
   {
   }
 
+  ContentsIndex::~ContentsIndex()
+  {
+    StopSpills();
+    contents.StopIt();
+  }
+
   auto  ContentsIndex::GetEntity( EntityId id ) const -> mtc::api<const IEntity>
   {
     return entities.GetEntity( id ).ptr();
@@ -174,7 +291,7 @@ namespace dynamic {
   {
     uint32_t  del_id = entities.DelEntity( id );
 
-    return del_id != (uint32_t)-1 ? shadowed.Set( del_id ), true : false;
+    return del_id != (uint32_t)-1 ? SetDeleted( del_id ), true : false;
   }
 
   auto  ContentsIndex::SetEntity( EntityId id, mtc::api<const IContents> keys,
@@ -185,10 +302,14 @@ namespace dynamic {
     auto  del_id = uint32_t{};
     auto  bdlPos = int64_t(-1);
 
-  // check memory requirements
-    if ( memArena.memusage() > memLimit )
+  // check memory requirements; the hard mark refuses any new entities
+    if ( MemUsage() > memLimit )
       throw index_overflow( "dynamic index memory overflow" );
 
+  // the spill failed is reported once, the entity is not set
+    if ( spillThrow.load() && spillThrow.exchange( false ) )
+      std::rethrow_exception( spillError );
+
   // check if bodies are defined
     if ( bodies != nullptr && !beef.empty() )
       bdlPos = bodies->Put( beef.data(), beef.size() );
@@ -199,11 +320,24 @@ namespace dynamic {
 
   // check if any entities deleted
     if ( del_id != uint32_t(-1) )
-      shadowed.Set( del_id );
-
-  // process contents indexing
-    if ( keys != nullptr )
-      keys->Enum( KeyValue( contents, entity->GetIndex() ).ptr() );
+      SetDeleted( del_id );
+
+  // process contents indexing; the entity is complete for snapshots even if
+  // indexing failed, else the watermark would stop on it
+    try
+    {
+      if ( keys != nullptr )
+        keys->Enum( KeyValue( contents, entity->GetIndex() ).ptr() );
+    }
+    catch ( ... )
+    {
+      SetIndexed( entity->GetIndex() );
+      throw;
+    }
+
+    SetIndexed( entity->GetIndex() );
+    CheckSpillMark();
+    CheckSoftMark();
 
     return Override::Entity( entity.ptr() ).Bundle( bodies, entity->GetPackPos() );
   }
@@ -217,7 +351,7 @@ namespace dynamic {
   {
     auto  pchain = contents.Lookup( { key.data(), key.size() } );
 
-    return pchain != nullptr && pchain->pfirst.load() != nullptr ?
+    return pchain != nullptr && !pchain->Empty() ?
       new Entities( pchain, this ) : nullptr;
   }
 
@@ -230,6 +364,11 @@ namespace dynamic {
     return { uint32_t(-1), 0 };
   }
 
+  auto  ContentsIndex::Snapshot() -> mtc::api<IContentsIndex>
+  {
+    return new PinnedView( this );
+  }
+
   auto  ContentsIndex::ListEntities( EntityId id ) -> mtc::api<IEntitiesList>
   {
     return new EntitiesList( entities.GetIterator( id ), this );
@@ -250,7 +389,8 @@ namespace dynamic {
     if ( pStorage == nullptr )
       throw std::logic_error( "output storage is not defined, but FlushSink() was called" );
 
-  // finalize keys thread and remove all the deleted elements from lists
+  // finalize spills and keys thread and remove all the deleted elements from lists
+    StopSpills();
     contents.StopIt().Remove( shadowed );
 
 //    contents.VerifyIds( GetMaxIndex() );
@@ -268,17 +408,188 @@ namespace dynamic {
       pStorage->Remove();
   }
 
+  /*
+   * MemUsage()
+   *
+   * Returns the memory allocated less the spilled pages kept for reuse.
+   */
+  auto  ContentsIndex::MemUsage() const -> size_t
+  {
+    auto  nalloc = memArena.memusage();
+    auto  pooled = contents.GetPooled();
+
+    return nalloc > pooled ? nalloc - pooled : 0;
+  }
+
+  /*
+   * CheckSpillMark()
+   *
+   * Queues the spill task once the index passes the spill mark of memory usage,
+   * so the index is rotated by the entities count rather than by memory.  One
+   * spill is queued at a time, the writers continue.
+   */
+  void  ContentsIndex::CheckSpillMark()
+  {
+    if ( pSpilled == nullptr || spillStop.load() || MemUsage() < memSpillMk )
+      return;
+
+    if ( !isSpilling.exchange( true ) )
+      Executor::Get().Run( Executor::housekeeping, this, [this](){  SpillTask();  } );
+  }
+
+  /*
+   * SpillTask()
+   *
+   * Spills the largest chains to the temporary store down to 3/4 of the spill
+   * mark.
+   *
+   * The spill is optional: if it fails, the error is kept, the spills are stopped
+   * and the owner is notified as at the soft mark, so the index is rotated before
+   * it reaches the hard mark.  The error is thrown by the next SetEntity() call.
+   */
+  void  ContentsIndex::SpillTask()
+  {
+    auto  memUsed = MemUsage();
+
+    try
+    {
+      if ( !spillStop.load() && memUsed >= memSpillMk )
+        contents.Spill( pSpilled.ptr(), memUsed - size_t(memSpillMk) * 3 / 4 );
+    }
+    catch ( ... )
+    {
+      spillError = std::current_exception();
+      spillStop = true;
+      spillThrow = true;
+    }
+
+    if ( spillError != nullptr && notifyOn != nullptr && !isFilled.exchange( true ) )
+      notifyOn( (IContentsIndex*)this );
+
+  // notify under the lock, the destructor waits for the task to finish
+    mtc::interlocked( mtc::make_unique_lock( spillMutex ), [&]()
+      {
+        isSpilling = false;
+        spillEvent.notify_all();
+      } );
+  }
+
+  /*
+   * StopSpills()
+   *
+   * Stops the spills: cancels the spill task queued or waits until the task run
+   * is finished.
+   */
+  void  ContentsIndex::StopSpills()
+  {
+    auto  exlock = mtc::make_unique_lock( spillMutex );
+
+    spillStop = true;
+
+    if ( Executor::Get().Cancel( this ) != 0 )
+      isSpilling = false;
+
+    spillEvent.wait( exlock, [&](){  return !isSpilling.load();  } );
+  }
+
+  /*
+   * CheckSoftMark()
+   *
+   * Notifies the owner once the index passes the soft mark of memory usage
+   * or entities count, so the replacement may be prepared before writers
+   * get index_overflow at the hard mark.
+   */
+  void  ContentsIndex::CheckSoftMark()
+  {
+    if ( notifyOn == nullptr || isFilled.load() )
+      return;
+
+    if ( MemUsage() < memSoftMk && entities.GetEntityCount() < entSoftMk )
+      return;
+
+    if ( !isFilled.exchange( true ) )
+      notifyOn( (IContentsIndex*)this );
+  }
+
+  /*
+   * SetIndexed( index )
+   *
+   * Marks the entity as completely indexed and moves the watermark over the
+   * continuous range of indexed entities, without any locks.
+   */
+  void  ContentsIndex::SetIndexed( uint32_t index )
+  {
+    indexed.Set( index );
+
+    for ( auto upper = stable.load(); indexed.Get( upper + 1 ); )
+      stable.compare_exchange_weak( upper, upper + 1 );
+  }
+
+  /*
+   * SetDeleted( index )
+   *
+   * Stores the deletion epoch for the entity before it is marked as deleted,
+   * so the snapshots taken before the deletion still see the entity.
+   */
+  void  ContentsIndex::SetDeleted( uint32_t index )
+  {
+    dropped[index] = ++delEpoch;
+      shadowed.Set( index );
+  }
+
+  bool  ContentsIndex::IsVisible( uint32_t index, uint32_t upper, uint32_t epoch ) const
+  {
+    return index <= upper && (!shadowed.Get( index ) || dropped[index].load() > epoch);
+  }
+
   // ContentsIndex::Entities implemenation
 
   auto  ContentsIndex::Entities::Find( uint32_t id ) -> Reference
   {
-    while ( pchain != nullptr && (pchain->entity < id || parent->shadowed.Get( pchain->entity )) )
-      pchain = pchain->p_next.load();
+    for ( auto next = pchain.Curr(); next.uEntity <= maxIndex && next.uEntity != uint32_t(-1); next = pchain.Next() )
+      if ( next.uEntity >= id && parent->IsVisible( next.uEntity, maxIndex, delEpoch ) )
+        return next;
 
-    if ( pchain != nullptr )
-      return { pchain->entity, { pchain->data(), pchain->lblock } };
-    else
-      return { uint32_t(-1), { nullptr, 0 } };
+    return { uint32_t(-1), { nullptr, 0 } };
+  }
+
+  // ContentsIndex::PinnedView implementation
+
+  auto  ContentsIndex::PinnedView::GetEntity( EntityId id ) const -> mtc::api<const IEntity>
+  {
+    auto  index = contents->entities.FindRecord( id, maxIndex );
+
+    return index != 0 ? GetPinned( index ) : nullptr;
+  }
+
+  auto  ContentsIndex::PinnedView::GetEntity( uint32_t index ) const -> mtc::api<const IEntity>
+  {
+    if ( index == 0 || index == uint32_t(-1) )
+      throw std::invalid_argument( "index out of range" );
+
+    return GetPinned( index );
+  }
+
+  auto  ContentsIndex::PinnedView::GetKeyBlock( const std::string_view& key ) const -> mtc::api<IEntities>
+  {
+    auto  pchain = contents->contents.Lookup( { key.data(), key.size() } );
+
+    return pchain != nullptr && !pchain->Empty() ?
+      new Entities( pchain, contents.ptr(), maxIndex, delEpoch ) : nullptr;
+  }
+
+  /*
+   * GetPinned( index )
+   *
+   * Returns the entity visible in the snapshot; the entity record may be
+   * deleted after the snapshot was taken, so the index is overriden.
+   */
+  auto  ContentsIndex::PinnedView::GetPinned( uint32_t index ) const -> mtc::api<const IEntity>
+  {
+    if ( !contents->IsVisible( index, maxIndex, delEpoch ) )
+      return nullptr;
+
+    return Override::Entity( contents->entities.GetRecord( index ).ptr() ).Index( index );
   }
 
   // contents implementation
@@ -289,7 +600,10 @@ namespace dynamic {
   auto  Index::Set( mtc::api<IStorage::IIndexStore> storage ) -> Index&
     {  return storageSink = storage, *this;  }
 
+  auto  Index::Set( OnFilled notify ) -> Index&
+    {  return notifyOwner = notify, *this;  }
+
   auto  Index::Create() const -> mtc::api<IContentsIndex>
-    {  return new ContentsIndex( openOptions.maxEntities, openOptions.maxAllocate, storageSink );  }
+    {  return new ContentsIndex( openOptions, storageSink, notifyOwner );  }
 
 }}}
@@ -79,12 +79,12 @@ namespace dynamic {
       string                id;                   // public entity id
       extras                extra;                // document attributes
       uint32_t              index = -1;          // order of creation, default 0
+      uint32_t              prior = 0;           // index of the version replaced
       int64_t               packPos = -1;
       uint64_t              version;
 
       mtc::Iface*           ownerPtr = nullptr;
       IStorage::IDumpStore* docStore = nullptr;
-      std::atomic<Entity*>  collision = nullptr;  // relocation in the hash table
 
     };
 
@@ -125,6 +125,21 @@ namespace dynamic {
     auto  SetEntity( const std::string_view&, const std::string_view& = {}, uint32_t* = nullptr ) -> mtc::api<Entity>;
     auto  SetExtras( const std::string_view&, const std::string_view& = {} ) -> mtc::api<Entity>;
 
+  /*
+   *  ::GetRecord( uint32_t )
+   *  Get entity record by index even if deleted or replaced.
+   *  Returns nullptr if not created yet.
+   *
+   *  ::FindRecord( StrView, uint32_t upper )
+   *  Find the index of the latest version of entity not above the upper index
+   *  passed, deleted or not.  Returns 0 if not found.
+   *
+   *  Both are used by snapshot views to read the versions replaced after the
+   *  snapshot was taken.
+   */
+    auto  GetRecord( uint32_t ) const -> mtc::api<const Entity>;
+    auto  FindRecord( const std::string_view&, uint32_t ) const -> uint32_t;
+
   public:      // iterator access
     auto  GetIterator( uint32_t ) const -> Iterator;
     auto  GetIterator( const std::string_view& ) const -> Iterator;
@@ -152,11 +167,49 @@ namespace dynamic {
     template <class S>
     static  auto  getEntity( S&, const std::string_view& ) -> mtc::api<EntityOf<S>>;
 
+  protected:
+   /*
+    * The id hash table is open-addressing one with linear probing; each slot holds
+    * the 32-bit hash fingerprint and the index of the entity with flags packed into
+    * single atomic 64-bit value.  Slots are never released, so the table has twice
+    * as many slots as entities to be stored.
+    */
+    using AtomicSlot = std::atomic<uint64_t>;
+
+    enum: uint32_t
+    {
+      slot_deleted = 0x80000000,    // the entity referenced is deleted
+      slot_blocked = 0x40000000,    // the slot is blocked for modification
+      slot_indices = 0x3fffffff
+    };
+
+    static  auto  HashPrint( size_t hash ) -> uint32_t
+      {  return uint32_t(uint64_t(hash) >> 32) ^ uint32_t(hash);  }
+    static  auto  SlotValue( uint32_t fprint, uint32_t index ) -> uint64_t
+      {  return (uint64_t(fprint) << 32) | index;  }
+    static  auto  SlotPrint( uint64_t hvalue ) -> uint32_t
+      {  return uint32_t(hvalue >> 32);  }
+    static  auto  SlotIndex( uint64_t hvalue ) -> uint32_t
+      {  return uint32_t(hvalue) & slot_indices;  }
+    static  bool  IsDeleted( uint64_t hvalue )
+      {  return (uint32_t(hvalue) & slot_deleted) != 0;  }
+    static  bool  IsBlocked( uint64_t hvalue )
+      {  return (uint32_t(hvalue) & slot_blocked) != 0;  }
+
+    auto  findSlot( const std::string_view&, uint64_t& ) const -> AtomicSlot*;
+
+    static  auto  CheckLimit( uint32_t size_limit ) -> uint32_t
+    {
+      if ( size_limit > slot_indices )
+        throw std::invalid_argument( "entities limit is too big" );
+      return size_limit;
+    }
+
   protected:
     using EntityHolder = typename std::aligned_storage<sizeof(Entity), alignof(Entity)>::type;
     using AtomicEntity = std::atomic<Entity*>;
     using EntityVector = std::vector<EntityHolder, AllocatorCast<Allocator, EntityHolder>>;
-    using StrHashTable = std::vector<AtomicEntity, AllocatorCast<Allocator, AtomicEntity>>;
+    using StrHashTable = std::vector<AtomicSlot, AllocatorCast<Allocator, AtomicSlot>>;
 
     const size_t EntityHolderSize = sizeof(EntityHolder);
 
@@ -246,9 +299,9 @@ namespace dynamic {
 
   template <class Allocator>
   EntityTable<Allocator>::EntityTable( uint32_t size_limit, mtc::Iface* owner, IStorage::IDumpStore* store, Allocator alloc ):
-    entStore( size_limit, alloc ),
+    entStore( CheckLimit( size_limit ), alloc ),   // checked before anything is allocated
     ptrStore( &getEntity( 1 ) ),
-    entTable( UpperPrime( size_limit ), alloc ),
+    entTable( UpperPrime( size_t(size_limit) * 2 ), alloc ),
     ptrOwner( owner ),
     docStore( store )
   {
@@ -266,49 +319,41 @@ namespace dynamic {
  /*
   *  EntityTable::DelEntity( StrView id )
   *
-  *  Marks the document with specified id as deleted and removes from the linked list
-  *  if found. Returns false if document is not found.
+  *  Marks the document with specified id as deleted in the hash table slot and
+  *  in the entity record.  Returns the index of deleted entity or -1 if not found.
   */
   template <class Allocator>
   auto  EntityTable<Allocator>::DelEntity( const std::string_view& id ) -> uint32_t
   {
-    auto  hindex = std::hash<std::string_view>{}( { id.data(), id.size() } ) % entTable.size();
-    auto* hentry = &entTable[hindex];
-    auto  hvalue = mtc::ptr::clean( hentry->load() );
+    auto  hvalue = uint64_t{};
+    auto  hentry = findSlot( id, hvalue );
     auto  del_id = uint32_t(-1);
 
-    // block the hash table entry from modifications
-    while ( !hentry->compare_exchange_weak( hvalue, mtc::ptr::dirty( hvalue ) ) )
-      hvalue = mtc::ptr::clean( hvalue );
+  // wait until the slot is unblocked and mark it as deleted
+    for ( ; ; )
+    {
+      if ( hvalue == 0 || IsDeleted( hvalue ) )
+        return uint32_t(-1);
 
-    // search existing documents with same document id and remove
-    for ( auto bfirst = true; hvalue != nullptr; hvalue = mtc::ptr::clean( hentry->load() ) )
-      if ( hvalue->id == id )
-      {
-        if ( bfirst ) hentry->store( mtc::ptr::dirty( hvalue->collision.load() ) );
-          else hentry->store( hvalue->collision.load() );
+      if ( IsBlocked( hvalue ) )
+        {  hvalue = hentry->load();  continue;  }
 
-        std::swap( del_id, hvalue->index );
-          break;
-      }
-        else
-      {
-        hentry = &hvalue->collision;
-        bfirst = false;
-      }
+      if ( hentry->compare_exchange_weak( hvalue, hvalue | slot_deleted ) )
+        break;
+    }
 
-  // unblock the entry
-    entTable[hindex].store( mtc::ptr::clean( entTable[hindex].load() ) );
-    return del_id;
+    std::swap( del_id, getEntity( SlotIndex( hvalue ) ).index );
+      return del_id;
   }
 
   template <class Allocator>
   auto  EntityTable<Allocator>::SetEntity( const std::string_view& id, const std::string_view& xtras, uint32_t* deleted ) -> mtc::api<Entity>
   {
-    auto  hindex = std::hash<std::string_view>{}( { id.data(), id.size() } ) % entTable.size();
-    auto* hentry = &entTable[hindex];
-    auto  hvalue = mtc::ptr::clean( hentry->load() );
+    auto  fprint = HashPrint( std::hash<std::string_view>{}( { id.data(), id.size() } ) );
     auto  entptr = ptrStore.load();
+    auto  entidx = uint32_t{};
+    auto  hvalue = uint64_t{};
+    auto  hentry = (AtomicSlot*)nullptr;
 
     if ( id.empty() )
       throw std::invalid_argument( "id is empty" );
@@ -329,49 +374,55 @@ namespace dynamic {
 
       (new( entptr ) Entity( entTable.get_allocator() ))->
         SetId( id ).
-        SetIndex( uint32_t(entptr - &getEntity( 0 )) ).
+        SetIndex( entidx = uint32_t(entptr - &getEntity( 0 )) ).
         SetExtra( xtras ).
         SetOwner( ptrOwner ).
         SetStore( docStore );
       break;
     }
 
-  // Ok, the entity is allocated and no changes made to document set and relocation table;
-  // ensure the element may be created with docid == -1 meaning it is 'deleted'
-  //
-  // Now block the hash table entry from modifications outside and create reference to document
-    while ( !hentry->compare_exchange_weak( hvalue, mtc::ptr::dirty( hvalue ) ) )
-      hvalue = mtc::ptr::clean( hvalue );
+  // Ok, the entity is allocated and no changes made to document set and hash table;
+  // now either occupy the free slot, or replace the reference to the previous version
+  // of the entity in the slot found
+    for ( hentry = findSlot( id, hvalue ); ; )
+    {
+      if ( hvalue == 0 )
+      {
+        if ( hentry->compare_exchange_strong( hvalue, SlotValue( fprint, entidx ) ) )
+          break;
+
+      // the slot is occupied by another SetEntity() call, possibly with the same
+      // id; continue probing
+        hentry = findSlot( id, hvalue );
+        continue;
+      }
+
+      if ( IsBlocked( hvalue ) )
+        {  hvalue = hentry->load();  continue;  }
+
+    // link the previous version before the new one is published
+      entptr->prior = SlotIndex( hvalue );
 
-  // search existing documents with same document id and remove
-    for ( auto bfirst = true; hvalue != nullptr; hvalue = mtc::ptr::clean( hentry->load() ) )
-      if ( hvalue->id == id )
+      if ( hentry->compare_exchange_weak( hvalue, SlotValue( fprint, entidx ) ) )
       {
-      // check algorithm consistency
-        if ( hvalue->index == uint32_t(-1) )
-          throw std::logic_error( "inconsistent lock-free algo @" __FILE__ ":" LINE_STRING );
+        if ( !IsDeleted( hvalue ) )
+        {
+          auto& oldent = getEntity( SlotIndex( hvalue ) );
 
-      // exclude matching document from the list
-        if ( bfirst ) hentry->store( mtc::ptr::dirty( hvalue->collision.load() ) );
-          else hentry->store( hvalue->collision.load() );
+        // check algorithm consistency
+          if ( oldent.index == uint32_t(-1) )
+            throw std::logic_error( "inconsistent lock-free algo @" __FILE__ ":" LINE_STRING );
 
-      // check if deleted document index is requested
-        if ( deleted != nullptr )
-          *deleted = uint32_t(hvalue - &getEntity( 0 ));
+        // check if deleted document index is requested
+          if ( deleted != nullptr )
+            *deleted = SlotIndex( hvalue );
 
-      // mark excluded document as deleted
-        hvalue->index = uint32_t(-1);
+        // mark excluded document as deleted
+          oldent.index = uint32_t(-1);
+        }
         break;
       }
-        else
-      {
-        hentry = &hvalue->collision;
-        bfirst = false;
-      }
-
-    // set up the document chain
-    entptr->collision.store( mtc::ptr::clean( entTable[hindex].load() ) );
-      entTable[hindex].store( entptr );
+    }
 
     return entptr;
   }
@@ -379,40 +430,67 @@ namespace dynamic {
   template <class Allocator>
   auto  EntityTable<Allocator>::SetExtras( const std::string_view& id, const std::string_view& xtras ) -> mtc::api<Entity>
   {
-    auto  hindex = std::hash<std::string_view>{}( { id.data(), id.size() } ) % entTable.size();
-    auto& hentry = entTable[hindex];
-    auto  hvalue = mtc::ptr::clean( hentry.load() );
+    auto  hvalue = uint64_t{};
+    auto  hentry = (AtomicSlot*)nullptr;
 
     if ( id.empty() )
       throw std::invalid_argument( "id is empty" );
 
-  // Now block the hash table entry from modifications outside
-    while ( !hentry.compare_exchange_weak( hvalue, mtc::ptr::dirty( hvalue ) ) )
-      hvalue = mtc::ptr::clean( hvalue );
+  // Now block the hash table slot from modifications outside
+    for ( hentry = findSlot( id, hvalue ); ; )
+    {
+      if ( hvalue == 0 || IsDeleted( hvalue ) )
+        return nullptr;
 
-  // search existing entity with specified id
-    while ( hvalue != nullptr && hvalue->id != id )
-      hvalue = mtc::ptr::clean( hvalue->collision.load() );
+      if ( IsBlocked( hvalue ) )
+        {  hvalue = hentry->load();  continue;  }
 
-  // check if not found
-    if ( hvalue == nullptr )
-      return hentry.store( mtc::ptr::clean( hentry.load() ) ), nullptr;
+      if ( hentry->compare_exchange_weak( hvalue, hvalue | slot_blocked ) )
+        break;
+    }
 
   // set up the entity data
     try
     {
-      hvalue->extra.resize( xtras.size() );
-        memcpy( hvalue->extra.data(), xtras.data(), xtras.size() );
+      auto& entity = getEntity( SlotIndex( hvalue ) );
+
+      entity.extra.resize( xtras.size() );
+        memcpy( entity.extra.data(), xtras.data(), xtras.size() );
 
-      return hentry.store( mtc::ptr::clean( hentry.load() ) ), hvalue;
+      return hentry->store( hvalue ), &entity;
     }
     catch ( ... )
     {
-      hentry.store( mtc::ptr::clean( hentry.load() ) );
+      hentry->store( hvalue );
       throw;
     }
   }
 
+ /*
+  *  EntityTable::findSlot( id, hvalue )
+  *
+  *  Probes the hash table for the slot referencing the entity with the id passed
+  *  or the first free slot where the entity has to be placed.  Stores the value
+  *  of the slot to hvalue.
+  */
+  template <class Allocator>
+  auto  EntityTable<Allocator>::findSlot( const std::string_view& id, uint64_t& hvalue ) const -> AtomicSlot*
+  {
+    auto  hashid = std::hash<std::string_view>{}( { id.data(), id.size() } );
+    auto  fprint = HashPrint( hashid );
+
+    for ( auto hindex = hashid % entTable.size(); ; hindex = (hindex + 1) % entTable.size() )
+    {
+      auto  hentry = const_cast<AtomicSlot*>( &entTable[hindex] );
+
+      if ( (hvalue = hentry->load()) == 0 )
+        return hentry;
+
+      if ( SlotPrint( hvalue ) == fprint && getEntity( SlotIndex( hvalue ) ).id == id )
+        return hentry;
+    }
+  }
+
   /*
    *  EntityTable::getEntity( uint32_t index )
    *
@@ -437,15 +515,41 @@ namespace dynamic {
   template <class S>
   auto  EntityTable<Allocator>::getEntity( S& self, const std::string_view& id ) -> mtc::api<EntityOf<S>>
   {
-    auto  hindex = std::hash<std::string_view>{}( { id.data(), id.size() } ) % self.entTable.size();
-    auto  docptr = mtc::ptr::clean( self.entTable[hindex].load() );
+    auto  hvalue = uint64_t{};
+    auto  docptr = decltype(&self.getEntity( 0 )){};
 
     // search matching document
-    while ( docptr != nullptr && docptr->id != id )
-      docptr = mtc::ptr::clean( docptr->collision.load() );
+    if ( self.findSlot( id, hvalue ) == nullptr || hvalue == 0 || IsDeleted( hvalue ) )
+      return nullptr;
+
+    // check if not deleted
+    docptr = &self.getEntity( SlotIndex( hvalue ) );
+
+    return docptr->index != uint32_t(-1) ? docptr : nullptr;
+  }
+
+  template <class Allocator>
+  auto  EntityTable<Allocator>::GetRecord( uint32_t index ) const -> mtc::api<const Entity>
+  {
+    if ( index == 0 || index == uint32_t(-1) || index >= entStore.size() )
+      throw std::invalid_argument( "index out of range" );
+
+    return &getEntity( index ) < ptrStore.load() ? &getEntity( index ) : nullptr;
+  }
+
+  template <class Allocator>
+  auto  EntityTable<Allocator>::FindRecord( const std::string_view& id, uint32_t upper ) const -> uint32_t
+  {
+    auto  hvalue = uint64_t{};
+    auto  record = uint32_t{};
+
+    if ( findSlot( id, hvalue ) == nullptr || hvalue == 0 )
+      return 0;
+
+    for ( record = SlotIndex( hvalue ); record > upper; record = getEntity( record ).prior )
+      (void)NULL;
 
-    // if found, lock and check if not deleted
-    return docptr != nullptr && docptr->index != uint32_t(-1) ? docptr : nullptr;
+    return record;
   }
 
   template <class Allocator>
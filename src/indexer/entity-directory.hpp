@@ -0,0 +1,351 @@
+# if !defined( __DelphiX_src_indexer_entity_directory_hxx__ )
+# define __DelphiX_src_indexer_entity_directory_hxx__
+# include "../../contents.hpp"
+# include <unordered_map>
+# include <string_view>
+# include <algorithm>
+# include <utility>
+# include <vector>
+# include <shared_mutex>
+# include <atomic>
+# include <mutex>
+
+namespace DelphiX {
+namespace indexer {
+
+ /*
+  * EntityDirectory maps the entity id hash to the key of the layer holding
+  * the live version of the entity, so the id-based operations of the layered
+  * index touch one layer instead of probing each.
+  *
+  * The entry keeps the second 32-bit fingerprint of the id; if two ids with
+  * equal hashes are placed, the entry becomes 'ambiguous' and the operations
+  * with these ids fall back to probing the layers.
+  *
+  * The absence of the entry means the entity does not exist.
+  *
+  * The entries keep the layer keys they were placed with; the keys of the
+  * layers merged or removed are remapped by the small table, and the entries
+  * are updated when touched.
+  */
+  class EntityDirectory: public mtc::Iface
+  {
+    implement_lifetime_control
+
+    enum: size_t
+    {
+      shard_count = 64
+    };
+
+    struct Location
+    {
+      uint32_t  ulayer;
+      uint32_t  fprint;
+      bool      copies;     // older versions are held by other layers
+    };
+
+    struct alignas(64) Shard
+    {
+      mutable std::mutex                      mxlock;
+      std::unordered_map<uint64_t, Location>  lookup;
+    };
+
+  public:
+    enum: uint32_t
+    {
+      unknown = 0,
+      ambiguous = uint32_t(-1)
+    };
+
+   /*
+    * Placement is the entity listed by the layer being placed on open; the
+    * placements are split by the shards, so the layers are listed in parallel
+    * and the shards are filled in parallel.
+    */
+    struct Placement
+    {
+      uint64_t  hashid;
+      uint32_t  fprint;
+      uint32_t  uindex;
+    };
+
+    using Listing = std::vector<std::vector<Placement>>;
+
+   /*
+    * Clash is the entity placed to the layer when the older layer already
+    * holds it; the older layer is 'ambiguous' for the ids clashing by hash.
+    */
+    struct Clash
+    {
+      uint32_t  uolder;
+      uint32_t  unewer;
+      uint32_t  uindex;
+    };
+
+  public:
+    auto  NewLayer() -> uint32_t  {  return ++nlayers;  }
+
+    auto  Get( const std::string_view& ) const -> uint32_t;
+    auto  Put( const std::string_view&, uint32_t ) -> uint32_t;
+    auto  Del( const std::string_view& ) -> uint32_t;
+    void  Move( const std::vector<uint32_t>&, uint32_t );
+    auto  Size() const -> size_t;
+
+    static  auto  List( IContentsIndex& ) -> Listing;
+    static  auto  Shards() -> size_t  {  return shard_count;  }
+    auto  Place( size_t, const std::vector<std::pair<uint32_t, const Listing*>>& ) -> std::vector<Clash>;
+
+  protected:
+    static  auto  HashId( const std::string_view& id ) -> uint64_t
+      {  return std::hash<std::string_view>{}( id );  }
+    static  auto  PrintId( const std::string_view& ) -> uint32_t;
+
+    static  auto  ShardOf( uint64_t hashid ) -> size_t
+      {  return (hashid >> 32) % shard_count;  }
+    auto  GetShard( uint64_t hashid ) const -> Shard&
+      {  return shards[ShardOf( hashid )];  }
+
+    auto  Insert( Shard&, uint64_t, uint32_t, uint32_t ) const -> uint32_t;
+    auto  Resolve( uint32_t ) const -> uint32_t;
+
+  protected:
+    mutable Shard         shards[shard_count];
+    std::atomic<uint32_t> nlayers = 0;
+
+    mutable std::shared_mutex               rmlock;
+    std::unordered_map<uint32_t, uint32_t>  remaps;     // the layers merged or removed
+    std::atomic<size_t>                     nremap = 0;
+
+  };
+
+  // EntityDirectory implementation
+
+ /*
+  * Get( id )
+  *
+  * Returns the key of the layer holding the entity, 'unknown' if there is no
+  * entity with this id, or 'ambiguous' if the layers have to be probed.
+  */
+  inline
+  auto  EntityDirectory::Get( const std::string_view& id ) const -> uint32_t
+  {
+    auto  hashid = HashId( id );
+    auto& rshard = GetShard( hashid );
+    auto  exlock = std::unique_lock<std::mutex>( rshard.mxlock );
+    auto  pfound = rshard.lookup.find( hashid );
+
+    if ( pfound == rshard.lookup.end() )
+      return unknown;
+
+    if ( pfound->second.ulayer == ambiguous )
+      return ambiguous;
+
+    if ( pfound->second.fprint != PrintId( id ) )
+      return unknown;
+
+    return pfound->second.ulayer = Resolve( pfound->second.ulayer );
+  }
+
+ /*
+  * Put( id, layer )
+  *
+  * Sets the layer holding the live version of the entity and returns the layer
+  * held the previous version: 'unknown' for the new entity, 'ambiguous' for the
+  * ids clashing by hash.
+  */
+  inline
+  auto  EntityDirectory::Put( const std::string_view& id, uint32_t ulayer ) -> uint32_t
+  {
+    auto  hashid = HashId( id );
+    auto& rshard = GetShard( hashid );
+    auto  exlock = std::unique_lock<std::mutex>( rshard.mxlock );
+
+    return Insert( rshard, hashid, PrintId( id ), ulayer );
+  }
+
+ /*
+  * Del( id )
+  *
+  * Removes the entry and returns the layer held the entity; the ambiguous
+  * entries are kept because other ids may still be placed.
+  *
+  * If the older versions of the entity are held by other layers, 'ambiguous'
+  * is returned, so the entity is deleted in all the layers.
+  */
+  inline
+  auto  EntityDirectory::Del( const std::string_view& id ) -> uint32_t
+  {
+    auto  hashid = HashId( id );
+    auto& rshard = GetShard( hashid );
+    auto  exlock = std::unique_lock<std::mutex>( rshard.mxlock );
+    auto  pfound = rshard.lookup.find( hashid );
+    auto  ulayer = uint32_t(unknown);
+
+    if ( pfound == rshard.lookup.end() )
+      return unknown;
+
+    if ( (ulayer = pfound->second.ulayer) == ambiguous )
+      return ambiguous;
+
+    if ( pfound->second.fprint != PrintId( id ) )
+      return unknown;
+
+    if ( (ulayer = Resolve( ulayer )) != unknown && pfound->second.copies )
+      ulayer = ambiguous;
+
+    return rshard.lookup.erase( pfound ), ulayer;
+  }
+
+ /*
+  * Move( from, to )
+  *
+  * Moves the entries of the layers listed to the other layer, e.g. when the
+  * layers are merged; with 'unknown' target, the entries are removed.
+  *
+  * The entries are not rewritten: the layers listed are remapped to the target
+  * one, and the remaps pointing to the layers listed are redirected, so each
+  * key is resolved by one lookup.
+  */
+  inline
+  void  EntityDirectory::Move( const std::vector<uint32_t>& layers, uint32_t ulayer )
+  {
+    auto  exlock = std::unique_lock<std::shared_mutex>( rmlock );
+
+    for ( auto& next: remaps )
+      if ( std::find( layers.begin(), layers.end(), next.second ) != layers.end() )
+        next.second = ulayer;
+
+    for ( auto source: layers )
+      remaps[source] = ulayer;
+
+    nremap = remaps.size();
+  }
+
+  inline
+  auto  EntityDirectory::Size() const -> size_t
+  {
+    auto  nitems = size_t(0);
+
+    for ( auto& rshard: shards )
+    {
+      auto  exlock = std::unique_lock<std::mutex>( rshard.mxlock );
+
+      nitems += rshard.lookup.size();
+    }
+    return nitems;
+  }
+
+ /*
+  * List( index )
+  *
+  * Lists the entities of the layer split by the shards; is called for each
+  * layer in parallel on open.
+  */
+  inline
+  auto  EntityDirectory::List( IContentsIndex& index ) -> Listing
+  {
+    auto  listed = Listing( shard_count );
+    auto  plist = index.ListEntities( "" );
+
+    if ( plist != nullptr )
+      for ( auto entity = plist->Curr(); entity != nullptr; entity = plist->Next() )
+      {
+        auto  entid = entity->GetId();
+        auto  hashid = HashId( entid );
+
+        listed[ShardOf( hashid )].push_back( { hashid, PrintId( entid ), entity->GetIndex() } );
+      }
+
+    return listed;
+  }
+
+ /*
+  * Place( shard, layers )
+  *
+  * Fills the shard with the entities of the layers listed from the oldest to
+  * the newest one and returns the entities replacing the older versions.
+  */
+  inline
+  auto  EntityDirectory::Place( size_t nshard, const std::vector<std::pair<uint32_t, const Listing*>>& layers ) -> std::vector<Clash>
+  {
+    auto& rshard = shards[nshard];
+    auto  exlock = std::unique_lock<std::mutex>( rshard.mxlock );
+    auto  clashes = std::vector<Clash>();
+
+    for ( auto& layer: layers )
+      for ( auto& next: (*layer.second)[nshard] )
+      {
+        auto  uolder = Insert( rshard, next.hashid, next.fprint, layer.first );
+
+        if ( uolder != unknown && uolder != layer.first )
+          clashes.push_back( { uolder, layer.first, next.uindex } );
+      }
+
+    return clashes;
+  }
+
+ /*
+  * PrintId( id )
+  *
+  * The 32-bit FNV-1a hash independent of the std::hash used for the key.
+  */
+  inline
+  auto  EntityDirectory::PrintId( const std::string_view& id ) -> uint32_t
+  {
+    auto  fprint = uint32_t(2166136261U);
+
+    for ( auto ch: id )
+      fprint = (fprint ^ uint8_t(ch)) * 16777619U;
+
+    return fprint;
+  }
+
+ /*
+  * Insert( shard, hashid, fprint, layer )
+  *
+  * Places the entity to the locked shard, see Put(); the entity replacing the
+  * version held by another layer is marked to have copies.  The entry of the
+  * layer removed is replaced as the new one.
+  */
+  inline
+  auto  EntityDirectory::Insert( Shard& rshard, uint64_t hashid, uint32_t fprint, uint32_t ulayer ) const -> uint32_t
+  {
+    auto  inserted = rshard.lookup.insert( { hashid, { ulayer, fprint, false } } );
+    auto& location = inserted.first->second;
+
+    if ( inserted.second || location.ulayer == ambiguous )
+      return inserted.second ? unknown : ambiguous;
+
+    if ( (location.ulayer = Resolve( location.ulayer )) == unknown )
+      return location = { ulayer, fprint, false }, unknown;
+
+    if ( location.fprint != fprint )
+      return location.ulayer = ambiguous;
+
+    if ( location.ulayer != ulayer )
+      location.copies = true;
+
+    return std::exchange( location.ulayer, ulayer );
+  }
+
+ /*
+  * Resolve( layer )
+  *
+  * Returns the layer holding the entries placed to the layer passed, 'unknown'
+  * for the layers removed.
+  */
+  inline
+  auto  EntityDirectory::Resolve( uint32_t ulayer ) const -> uint32_t
+  {
+    if ( ulayer == ambiguous || nremap.load() == 0 )
+      return ulayer;
+
+    auto  shlock = std::shared_lock<std::shared_mutex>( rmlock );
+    auto  pfound = remaps.find( ulayer );
+
+    return pfound != remaps.end() ? pfound->second : ulayer;
+  }
+
+}}
+
+# endif   // !__DelphiX_src_indexer_entity_directory_hxx__
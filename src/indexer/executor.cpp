@@ -0,0 +1,215 @@
+# include "../../indexer/executor.hpp"
+# include <algorithm>
+# include <iterator>
+
+namespace DelphiX {
+namespace indexer {
+
+  static  auto  DefaultThreads() -> unsigned
+  {
+    return std::max( 2U, std::thread::hardware_concurrency() / 2 );
+  }
+
+  // Executor implementation
+
+  Executor::Executor( unsigned count ):
+    nthreads( count != 0 ? count : DefaultThreads() ) {}
+
+  Executor::~Executor()
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxLock );
+    auto  finish = std::move( workers );
+
+    nthreads = 0;
+      exlock.unlock();
+    mxWait.notify_all();
+
+    for ( auto& next: finish )
+      next.join();
+  }
+
+  auto  Executor::Get() -> Executor&
+  {
+    static auto executor = new Executor();    // never destroyed, the indexes may outlive the statics
+
+    return *executor;
+  }
+
+  auto  Executor::SetThreads( unsigned count ) -> Executor&
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxLock );
+    auto  finish = std::vector<std::thread>();
+
+    nthreads = count != 0 ? count : DefaultThreads();
+
+    if ( Workers() < workers.size() )
+    {
+      finish.insert( finish.end(),
+        std::make_move_iterator( workers.begin() + Workers() ),
+        std::make_move_iterator( workers.end() ) );
+      workers.resize( Workers() );
+    } else Spawn( Pending() );
+
+    exlock.unlock();
+    mxWait.notify_all();
+
+    for ( auto& next: finish )
+      next.join();
+
+    return *this;
+  }
+
+  auto  Executor::GetThreads() const -> unsigned
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxLock );
+
+    return nthreads;
+  }
+
+  void  Executor::Run( Priority prio, const void* owner, Task task )
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxLock );
+
+    queues[prio].push_back( { prio, owner, std::move( task ) } );
+      Spawn( Pending() );
+
+  // the reserved worker may take the wakeup of the merge it does not run
+    if ( workers.size() > nthreads )
+      mxWait.notify_all();
+    else
+      mxWait.notify_one();
+  }
+
+  void  Executor::Run( Priority prio, const void* owner, Task task, Clock::duration delay )
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxLock );
+
+    timers.insert( { Clock::now() + delay, { prio, owner, std::move( task ) } } );
+      Spawn( 1 );
+    mxWait.notify_all();    // the idle workers have to wait for the nearest timer
+  }
+
+  auto  Executor::Cancel( const void* owner ) -> size_t
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxLock );
+    auto  ncount = size_t(0);
+
+    for ( auto& queue: queues )
+      for ( auto it = queue.begin(); it != queue.end(); )
+        if ( it->owner == owner ) it = queue.erase( it ), ++ncount;
+          else ++it;
+
+    for ( auto it = timers.begin(); it != timers.end(); )
+      if ( it->second.owner == owner ) it = timers.erase( it ), ++ncount;
+        else ++it;
+
+    return ncount;
+  }
+
+ /*
+  * Worker( index )
+  *
+  * Runs the tasks while the worker index is below the count of workers; the
+  * task is released out of the lock because it may hold the owner objects.
+  * The worker reserved above the count of threads does not run the merges.
+  */
+  void  Executor::Worker( size_t index )
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxLock );
+
+    pthread_setname_np( pthread_self(), "indexer::Worker" );
+
+    for ( Queued next; index < Workers(); )
+    {
+      if ( GetNext( next, index < nthreads ) )
+      {
+        --nidle;
+
+      // the merge started may leave the commits to the reserved worker
+        if ( next.prio == merge )
+          ++nmerges, Spawn( 0 );
+
+        exlock.unlock();
+
+        next.task();
+        next.task = nullptr;
+
+          exlock.lock();
+          nmerges -= next.prio == merge ? 1 : 0;
+        ++nidle;
+      }
+        else
+      if ( timers.empty() )
+        mxWait.wait( exlock );
+      else
+        mxWait.wait_until( exlock, timers.begin()->first );
+    }
+    --nidle;
+  }
+
+ /*
+  * GetNext( next, merges )
+  *
+  * Moves the delayed tasks due to the queues and gets the task of the highest
+  * priority; the merges are left queued while all but one threads merge, or if
+  * the worker may not run them.
+  */
+  bool  Executor::GetNext( Queued& next, bool merges )
+  {
+    auto  tmnow = Clock::now();
+
+    for ( auto it = timers.begin(); it != timers.end() && it->first <= tmnow; it = timers.erase( it ) )
+      queues[it->second.prio].push_back( std::move( it->second ) );
+
+    for ( auto& queue: queues )
+    {
+      if ( queue.empty() )
+        continue;
+      if ( &queue == &queues[merge] && (!merges || nmerges >= std::max( nthreads, 2U ) - 1) )
+        continue;
+      next = std::move( queue.front() );
+        queue.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  auto  Executor::Pending() const -> size_t
+  {
+    return queues[commit].size() + queues[merge].size() + queues[housekeeping].size();
+  }
+
+ /*
+  * Workers()
+  *
+  * Returns the count of workers: the single thread gets one more worker for the
+  * commits and the housekeeping, started when the thread merges.
+  */
+  auto  Executor::Workers() const -> unsigned
+  {
+    return nthreads != 1 ? nthreads : 2;
+  }
+
+ /*
+  * Spawn( ntasks )
+  *
+  * Starts the workers for the tasks not covered by the idle workers while the
+  * count of threads allows; the reserved worker is started only when the tasks
+  * wait for the merge run by the single thread.  Is called under the lock.
+  */
+  void  Executor::Spawn( size_t ntasks )
+  {
+    while ( ntasks > nidle && workers.size() < nthreads )
+    {
+      workers.emplace_back( &Executor::Worker, this, workers.size() );
+      ++nidle;
+    }
+
+    if ( nmerges != 0 && workers.size() < Workers() && queues[commit].size() + queues[housekeeping].size() > nidle )
+    {
+      workers.emplace_back( &Executor::Worker, this, workers.size() );
+      ++nidle;
+    }
+  }
+
+}}
@@ -38,6 +38,40 @@ namespace indexer {
 
   };
 
+  class IndexLayers::EntitiesList final: public IContentsIndex::IEntitiesList
+  {
+    struct Iterator
+    {
+      const IndexEntry*                       player;
+      mtc::api<IContentsIndex::IEntitiesList> plist;
+      mtc::api<const IEntity>                 entity;
+    };
+
+    mtc::api<const mtc::Iface>  holder;
+    const IndexLayers&          layset;
+    std::vector<Iterator>       merged;     // the lists of the layers ordered by id
+    Iterator                    ordered;    // the list of the layer ordered by index
+    mtc::api<const IEntity>     current;
+
+    implement_lifetime_control
+
+  public:
+    EntitiesList( const IndexLayers& ls, const mtc::Iface* pix ):
+      holder( pix ), layset( ls ), ordered{ nullptr, nullptr, nullptr }  {}
+
+    void  ListById( EntityId );
+    void  ListByIx( uint32_t );
+
+  public:
+    auto  Curr() -> mtc::api<const IEntity> override  {  return current;  }
+    auto  Next() -> mtc::api<const IEntity> override;
+
+  protected:
+    auto  SelectId() -> mtc::api<const IEntity>;
+    auto  SelectIx( mtc::api<const IEntity> ) -> mtc::api<const IEntity>;
+
+  };
+
   // IndexLayers implementation
 
   IndexLayers::IndexLayers( const mtc::api<IContentsIndex>* indices, size_t count )
@@ -59,6 +93,19 @@ namespace indexer {
   */
   auto  IndexLayers::getEntity( EntityId id ) const -> mtc::api<const IEntity>
   {
+    if ( directory != nullptr )
+    {
+      auto  ulayer = directory->Get( id );
+      auto  player = (const IndexEntry*)nullptr;
+      auto  entity = mtc::api<const IEntity>();
+
+      if ( ulayer == EntityDirectory::unknown )
+        return {};
+
+      if ( ulayer != EntityDirectory::ambiguous && (player = getLayer( ulayer )) != nullptr )
+        return (entity = player->pIndex->GetEntity( id )) != nullptr ? player->Override( entity ) : nullptr;
+    }
+
     for ( auto beg = layers.rbegin(); beg != layers.rend(); ++beg )
     {
       auto  entity = beg->pIndex->GetEntity( id );
@@ -82,6 +129,18 @@ namespace indexer {
   {
     auto  deleted = false;
 
+    if ( directory != nullptr )
+    {
+      auto  ulayer = directory->Del( id );
+      auto  player = (const IndexEntry*)nullptr;
+
+      if ( ulayer == EntityDirectory::unknown )
+        return false;
+
+      if ( ulayer != EntityDirectory::ambiguous && (player = getLayer( ulayer )) != nullptr )
+        return player->pIndex->DelEntity( id );
+    }
+
     for ( auto& next: layers )
       deleted |= next.pIndex->DelEntity( id );
     return deleted;
@@ -91,6 +150,18 @@ namespace indexer {
   {
     auto  entity = mtc::api<const IEntity>();
 
+    if ( directory != nullptr )
+    {
+      auto  ulayer = directory->Get( id );
+      auto  player = (const IndexEntry*)nullptr;
+
+      if ( ulayer == EntityDirectory::unknown )
+        return {};
+
+      if ( ulayer != EntityDirectory::ambiguous && (player = getLayer( ulayer )) != nullptr )
+        return (entity = player->pIndex->SetExtras( id, xtras )) != nullptr ? player->Override( entity ) : nullptr;
+    }
+
     for ( auto& next: layers )
       if ( (entity = next.pIndex->SetExtras( id, xtras )) != nullptr )
         return entity;
@@ -127,26 +198,42 @@ namespace indexer {
     IContentsIndex::BlockInfo blockStats = { uint32_t(-1), 0 };
 
     for ( auto& next: layers )
-    {
-      auto  cStats = next.pIndex->GetKeyStats( key );
-
-      if ( cStats.bkType == uint32_t(-1) )
-        continue;
-      if ( blockStats.bkType == uint32_t(-1) )  blockStats = cStats;
-        else
-      if ( blockStats.bkType == cStats.bkType ) blockStats.nCount += cStats.nCount;
-        else
-      throw std::invalid_argument( "Block types differ in sequental indives" );
-    }
+      blockStats = addKeyStats( blockStats, next.pIndex->GetKeyStats( key ) );
 
     return blockStats;
   }
 
+  auto  IndexLayers::addKeyStats( const IContentsIndex::BlockInfo& blockStats,
+    const IContentsIndex::BlockInfo& cStats ) -> IContentsIndex::BlockInfo
+  {
+    if ( cStats.bkType == uint32_t(-1) )
+      return blockStats;
+    if ( blockStats.bkType == uint32_t(-1) )
+      return cStats;
+    if ( blockStats.bkType == cStats.bkType )
+      return { blockStats.bkType, blockStats.nCount + cStats.nCount };
+    throw std::invalid_argument( "Block types differ in sequental indives" );
+  }
+
   void  IndexLayers::addContents( mtc::api<IContentsIndex> ix )
   {
     auto  uLower = layers.empty() ? 1 : layers.back().uUpper + 1;
 
-    layers.emplace_back( uLower, ix );
+    layers.emplace_back( uLower, ix, directory != nullptr ? directory->NewLayer() : 0 );
+  }
+
+  auto  IndexLayers::listEntities( EntityId id, const mtc::Iface* poo ) -> mtc::api<IContentsIndex::IEntitiesList>
+  {
+    auto  entities = mtc::api<EntitiesList>( new EntitiesList( *this, poo ) );
+
+    return entities->ListById( id ), entities.ptr();
+  }
+
+  auto  IndexLayers::listEntities( uint32_t ix, const mtc::Iface* poo ) -> mtc::api<IContentsIndex::IEntitiesList>
+  {
+    auto  entities = mtc::api<EntitiesList>( new EntitiesList( *this, poo ) );
+
+    return entities->ListByIx( ix ), entities.ptr();
   }
 
   auto  IndexLayers::listContents( const std::string_view& key, const mtc::Iface* poo  ) -> mtc::api<IContentsIndex::IContentsList>
@@ -168,19 +255,202 @@ namespace indexer {
       next.pIndex->Commit();
   }
 
+ /*
+  * hideClashes()
+  *
+  * Attaches the entity directory and fills it with the entities of the layers
+  * listed one by one, see hideClashes( listed, forEach ).
+  */
   void  IndexLayers::hideClashes()
   {
-    for ( auto beg = layers.begin(); beg != layers.end(); ++beg )
+    auto  listed = std::vector<EntityDirectory::Listing>();
+
+    for ( auto& next: layers )
+      listed.push_back( EntityDirectory::List( *next.pIndex ) );
+
+    hideClashes( listed, []( size_t count, const std::function<void( size_t )>& func )
+      {
+        for ( size_t i = 0; i != count; ++i )
+          func( i );
+      } );
+  }
+
+ /*
+  * hideClashes( listed, forEach )
+  *
+  * Attaches the entity directory and fills it with the entities listed by the
+  * layers from the oldest to the newest one; the shards are filled by forEach,
+  * so the caller may fill them in parallel.
+  *
+  * The versions shadowed by the newer layers are stashed, i.e. hidden in memory
+  * only, so opening the index does not modify the layers.
+  */
+  void  IndexLayers::hideClashes( const std::vector<EntityDirectory::Listing>& listed, const ForEach& forEach )
+  {
+    auto  placed = std::vector<std::pair<uint32_t, const EntityDirectory::Listing*>>();
+    auto  clashes = std::vector<std::vector<EntityDirectory::Clash>>( EntityDirectory::Shards() );
+
+    if ( listed.size() != layers.size() )
+      throw std::invalid_argument( "entities are not listed for all the layers" );
+
+    if ( directory == nullptr )
+      directory = new EntityDirectory();
+
+    for ( size_t i = 0; i != layers.size(); ++i )
+    {
+      if ( layers[i].lLayer == 0 )
+        layers[i].lLayer = directory->NewLayer();
+
+      placed.emplace_back( layers[i].lLayer, &listed[i] );
+    }
+
+    forEach( clashes.size(), [&]( size_t nshard ){  clashes[nshard] = directory->Place( nshard, placed );  } );
+
+  // the clashes of each shard are ordered from the oldest layer, so the newer
+  // version is not stashed before the older one is found
+    for ( auto& shard: clashes )
+      for ( auto& clash: shard )
+        hideClash( clash );
+  }
+
+ /*
+  * hideClash( clash )
+  *
+  * Stashes the version of the entity replaced by the newer layer; for the ids
+  * clashing by hash, the entity is stashed in all the older layers.
+  */
+  void  IndexLayers::hideClash( const EntityDirectory::Clash& clash )
+  {
+    auto  pnewer = getLayer( clash.unewer );
+    auto  polder = (const IndexEntry*)nullptr;
+    auto  entity = mtc::api<const IEntity>();
+
+    if ( pnewer == nullptr || (entity = pnewer->pIndex->GetEntity( clash.uindex )) == nullptr )
+      return;
+
+    if ( clash.uolder != EntityDirectory::ambiguous && (polder = getLayer( clash.uolder )) != nullptr )
+      return polder->pIndex->Stash( entity->GetId() );
+
+    for ( auto next = layers.data(); next != pnewer; ++next )
+      next->pIndex->Stash( entity->GetId() );
+  }
+
+ /*
+  * getLayer( layer )
+  *
+  * Returns the entry holding the layer with the key passed; the layers being
+  * merged are held by the merger entry in the backup list.
+  */
+  auto  IndexLayers::getLayer( uint32_t ulayer ) const -> const IndexEntry*
+  {
+    for ( auto& next: layers )
+    {
+      if ( next.lLayer == ulayer )
+        return &next;
+
+      for ( auto& back: next.backup )
+        if ( back.lLayer == ulayer )
+          return &next;
+    }
+    return nullptr;
+  }
+
+ /*
+  * isShadowed( entity, entry )
+  *
+  * Checks if the entity listed by the layer passed is replaced by the version
+  * held by some newer layer.  The directory is asked first, and the newer layers
+  * are probed only if it does not know the layer exactly.
+  */
+  bool  IndexLayers::isShadowed( const IEntity& entity, const IndexEntry& entry ) const
+  {
+    auto  ulayer = directory != nullptr ? directory->Get( entity.GetId() ) : uint32_t(EntityDirectory::unknown);
+    auto  player = (const IndexEntry*)nullptr;
+
+    if ( ulayer != EntityDirectory::unknown && ulayer != EntityDirectory::ambiguous && (player = getLayer( ulayer )) != nullptr )
+      return player != &entry;
+
+    for ( auto next = &entry + 1; next < layers.data() + layers.size(); ++next )
+      if ( next->pIndex->GetEntity( entity.GetId() ) != nullptr )
+        return true;
+
+    return false;
+  }
+
+ /*
+  * setLayer( id, entry )
+  *
+  * Registers the entity just set to the layer passed and hides the previous
+  * version in the layer the directory names; for the ids clashing by hash, the
+  * version is hidden in all the other layers, see hideVersion().
+  */
+  void  IndexLayers::setLayer( EntityId id, const IndexEntry& entry )
+  {
+    auto  ulayer = directory->Put( id, entry.lLayer );
+    auto  polder = (const IndexEntry*)nullptr;
+
+    if ( ulayer == EntityDirectory::unknown || ulayer == entry.lLayer )
+      return;
+
+    if ( ulayer != EntityDirectory::ambiguous )
     {
+      if ( (polder = getLayer( ulayer )) != nullptr && polder != &entry )
+        hideVersion( id, *polder );
+      return;
     }
+
+    for ( auto& next: layers )
+      if ( &next != &entry )
+        hideVersion( id, next );
+  }
+
+ /*
+  * hideVersion( id, entry )
+  *
+  * Hides the version of the entity replaced by the newer one: the static layers
+  * stash it in memory, and the dynamic, committing and merging ones delete it.
+  * Either way the version is counted deleted by the layer and is dropped by the
+  * merge.
+  */
+  void  IndexLayers::hideVersion( EntityId id, const IndexEntry& entry )
+  {
+    if ( entry.dwSets == 0 )
+      entry.pIndex->Stash( id );
+    else
+      entry.pIndex->DelEntity( id );
+  }
+
+ /*
+  * mapLayers( entry, layer )
+  *
+  * Moves the directory entries of the layers held by the entry to the layer
+  * passed, or removes them for 'unknown'.
+  */
+  void  IndexLayers::mapLayers( const IndexEntry& entry, uint32_t ulayer )
+  {
+    auto  source = std::vector<uint32_t>();
+
+    if ( directory == nullptr )
+      return;
+
+    if ( entry.lLayer != ulayer )
+      source.push_back( entry.lLayer );
+
+    for ( auto& next: entry.backup )
+      if ( next.lLayer != ulayer && next.lLayer != entry.lLayer )
+        source.push_back( next.lLayer );
+
+    if ( !source.empty() )
+      directory->Move( source, ulayer );
   }
 
   // IndexLayers::IndexEntry implementation
 
-  IndexLayers::IndexEntry::IndexEntry( uint32_t lower, mtc::api<IContentsIndex> index ):
+  IndexLayers::IndexEntry::IndexEntry( uint32_t lower, mtc::api<IContentsIndex> index, uint32_t layer ):
     uLower( lower ),
     uUpper( uLower + index->GetMaxIndex() - 1 ),
-    pIndex( index )
+    pIndex( index ),
+    lLayer( layer )
   {
   }
   IndexLayers::IndexEntry::IndexEntry( const IndexEntry& ie ):
@@ -188,7 +458,8 @@ namespace indexer {
     uUpper( ie.uUpper ),
     pIndex( ie.pIndex ),
     backup( ie.backup ),
-    dwSets( ie.dwSets )
+    dwSets( ie.dwSets ),
+    lLayer( ie.lLayer )
   {
   }
 
@@ -199,6 +470,7 @@ namespace indexer {
     pIndex = ie.pIndex;
     backup = ie.backup;
     dwSets = ie.dwSets;
+    lLayer = ie.lLayer;
     return *this;
   }
 
@@ -244,42 +516,141 @@ namespace indexer {
     return { uint32_t(-1), {} };
   }
 
+  // IndexLayers::EntitiesList implementation
+
+ /*
+  * ListById( id )
+  *
+  * Opens the lists of all the layers; the lists are merged by the ids, and the
+  * entity held by several layers is got from the newest one.
+  */
+  void  IndexLayers::EntitiesList::ListById( EntityId id )
+  {
+    for ( auto& next: layset.layers )
+    {
+      auto  plist = next.pIndex->ListEntities( id );
+
+      if ( plist != nullptr )
+        merged.push_back( { &next, plist, plist->Curr() } );
+    }
+    current = SelectId();
+  }
+
+ /*
+  * ListByIx( ix )
+  *
+  * Opens the list of the layer holding the index passed; the layers are listed
+  * one by one, so only one list is open.
+  */
+  void  IndexLayers::EntitiesList::ListByIx( uint32_t ix )
+  {
+    auto& layers = layset.layers;
+    auto  player = layers.begin();
+
+    while ( player != layers.end() && player->uUpper < ix )
+      ++player;
+
+    if ( player != layers.end() )
+    {
+      ordered.player = &*player;
+      ordered.plist = player->pIndex->ListEntities( ix >= player->uLower ? ix - player->uLower + 1 : 0U );
+      current = SelectIx( ordered.plist != nullptr ? ordered.plist->Curr() : nullptr );
+    }
+  }
+
+  auto  IndexLayers::EntitiesList::Next() -> mtc::api<const IEntity>
+  {
+    auto  last = current;
+
+    if ( last == nullptr )
+      return nullptr;
+
+    if ( ordered.player != nullptr )
+      return current = SelectIx( ordered.plist->Next() );
+
+    for ( auto& next: merged )
+      if ( next.entity != nullptr && std::string_view( next.entity->GetId() ) == last->GetId() )
+        next.entity = next.plist->Next();
+
+    return current = SelectId();
+  }
+
+ /*
+  * SelectId()
+  *
+  * Returns the entity with the lowest id; the lists are ordered from the oldest
+  * layer to the newest one, so the newest version of the entity wins.
+  */
+  auto  IndexLayers::EntitiesList::SelectId() -> mtc::api<const IEntity>
+  {
+    auto  select = (const Iterator*)nullptr;
+
+    for ( auto& next: merged )
+      if ( next.entity != nullptr )
+        if ( select == nullptr || !(select->entity->GetId() < next.entity->GetId()) )
+          select = &next;
+
+    return select != nullptr ? select->player->Override( select->entity ) : nullptr;
+  }
+
+ /*
+  * SelectIx( entity )
+  *
+  * Skips the entities replaced by the newer layers and passes to the next layers
+  * when the list of the current one is over.
+  */
+  auto  IndexLayers::EntitiesList::SelectIx( mtc::api<const IEntity> entity ) -> mtc::api<const IEntity>
+  {
+    auto& layers = layset.layers;
+
+    for ( ; ; )
+    {
+      for ( ; entity != nullptr; entity = ordered.plist->Next() )
+        if ( !layset.isShadowed( *entity, *ordered.player ) )
+          return ordered.player->Override( entity );
+
+      do
+      {
+        if ( ++ordered.player == layers.data() + layers.size() )
+          return ordered.player = nullptr, ordered.plist = nullptr, nullptr;
+      } while ( (ordered.plist = ordered.player->pIndex->ListEntities( 0U )) == nullptr );
+
+      entity = ordered.plist->Curr();
+    }
+  }
+
   // IndexLayers::ContentsList implementation
 
   IndexLayers::ContentsList::ContentsList( const std::vector<mtc::api<IContentsList>>& list, const Iface* parent ):
-    parentObject( parent )
+    parentObject( parent ),
+    contentsList( list.begin(), list.end() ),
+    selectorTree( contentsList.size(), Compare{ &contentsList } )
   {
-    for ( auto& next: list )
-      contentsList.push_back( next );
-
-    for ( auto& next: contentsList )
-      if ( next.Curr().size() != 0 )
-        if ( currentValue == nullptr || next.Curr() < *currentValue )
-          currentValue = &next.Curr();
   }
 
   auto  IndexLayers::ContentsList::Curr() -> std::string
   {
-    return currentValue != nullptr ? *currentValue : std::string();
+    return contentsList[selectorTree.Top()].Curr();
   }
 
+ /*
+  * Next()
+  *
+  * Steps over the current key in all the lists having it; the key is taken from
+  * the first list, so the other ones are compared without copying.
+  */
   auto  IndexLayers::ContentsList::Next() -> std::string
   {
-    if ( currentValue != nullptr )
+    auto  ptop = &contentsList[selectorTree.Top()];
+
+    if ( !ptop->Curr().empty() )
     {
-      const std::string*  minValue = nullptr;
+      auto  select = ptop->Take();
 
-      for ( auto& next: contentsList )
-      {
-        if ( currentValue == &next.Curr() || *currentValue == next.Curr() )
-          next.Next();
-        if ( next.Curr().size() != 0 )
-          if ( minValue == nullptr || next.Curr() < *minValue )
-            minValue = &next.Curr();
-      }
-      currentValue = minValue;
+      for ( selectorTree.Update(); (ptop = &contentsList[selectorTree.Top()])->Curr() == select; selectorTree.Update() )
+        ptop->Next();
     }
-    return currentValue != nullptr ? *currentValue : std::string();
+    return Curr();
   }
 
 }}
@@ -1,9 +1,12 @@
 # if !defined( __DelphiX_src_indexer_index_layers_hpp__ )
 # define __DelphiX_src_indexer_index_layers_hpp__
 #include <shared_mutex>
+#include <functional>
 
 # include "../../contents.hpp"
+# include "entity-directory.hpp"
 # include "dynamic-bitmap.hpp"
+# include "loser-tree.hpp"
 
 namespace DelphiX {
 namespace indexer {
@@ -20,10 +23,19 @@ namespace indexer {
   *
   * Ротацию таких массивов при переполнении будет обеспечивать другой
   * компонент.
+  *
+  * With the entity directory attached by hideClashes(), the id-based
+  * operations look up the layer holding the live version of the entity
+  * instead of probing all the layers; the layers are identified by the keys
+  * kept through the commits and merges.
   */
   class IndexLayers
   {
     class Entities;
+    class EntitiesList;
+
+  public:
+    using ForEach = std::function<void( size_t, const std::function<void( size_t )>& )>;
 
   public:
     IndexLayers() = default;
@@ -40,6 +52,8 @@ namespace indexer {
     auto  getKeyBlock( const std::string_view&, const mtc::Iface* = nullptr ) const -> mtc::api<IContentsIndex::IEntities>;
     auto  getKeyStats( const std::string_view& ) const -> IContentsIndex::BlockInfo;
 
+    auto  listEntities( EntityId, const mtc::Iface* = nullptr ) -> mtc::api<IContentsIndex::IEntitiesList>;
+    auto  listEntities( uint32_t, const mtc::Iface* = nullptr ) -> mtc::api<IContentsIndex::IEntitiesList>;
     auto  listContents( const std::string_view&, const mtc::Iface* = nullptr ) -> mtc::api<IContentsIndex::IContentsList>;
 
     void  addContents( mtc::api<IContentsIndex> pindex );
@@ -47,6 +61,7 @@ namespace indexer {
     void  commitItems();
 
     void  hideClashes();
+    void  hideClashes( const std::vector<EntityDirectory::Listing>&, const ForEach& );
 
   protected:
     struct IndexEntry
@@ -56,9 +71,10 @@ namespace indexer {
       mtc::api<IContentsIndex>  pIndex;
       std::vector<IndexEntry>   backup;
       uint32_t                  dwSets = 0;
+      uint32_t                  lLayer = 0;     // the layer key in the directory
 
     public:
-      IndexEntry( uint32_t uLower, mtc::api<IContentsIndex> pindex );
+      IndexEntry( uint32_t uLower, mtc::api<IContentsIndex> pindex, uint32_t layer = 0 );
       IndexEntry( const IndexEntry& );
       IndexEntry& operator=( const IndexEntry& );
 
@@ -70,7 +86,19 @@ namespace indexer {
     class ContentsList;
 
   protected:
-    std::vector<IndexEntry> layers;
+    static  auto  addKeyStats( const IContentsIndex::BlockInfo&,
+      const IContentsIndex::BlockInfo& ) -> IContentsIndex::BlockInfo;
+
+    auto  getLayer( uint32_t ) const -> const IndexEntry*;
+    bool  isShadowed( const IEntity&, const IndexEntry& ) const;
+    void  setLayer( EntityId, const IndexEntry& );
+    void  hideVersion( EntityId, const IndexEntry& );
+    void  hideClash( const EntityDirectory::Clash& );
+    void  mapLayers( const IndexEntry&, uint32_t );
+
+  protected:
+    std::vector<IndexEntry>         layers;
+    mtc::api<EntityDirectory>       directory;
 
   };
 
@@ -94,14 +122,31 @@ namespace indexer {
       Iterator( const api& list ): api( list ), contentsItem( list->Curr() )  {}
 
     public:
-      auto  Curr() -> const std::string&  {  return contentsItem;  }
+      auto  Curr() const -> const std::string&  {  return contentsItem;  }
       auto  Next() -> const std::string&  {  return contentsItem = ptr()->Next();  }
+      auto  Take() -> std::string
+        {
+          auto  prev = std::move( contentsItem );
+          return contentsItem = ptr()->Next(), prev;
+        }
+    };
+
+    struct Compare
+    {
+      const std::vector<Iterator>*  lists;
+
+      bool  operator()( size_t a, size_t b ) const
+      {
+        auto& sa = (*lists)[a].Curr();
+        auto& sb = (*lists)[b].Curr();
+
+        return !sa.empty() && (sb.empty() || sa < sb);
+      }
     };
 
     mtc::api<const Iface> parentObject;
     std::vector<Iterator> contentsList;
-    const std::string*    currentValue = nullptr;
-
+    LoserTree<Compare>    selectorTree;
 
   };
 
@@ -0,0 +1,39 @@
+# if !defined( __DelphiX_src_indexer_io_throttle_hxx__ )
+# define __DelphiX_src_indexer_io_throttle_hxx__
+# include "../../indexer/rate-limiter.hpp"
+# include <utility>
+
+namespace DelphiX {
+namespace indexer {
+namespace io {
+
+ /*
+  * Charger accumulates the small reads and writes of one thread and acquires
+  * the budget by chunks, so the limiter is not locked for each varint stored.
+  */
+  class Charger
+  {
+    enum: size_t
+    {
+      charge_chunk = 0x10000
+    };
+
+  public:
+    Charger( mtc::api<IRateLimiter> limiter = nullptr ):
+      rlimit( limiter ) {}
+
+    void  operator()( size_t cbsize )
+    {
+      if ( rlimit != nullptr && (cbcount += cbsize) >= charge_chunk )
+        rlimit->Acquire( std::exchange( cbcount, 0 ) );
+    }
+
+  protected:
+    mtc::api<IRateLimiter>  rlimit;
+    size_t                  cbcount = 0;
+
+  };
+
+}}}
+
+# endif   // !__DelphiX_src_indexer_io_throttle_hxx__
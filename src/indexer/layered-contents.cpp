@@ -1,15 +1,18 @@
 # include "../../indexer/layered-contents.hpp"
 # include "../../indexer/static-contents.hpp"
 # include "../../indexer/dynamic-contents.hpp"
+# include "../../indexer/executor.hpp"
 # include "../../exceptions.hpp"
 # include "../../compat.hpp"
 # include "commit-contents.hpp"
 # include "merger-contents.hpp"
 # include "object-holders.hpp"
 # include "index-layers.hpp"
+# include "rcu-pointer.hpp"
 # include <mtc/recursive_shared_mutex.hpp>
+# include <unordered_map>
 # include <shared_mutex>
-# include <cmath>
+# include <array>
 
 namespace DelphiX {
 namespace indexer {
@@ -22,11 +25,16 @@ namespace layered {
     long  Attach() override {  return ++referenceCount;  }
     long  Detach() override;
 
+    class LayerSet;
+    class LayerPart;
+
   public:
     ContentsIndex( const mtc::api<IContentsIndex>* indices, size_t count );
-    ContentsIndex( const mtc::api<IStorage>&, const dynamic::Settings& );
+    ContentsIndex( const mtc::api<IStorage>&, const dynamic::Settings&,
+      const mtc::api<IMergePolicy>&, const merge::Schedule&, const io::Limits& );
 
     auto  StartMonitor( const std::chrono::seconds& mergeMonitorDelay ) -> ContentsIndex*;
+    auto  GetStartup() const -> const StartupStats&  {  return startup;  }
 
   public:
     auto  GetEntity( EntityId ) const -> mtc::api<const IEntity> override;
@@ -40,11 +48,10 @@ namespace layered {
     auto  GetMaxIndex() const -> uint32_t override;
     auto  GetKeyBlock( const std::string_view& ) const -> mtc::api<IEntities> override;
     auto  GetKeyStats( const std::string_view& ) const -> BlockInfo override;
+    auto  GetIndexStats() const -> IndexStats override;
 
-    auto  ListEntities( EntityId ) -> mtc::api<IEntitiesList> override
-      {  throw std::runtime_error( "not implemented @" __FILE__ ":" LINE_STRING );  }
-    auto  ListEntities( uint32_t ) -> mtc::api<IEntitiesList> override
-      {  throw std::runtime_error( "not implemented @" __FILE__ ":" LINE_STRING );  }
+    auto  ListEntities( EntityId ) -> mtc::api<IEntitiesList> override;
+    auto  ListEntities( uint32_t ) -> mtc::api<IEntitiesList> override;
     auto  ListContents( const std::string_view& ) -> mtc::api<IContentsList> override;
 
     auto  Commit() -> mtc::api<IStorage::ISerialized> override;
@@ -53,65 +60,310 @@ namespace layered {
 
     void  Stash( EntityId ) override  {}
 
+    auto  Snapshot() -> mtc::api<IContentsIndex> override;
+
+    auto  ForceMerge( uint32_t ) -> std::future<void> override;
+    auto  ExpungeDeletes( double ) -> std::future<void> override;
+
+    auto  Partition( unsigned ) -> std::vector<mtc::api<IContentsIndex>>;
+
   protected:
     using LayersIt = decltype(layers)::iterator;
     using EventRec = std::pair<void*, Notify::Event>;
 
-    void  MergeMonitor( const std::chrono::seconds& );
+    struct Maintenance
+    {
+      enum Kind: unsigned
+      {
+        forceMerge = 0,
+        expungeDeletes = 1
+      };
+
+      Kind                kind;
+      double              value;        // segments count or deleted ratio
+      std::promise<void>  result;
+    };
+
+    void  MonitorTask();
     auto  SelectLimits() -> std::pair<LayersIt, LayersIt>;
-    auto  WaitGetEvent( const std::chrono::seconds& ) -> EventRec;
+    bool  SelectMaintenance( const std::vector<IMergePolicy::Layer>&, std::pair<size_t, size_t>& );
+    void  CheckMaintenance();
+    auto  PutMaintenance( Maintenance::Kind, double ) -> std::future<void>;
+    auto  GetLayerStats() const -> std::vector<IMergePolicy::Layer>;
+    bool  StartMerge();
+    bool  GetNewEvent( EventRec& );
+    void  PutNewEvent( void*, Notify::Event );
+
+    auto  OpenLayers( const std::vector<mtc::api<IStorage::ISerialized>>&,
+      std::vector<EntityDirectory::Listing>& ) -> std::vector<mtc::api<IContentsIndex>>;
+    void  RunParallel( size_t, const std::function<void( size_t )>& );
+    auto  CreateDynamic() -> mtc::api<IContentsIndex>;
+    auto  TakeStandby() -> mtc::api<IContentsIndex>;
+    void  MakeStandby();
+    void  RotateLayers( mtc::api<IContentsIndex> );
+    bool  CommitsFull() const;
+    bool  DeferFilled( void* );
+    void  WaitCommits();
+    void  PublishLayers();
 
   protected:
     mtc::api<IStorage>          istore;
     dynamic::Settings           dynSet;
+    mtc::api<IMergePolicy>      policy;
+    io::Limits                  ioLimits;         // merge and commit i/o budgets
     bool                        rdOnly = false;
+    bool                        pinned = false;   // snapshot, never committed
 
     volatile bool               canRun = true;    // the continue flag
+    bool                        monitored = false;
+    StartupStats                startup;
 
+  // the layers are changed by rotation and merges under the exclusive lock,
+  // and the writers use them under the shared lock; the readers use the copy
+  // published after each change and take no locks
     mutable std::shared_mutex   ixlock;
+    RcuPointer<LayerSet>        rdLayers;
 
   // event manager - the events are processed after the index
-  // asyncronous action is performed
+  // asyncronous action is performed by the monitor task
     std::list<EventRec>         evQueue;
     std::mutex                  evMutex;
     std::condition_variable     evEvent;
-    std::thread                 monitor;
-    volatile bool               merging = false;
+    bool                        evQueued = false; // the monitor task is queued or run
+
+  // merges run concurrently, limited by the schedule
+    merge::Schedule             mrgSet;
+    std::atomic<uint32_t>       nmerges = 0;
+    std::atomic<uint64_t>       cbmerge = 0;    // size of the layers being merged
+
+  // maintenance requested by the user overrides the merge policy until done;
+  // the requests not finished are broken with the index
+    std::list<Maintenance>      mtQueue;
+    std::mutex                  mtMutex;
+
+  // rotation syncro - writers having the dynamic index overflowed wait
+  // for the monitor to rotate it, or for the commit to finish if too many
+  // full indices are being committed
+    std::atomic<uint64_t>       rotated = 0;
+    std::atomic<uint32_t>       ncommits = 0;
+    void*                       deferred = nullptr; // filled while the commits are full
+    std::mutex                  rtMutex;
+    std::condition_variable     rtEvent;
+
+  // standby dynamic index created in advance to make the rotation a simple
+  // pointer swap; is refilled by the monitor
+    mtc::api<IContentsIndex>    standby;
+    std::mutex                  sbMutex;
+  };
+
+  /*
+   * LayerSet is the immutable copy of the layers published to the readers;
+   * it shares the entity directory with the index.
+   *
+   * The key statistics of the layers not changed while the copy is published
+   * (all but the dynamic one) are cached by the key, so each change of the
+   * layers invalidates the cache with the copy itself.
+   *
+   * The cache is split to the shards by the hash of the key, each one locked
+   * and flushed on overflow separately; the keys are looked up by the hash and
+   * compared with the key kept, so a hit allocates nothing.
+   */
+  class ContentsIndex::LayerSet final: public IndexLayers, public mtc::Iface
+  {
+    implement_lifetime_control
+
+    enum: size_t
+    {
+      stats_limit = 0x10000,
+      stats_shards = 16
+    };
+
+    struct alignas(64) StatShard
+    {
+      std::shared_mutex                                                 stlock;
+      std::unordered_map<size_t, std::pair<std::string, BlockInfo>>     kstats;   // by the hash of the key
+    };
+
+  public:
+    LayerSet( const IndexLayers& );
+    LayerSet( const IndexLayers&, size_t, size_t );
+
+    auto  Layers() const -> const std::vector<IndexEntry>&  {  return layers;  }
+    auto  GetKeyStats( const std::string_view& ) const -> BlockInfo;
+
+  protected:
+    size_t                                        nfixed;
+    mutable std::array<StatShard, stats_shards>   kshards;
+
+  };
+
+  /*
+   * LayerPart is the read-only view searching the key blocks of the group of
+   * layers; the entities, the key statistics and the contents are got from the
+   * whole copy of the layers.
+   */
+  class ContentsIndex::LayerPart final: public IContentsIndex
+  {
+    implement_lifetime_control
+
+  public:
+    LayerPart( mtc::api<const Iface> owner, mtc::api<LayerSet> whole, mtc::api<LayerSet> group ):
+      parent( owner ),
+      layset( whole ),
+      keyset( group ) {}
+
+  public:
+    auto  GetEntity( EntityId id ) const -> mtc::api<const IEntity> override
+      {  return layset->getEntity( id );  }
+    auto  GetEntity( uint32_t id ) const -> mtc::api<const IEntity> override
+      {  return layset->getEntity( id );  }
+
+    bool  DelEntity( EntityId ) override
+      {  throw std::logic_error( "index partition is read-only" );  }
+    auto  SetEntity( EntityId, mtc::api<const IContents>,
+      const std::string_view&, const std::string_view& ) -> mtc::api<const IEntity> override
+      {  throw std::logic_error( "index partition is read-only" );  }
+    auto  SetExtras( EntityId, const std::string_view& ) -> mtc::api<const IEntity> override
+      {  throw std::logic_error( "index partition is read-only" );  }
+
+    auto  GetMaxIndex() const -> uint32_t override
+      {  return layset->getMaxIndex();  }
+    auto  GetKeyBlock( const std::string_view& key ) const -> mtc::api<IEntities> override
+      {  return keyset->getKeyBlock( key, this );  }
+    auto  GetKeyStats( const std::string_view& key ) const -> BlockInfo override
+      {  return layset->GetKeyStats( key );  }
+
+    auto  ListEntities( EntityId id ) -> mtc::api<IEntitiesList> override
+      {  return layset->listEntities( id, this );  }
+    auto  ListEntities( uint32_t ix ) -> mtc::api<IEntitiesList> override
+      {  return layset->listEntities( ix, this );  }
+    auto  ListContents( const std::string_view& key ) -> mtc::api<IContentsList> override
+      {  return layset->listContents( key, this );  }
+
+    auto  Commit() -> mtc::api<IStorage::ISerialized> override  {  return nullptr;  }
+    auto  Reduce() -> mtc::api<IContentsIndex> override {  return this;  }
+    void  Remove() override
+      {  throw std::logic_error( "index partition is read-only" );  }
+
+    void  Stash( EntityId ) override  {}
+
+  protected:
+    mtc::api<const Iface> parent;
+    mtc::api<LayerSet>    layset;
+    mtc::api<LayerSet>    keyset;
+
   };
 
+  // ContentsIndex::LayerSet implementation
+
+  ContentsIndex::LayerSet::LayerSet( const IndexLayers& source ):
+    IndexLayers( source ),
+    nfixed( layers.size() )
+  {
+    if ( nfixed != 0 && layers.back().uUpper == uint32_t(-1) )
+      --nfixed;
+  }
+
+  ContentsIndex::LayerSet::LayerSet( const IndexLayers& source, size_t first, size_t last ):
+    IndexLayers( source )
+  {
+    layers.erase( layers.begin() + last, layers.end() );
+    layers.erase( layers.begin(), layers.begin() + first );
+
+    if ( (nfixed = layers.size()) != 0 && layers.back().uUpper == uint32_t(-1) )
+      --nfixed;
+  }
+
+  auto  ContentsIndex::LayerSet::GetKeyStats( const std::string_view& key ) const -> BlockInfo
+  {
+    auto  khash = std::hash<std::string_view>()( key );
+    auto& kshard = kshards[khash % stats_shards];
+    auto  fixset = mtc::interlocked( mtc::make_shared_lock( kshard.stlock ), [&]()
+      {
+        auto  pfound = kshard.kstats.find( khash );
+
+        return pfound != kshard.kstats.end() && pfound->second.first == key ?
+          std::make_pair( true, pfound->second.second ) :
+          std::make_pair( false, BlockInfo{ uint32_t(-1), 0 } );
+      } );
+    auto  kstat = fixset.second;
+
+    if ( !fixset.first )
+    {
+      for ( size_t i = 0; i != nfixed; ++i )
+        kstat = addKeyStats( kstat, layers[i].pIndex->GetKeyStats( key ) );
+
+    // the key of the same hash cached before is replaced
+      mtc::interlocked( mtc::make_unique_lock( kshard.stlock ), [&]()
+        {
+          if ( kshard.kstats.size() >= stats_limit / stats_shards )
+            kshard.kstats.clear();
+          kshard.kstats[khash] = { std::string( key ), kstat };
+        } );
+    }
+
+    for ( auto i = nfixed; i != layers.size(); ++i )
+      kstat = addKeyStats( kstat, layers[i].pIndex->GetKeyStats( key ) );
+
+    return kstat;
+  }
+
   // ContentsIndex implementation
 
   ContentsIndex::ContentsIndex( const mtc::api<IContentsIndex>* indices, size_t count ):
     IndexLayers( indices, count )
   {
+    PublishLayers();
   }
 
-  ContentsIndex::ContentsIndex( const mtc::api<IStorage>& storage, const dynamic::Settings& dynamicSets ):
-    IndexLayers(), istore( storage ), dynSet( dynamicSets )
+  ContentsIndex::ContentsIndex( const mtc::api<IStorage>& storage, const dynamic::Settings& dynamicSets,
+    const mtc::api<IMergePolicy>& mergePolicy, const merge::Schedule& mergeSchedule, const io::Limits& limits ):
+    IndexLayers(), istore( storage ), dynSet( dynamicSets ), policy( mergePolicy ), ioLimits( limits ), mrgSet( mergeSchedule )
   {
     auto  sources = istore->ListIndices();
-    auto  dynamic = istore->CreateStore();
+    auto  serials = std::vector<mtc::api<IStorage::ISerialized>>();
+    auto  listed = std::vector<EntityDirectory::Listing>();
+    auto  tstart = std::chrono::steady_clock::now();
+    auto  dynamic = io::Throttle( istore->CreateStore(), ioLimits.commit );
 
-  // check if has any sources
+  // check if has any sources, and open them keeping the order
     if ( sources != nullptr )
       for ( auto serial = sources->Get(); serial != nullptr; serial = sources->Get() )
-        addContents( static_::Index().Create( serial ) );
+        serials.push_back( serial );
+
+    for ( auto& next: OpenLayers( serials, listed ) )
+      addContents( next );
+
+  // map the entities listed by the layers to the layers holding them
+    hideClashes( listed, [this]( size_t count, const std::function<void( size_t )>& func )
+      {  RunParallel( count, func );  } );
 
   // add dynamic index to the end if possible
     if ( dynamic != nullptr )
     {
       addContents( dynamic::Index()
         .Set( dynamic )
-        .Set( dynSet ).Create() );
+        .Set( dynSet )
+        .Set( [this]( void* to ){  PutNewEvent( to, Notify::Event::Filled );  } ).Create() );
       layers.back().uUpper = uint32_t(-1);
       layers.back().dwSets = 1;
       rdOnly = false;
+      MakeStandby();
     } else rdOnly = true;
+
+    PublishLayers();
+
+    startup.tmTotal = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - tstart );
   }
 
   auto  ContentsIndex::StartMonitor( const std::chrono::seconds& mergeMonitorDelay ) -> ContentsIndex*
   {
-    monitor = std::thread( &ContentsIndex::MergeMonitor, this, mergeMonitorDelay );
+    mtc::interlocked( mtc::make_unique_lock( evMutex ), [&]()
+      {
+        monitored = evQueued = true;
+        Executor::Get().Run( Executor::housekeeping, this, [this](){  MonitorTask();  }, mergeMonitorDelay );
+      } );
     return this;
   }
 
@@ -121,13 +373,19 @@ namespace layered {
 
     if ( rcount == 0 )
     {
-      if ( monitor.joinable() )
+      if ( monitored )
       {
-        canRun = false,
-          evEvent.notify_one();
-        monitor.join();
+        auto  exwait = mtc::make_unique_lock( evMutex );
+
+        canRun = false;
+
+        if ( Executor::Get().Cancel( this ) != 0 )
+          evQueued = false;
+
+        evEvent.wait( exwait, [this](){  return !evQueued;  } );
       }
-      commitItems();
+      if ( !pinned )
+        commitItems();
       delete this;
     }
     return rcount;
@@ -136,16 +394,12 @@ namespace layered {
 
   auto  ContentsIndex::GetEntity( EntityId id ) const -> mtc::api<const IEntity>
   {
-    auto  shlock = mtc::make_shared_lock( ixlock );
-
-    return getEntity( id );
+    return rdLayers.Get()->getEntity( id );
   }
 
   auto  ContentsIndex::GetEntity( uint32_t id ) const -> mtc::api<const IEntity>
   {
-    auto  shlock = mtc::make_shared_lock( ixlock );
-
-    return getEntity( id );
+    return rdLayers.Get()->getEntity( id );
   }
 
   bool  ContentsIndex::DelEntity( EntityId id )
@@ -166,40 +420,53 @@ namespace layered {
       auto  shlock = mtc::make_shared_lock( ixlock );
       auto  exlock = mtc::make_unique_lock( ixlock, std::defer_lock );
       auto  pindex = layers.back().pIndex.ptr();    // the last index pointer, unchanged in one thread
+      auto  rotnum = rotated.load();
 
     // try Set the entity to the last index in the chain
       try
       {
-        return layers.back().Override( pindex->SetEntity( id, contents, xtra, beef ) );
+        auto  entity = pindex->SetEntity( id, contents, xtra, beef );
+
+        if ( directory != nullptr )
+          setLayer( id, layers.back() );
+
+        return layers.back().Override( entity );
       }
 
-    // on dynamic index overflow, rotate the last index by creating new one in a new flakes,
-    // and continue Setting attempts
+    // on dynamic index overflow (the hard mark) wait a bounded time for the monitor
+    // to rotate the index prepared at the soft mark; rotate it synchronously if the
+    // monitor did not manage it
+    //
+    // the monitor does not rotate while the commits are limited, so wait for some
+    // commit to finish; index_busy is thrown if it takes longer than commitWait
       catch ( const index_overflow& /*xo*/ )
       {
-        shlock.unlock();  exlock.lock();
+        shlock.unlock();
+
+        if ( CommitsFull() )
+        {
+          WaitCommits();
+        }
+          else
+        if ( monitored )
+        {
+          auto  rtwait = mtc::make_unique_lock( rtMutex );
+
+          if ( rtEvent.wait_for( rtwait, dynSet.hardMarkWait, [&](){  return rotated.load() != rotnum;  } ) )
+            continue;
+        }
+
+        exlock.lock();
 
       // received exclusive lock, check if index is already rotated by another
       // SetEntity call; if yes, try again to SetEntity, else rotate index
         if ( layers.back().pIndex.ptr() == pindex )
         {
-        // rotate the index by creating the commiter for last (dynamic) index
-        // and create the new dynamic index
-          layers.back().uUpper = layers.back().uLower
-            + pindex->GetMaxIndex() - 1;
-
-          layers.back().pIndex = commit::Contents().Create( layers.back().pIndex, [this]( void* to, Notify::Event event )
-            {
-              mtc::interlocked( mtc::make_unique_lock( evMutex ), [&]()
-                {  evQueue.emplace_back( to, event );  } );
-              evEvent.notify_one();
-            } );
+          if ( CommitsFull() )
+            continue;
 
-          layers.emplace_back( layers.back().uUpper + 1, dynamic::Index()
-            .Set( dynSet )
-            .Set( istore->CreateStore() ).Create() );
-          layers.back().uUpper = (uint32_t)-1;
-          layers.back().dwSets = 1;
+          RotateLayers( TakeStandby() );
+          PutNewEvent( nullptr, Notify::Event::None );    // wake up the monitor to refill standby
         }
       }
     }
@@ -225,208 +492,788 @@ namespace layered {
 
   auto  ContentsIndex::GetMaxIndex() const -> uint32_t
   {
-    auto  shlock = mtc::make_shared_lock( ixlock );
-    return getMaxIndex();
+    return rdLayers.Get()->getMaxIndex();
   }
 
   auto  ContentsIndex::GetKeyBlock( const std::string_view& key ) const -> mtc::api<IEntities>
   {
-    return mtc::interlocked( mtc::make_shared_lock( ixlock ), [&]()
-      {  return getKeyBlock( key, this );  } );
+    auto  rdlist = rdLayers.Get();
+
+    return rdlist->getKeyBlock( key, MakeObjectHolder( mtc::api( (const Iface*)this ),
+      mtc::api<LayerSet>( rdlist ) ) );
   }
 
   auto  ContentsIndex::GetKeyStats( const std::string_view& key ) const -> BlockInfo
   {
-    return mtc::interlocked( mtc::make_shared_lock( ixlock ), [&]()
-      {  return getKeyStats( key );  } );
+    return rdLayers.Get()->GetKeyStats( key );
   }
 
-  auto  ContentsIndex::ListContents( const std::string_view& key ) -> mtc::api<IContentsList>
+  /*
+   * GetIndexStats()
+   *
+   * Sums the statistics of the published layers.
+   */
+  auto  ContentsIndex::GetIndexStats() const -> IndexStats
   {
-    return listContents( key, MakeObjectHolder( mtc::api( (const Iface*)this ),
-      std::move( mtc::make_shared_lock( ixlock ) ) ) );
+    auto  rdlist = rdLayers.Get();
+    auto  istats = IndexStats{ 0, 0, 0 };
+
+    for ( auto& next: rdlist->Layers() )
+    {
+      auto  lstats = next.pIndex->GetIndexStats();
+
+      istats.nCount += lstats.nCount;
+      istats.nDeleted += lstats.nDeleted;
+      istats.cbStored += lstats.cbStored;
+    }
+    return istats;
+  }
+
+  /*
+   * Snapshot()
+   *
+   * Pins each layer of the published copy and creates the read-only layered
+   * index over the snapshots, so the entity index ranges do not change.
+   */
+  auto  ContentsIndex::Snapshot() -> mtc::api<IContentsIndex>
+  {
+    auto  rdlist = rdLayers.Get();
+    auto  layset = std::vector<mtc::api<IContentsIndex>>();
+    auto  pindex = mtc::api<ContentsIndex>();
+
+    for ( auto& next: rdlist->Layers() )
+      layset.push_back( next.pIndex->Snapshot() );
+
+    pindex = new ContentsIndex( layset.data(), layset.size() );
+    pindex->rdOnly = pindex->pinned = true;
+
+    return pindex.ptr();
+  }
+
+  auto  ContentsIndex::ForceMerge( uint32_t maxSegments ) -> std::future<void>
+  {
+    return PutMaintenance( Maintenance::forceMerge, std::max( maxSegments, 1U ) );
   }
 
-  void  ContentsIndex::MergeMonitor( const std::chrono::seconds& startDelay )
+  auto  ContentsIndex::ExpungeDeletes( double minDeletedRatio ) -> std::future<void>
   {
-    pthread_setname_np( pthread_self(), "MergeMonitor" );
+    return PutMaintenance( Maintenance::expungeDeletes, minDeletedRatio );
+  }
+
+ /*
+  * Partition( nparts )
+  *
+  * Splits the published copy of the layers to the groups of adjacent layers of
+  * about the same count of entities.
+  */
+  auto  ContentsIndex::Partition( unsigned nparts ) -> std::vector<mtc::api<IContentsIndex>>
+  {
+    auto  rdlist = rdLayers.Get();
+    auto& layset = rdlist->Layers();
+    auto  ngroup = std::min( size_t(std::max( nparts, 1U )), layset.size() );
+    auto  ntotal = uint64_t(0);
+    auto  ncount = uint64_t(0);
+    auto  output = std::vector<mtc::api<IContentsIndex>>();
+
+    if ( ngroup < 2 )
+      return { this };
 
-    for ( std::this_thread::sleep_for( startDelay ); canRun; )
+    for ( auto& next: layset )
+      ntotal += next.pIndex->GetMaxIndex();
+
+    for ( size_t first = 0, igroup = 0; igroup != ngroup; ++igroup )
     {
-      auto  evNext = WaitGetEvent( std::chrono::seconds( 30 ) );
+      auto  nlimit = ntotal * (igroup + 1) / ngroup;
+      auto  last = first + 1;
 
-    // for event occured, search the element in the list of indices to Reduce()
-    // and finish index modification
-      if ( evNext.first != nullptr && canRun)
-      {
-        auto  exlock = mtc::make_unique_lock( ixlock );
-        auto  pfound = std::find_if( layers.begin(), layers.end(), [&]( const IndexEntry& index )
-          {  return index.pIndex.ptr() == evNext.first;  } );
+    // take the layers up to the share of entities, but leave one layer at least
+    // for each group left; the last group takes all the rest
+      for ( ncount += layset[first].pIndex->GetMaxIndex(); last != layset.size() - (ngroup - igroup - 1) && ncount < nlimit; ++last )
+        ncount += layset[last].pIndex->GetMaxIndex();
 
-      // if the index with key pointer found, check the type of event occured
-        if ( pfound == layers.end() )
-          throw std::logic_error( "strange event not attached to any index!" );
+      if ( igroup == ngroup - 1 )
+        last = layset.size();
 
-        switch ( evNext.second )
-        {
-        // On OK, replace the index in the entry to it's reduced version,
-        // resort the indices in the size-decreasing order, and renumber
-          case Notify::Event::OK:
-          {
-            uint32_t uLower = 1;
+      output.push_back( new LayerPart( mtc::api( (const Iface*)this ), rdlist,
+        new LayerSet( *rdlist, first, last ) ) );
 
-            pfound->pIndex = pfound->pIndex->Reduce();
-            pfound->backup.clear();
-            pfound->dwSets = 0;
+      first = last;
+    }
+    return output;
+  }
 
-            std::sort( layers.begin(), layers.end() - 1, []( const IndexEntry& a, const IndexEntry& b )
-            {
-              if ( a.dwSets != b.dwSets )
-                return (a.dwSets != 0) > (b.dwSets != 0 );
-              return a.pIndex->GetMaxIndex() > b.pIndex->GetMaxIndex();
-            } );
+  auto  ContentsIndex::ListEntities( EntityId id ) -> mtc::api<IEntitiesList>
+  {
+    auto  rdlist = rdLayers.Get();
 
-            for ( auto& index: layers )
-              uLower = (index.uUpper = (index.uLower = uLower) + index.pIndex->GetMaxIndex() - 1) + 1;
+    return rdlist->listEntities( id, MakeObjectHolder( mtc::api( (const Iface*)this ),
+      mtc::api<LayerSet>( rdlist ) ) );
+  }
 
-            layers.back().uUpper = uint32_t(-1);
-            break;
-          }
+  auto  ContentsIndex::ListEntities( uint32_t ix ) -> mtc::api<IEntitiesList>
+  {
+    auto  rdlist = rdLayers.Get();
 
-        // On Empty, simple remove the existing index because its processing
-        // result is empty
-          case Notify::Event::Empty:
-            layers.erase( pfound );
-            break;
+    return rdlist->listEntities( ix, MakeObjectHolder( mtc::api( (const Iface*)this ),
+      mtc::api<LayerSet>( rdlist ) ) );
+  }
 
-        // On Cancel, rollback the event record to the previous subset
-        // of entries saved in the entry processed
-          case Notify::Event::Canceled:
-          {
-            auto  backup = std::move( pfound->backup );
+  auto  ContentsIndex::ListContents( const std::string_view& key ) -> mtc::api<IContentsList>
+  {
+    auto  rdlist = rdLayers.Get();
 
-            layers.insert( layers.erase( pfound ),
-              backup.begin(), backup.end() );
-            break;
-          }
+    return rdlist->listContents( key, MakeObjectHolder( mtc::api( (const Iface*)this ),
+      mtc::api<LayerSet>( rdlist ) ) );
+  }
 
-      // On Failed, commit index and shutdown service if possible
-          default:
-            break;
-        }
-      }
+ /*
+  * MonitorTask()
+  *
+  * The executor task processing the events queued; is scheduled by the first
+  * event put and processes the events one by one until the queue is empty.
+  * The first run checks the merges of the layers the index is opened with.
+  */
+  void  ContentsIndex::MonitorTask()
+  {
+    auto  evNext = EventRec( nullptr, Notify::Event::None );
+    auto  prepare = [this]()
+      {
+        try
+          {  MakeStandby();  }
+        catch ( ... )
+          {}
+      };
 
-    // try select indices to be merged
-      if ( canRun )
+    do
+    {
+      try
       {
-        auto  shlock = mtc::make_shared_lock( ixlock );
-        auto  exlock = mtc::make_unique_lock( ixlock, std::defer_lock );
-        auto  limits = SelectLimits();
+      // keep the standby dynamic index ready for the rotation; on failure the
+      // standby is left empty, and TakeStandby() throws the error to the writer
+        if ( canRun && !rdOnly )
+          prepare();
+
+      // for the dynamic index passed the soft mark, switch writers to the standby
+      // index if the index is not rotated yet, and prepare the next standby
+        if ( evNext.second == Notify::Event::Filled && canRun )
+        {
+          auto  dynamic = TakeStandby();
+          auto  exlock = mtc::make_unique_lock( ixlock );
 
-      // select the limits, check and select again the limits for merger
-        if ( limits.first != limits.second )
+          if ( layers.back().pIndex.ptr() == evNext.first && !DeferFilled( evNext.first ) )
+          {
+            RotateLayers( dynamic );
+          }
+            else
+          {
+            mtc::interlocked( mtc::make_unique_lock( sbMutex ), [&]()
+              {  if ( standby == nullptr ) standby = dynamic;  } );
+          }
+          exlock.unlock();
+
+          prepare();
+        }
+          else
+        if ( evNext.first != nullptr && canRun )
         {
-          shlock.unlock();  exlock.lock();
+        // for other event occured, search the element in the list of indices to
+        // Reduce() and finish index modification
+          auto  exlock = mtc::make_unique_lock( ixlock );
+          auto  pfound = std::find_if( layers.begin(), layers.end(), [&]( const IndexEntry& index )
+            {  return index.pIndex.ptr() == evNext.first;  } );
 
-          if ( (limits = SelectLimits()).first != limits.second )
+        // if the index with key pointer found, check the type of event occured
+          if ( pfound == layers.end() )
+            throw std::logic_error( "strange event not attached to any index!" );
+
+          switch ( evNext.second )
           {
-            auto  xMaker = fusion::Contents()
-              .Set( [this]( void* to, Notify::Event event )
-                {
-                  mtc::interlocked( mtc::make_unique_lock( evMutex ), [&]()
-                    {  evQueue.emplace_back( to, event );  } );
-                  merging = false;
-                    evEvent.notify_one();
-                } )
-//              .Set( canContinue )
-              .Set( istore->CreateStore() );
-
-            for ( auto p = limits.first; p != limits.second; ++p )
+          // On OK, replace the index in the entry to it's reduced version,
+          // resort the indices in the size-decreasing order, and renumber
+            case Notify::Event::OK:
             {
-              xMaker.Add( p->pIndex );
-              limits.first->backup.push_back( IndexEntry{ p->uLower, p->pIndex } );
+              uint32_t uLower = 1;
+
+              mapLayers( *pfound, pfound->lLayer );
+
+              pfound->pIndex = pfound->pIndex->Reduce();
+              pfound->backup.clear();
+              pfound->dwSets = 0;
+
+              std::sort( layers.begin(), layers.end() - 1, []( const IndexEntry& a, const IndexEntry& b )
+              {
+                if ( a.dwSets != b.dwSets )
+                  return (a.dwSets != 0) > (b.dwSets != 0 );
+                return a.pIndex->GetMaxIndex() > b.pIndex->GetMaxIndex();
+              } );
+
+              for ( auto& index: layers )
+                uLower = (index.uUpper = (index.uLower = uLower) + index.pIndex->GetMaxIndex() - 1) + 1;
+
+              layers.back().uUpper = uint32_t(-1);
+              break;
             }
 
-            limits.first->uUpper = limits.first->backup.back().uUpper;
-            limits.first->pIndex = xMaker.Create();
-            limits.first->dwSets = 1;
+          // On Empty, simple remove the existing index because its processing
+          // result is empty
+            case Notify::Event::Empty:
+              mapLayers( *pfound, EntityDirectory::unknown );
+              layers.erase( pfound );
+              break;
+
+          // On Cancel, rollback the event record to the previous subset
+          // of entries saved in the entry processed
+            case Notify::Event::Canceled:
+            {
+              auto  backup = std::move( pfound->backup );
+              auto  uLower = pfound->uLower;
+
+            // the entry may be moved by other merges finished, so renumber
+              for ( auto& index: backup )
+                uLower = (index.uUpper = (index.uLower = uLower) + index.pIndex->GetMaxIndex() - 1) + 1;
 
-            layers.erase( limits.first + 1, limits.second );
+              layers.insert( layers.erase( pfound ),
+                backup.begin(), backup.end() );
+              break;
+            }
 
-            merging = true;
+        // On Failed, commit index and shutdown service if possible
+            default:
+              break;
           }
+
+          PublishLayers();
         }
+
+      // finish the maintenance requests done, and start the merges of selected
+      // layers while the schedule allows
+        if ( canRun )
+          CheckMaintenance();
+
+        while ( canRun && StartMerge() )
+          (void)NULL;
       }
-    }
+    // the task runs in the executor thread and must not throw, so the event failed
+    // is dropped and the next one is processed; evQueued is cleared by the loop
+      catch ( ... )
+      {
+      }
+    } while ( GetNewEvent( evNext ) );
   }
 
  /*
-  * Ищет самую длинную постедовательность самых маленьких индексов. Критерий -
+  * SelectLimits()
+  *
+  * Asks the merge policy for the range of layers to be merged; only the static
+  * layers may be merged, so the merges run do not overlap.  The merge is not
+  * started if the schedule limits are exceeded, but the first one is started
+  * regardless of its size.
+  *
+  * The pending maintenance request selects the layers instead of the policy and
+  * is not limited by the size of the layers being merged.
   */
   auto  ContentsIndex::SelectLimits() -> std::pair<LayersIt, LayersIt>
   {
-    auto  asizes = std::vector<size_t>();
-    auto  select = std::make_pair( layers.end(), layers.end() );
-    float srange;
-    auto  Ranker = [&]( size_t from, size_t to ) -> float
+    auto  lstats = std::vector<IMergePolicy::Layer>();
+    auto  select = std::pair<size_t, size_t>();
+    auto  cbsize = uint64_t(0);
+    auto  forced = false;
+
+    if ( nmerges >= std::max( mrgSet.maxMerges, 1U ) )
+      return { layers.end(), layers.end() };
+
+    lstats = GetLayerStats();
+
+    if ( (forced = SelectMaintenance( lstats, select )) == false )
     {
-      auto  min_size = size_t(-1);
-      auto  max_size = size_t(0);
-      auto  med_size = size_t(0);
+      if ( policy == nullptr )
+        return { layers.end(), layers.end() };
+      select = policy->Select( lstats.data(), lstats.size() );
+    }
+
+    if ( select.first >= select.second || select.second > layers.size() )
+      return { layers.end(), layers.end() };
+
+    for ( auto i = select.first; i != select.second; ++i )
+    {
+      if ( !lstats[i].canMerge )
+        throw std::logic_error( "merge policy selected the layer not to be merged" );
+      cbsize += lstats[i].stats.cbStored;
+    }
+
+    if ( !forced && mrgSet.maxBytes != 0 && nmerges != 0 && cbmerge + cbsize > mrgSet.maxBytes )
+      return { layers.end(), layers.end() };
+
+    return { layers.begin() + select.first, layers.begin() + select.second };
+  }
 
-      for ( auto i = from; i != to; ++i )
+ /*
+  * SelectMaintenance( lstats, select )
+  *
+  * Selects the layers for the first maintenance request pending; returns false
+  * if there is no request.
+  *
+  * ForceMerge selects the longest run of adjacent static layers not longer than
+  * needed to reach the count requested, the smallest one of equal runs, so the
+  * small layers are merged first.  ExpungeDeletes selects the single layer with
+  * the largest ratio of deleted entities to be rewritten.
+  */
+  bool  ContentsIndex::SelectMaintenance( const std::vector<IMergePolicy::Layer>& lstats, std::pair<size_t, size_t>& select )
+  {
+    auto  exlock = mtc::make_unique_lock( mtMutex );
+    auto  nfixed = lstats.size() - 1;     // the dynamic layer is never merged
+    auto  cbbest = uint64_t(0);
+    auto  dlbest = 0.0;
+
+    if ( mtQueue.empty() )
+      return false;
+
+    select = { 0, 0 };
+
+    if ( mtQueue.front().kind == Maintenance::forceMerge )
+    {
+      auto  maxseg = size_t(mtQueue.front().value);
+      auto  excess = nfixed > maxseg ? nfixed - maxseg : 0;
+
+      for ( size_t i = 0; excess != 0 && i != nfixed; ++i )
       {
-        min_size = std::min( min_size, asizes[i] );
-        max_size = std::max( max_size, asizes[i] );
-        med_size += asizes[i];
+        auto  cbsize = uint64_t(0);
+        auto  j = i;
+
+        for ( ; j != nfixed && j - i <= excess && lstats[j].canMerge; ++j )
+          cbsize += lstats[j].stats.cbStored;
+
+        if ( j - i < 2 || j - i < select.second - select.first )
+          continue;
+
+        if ( j - i > select.second - select.first || cbsize < cbbest )
+          select = { i, j }, cbbest = cbsize;
       }
-      med_size /= (to - from);
+    }
+      else
+    {
+      for ( size_t i = 0; i != nfixed; ++i )
+      {
+        auto& stats = lstats[i].stats;
+        auto  dratio = stats.nDeleted != 0 ? stats.nDeleted / double(stats.nCount) : 0.0;
 
-      auto  s_factor = 1 / (1 + log(1 + (max_size - min_size) / 1000.0));
-      auto  l_factor = 0.2 + sin(1.57 + atan((med_size - 1) / 10000.0)) * 0.8;
-      auto  n_factor = 0.2 + sin(2 * atan((to - from - 2) / 6.0)) * 0.8;
+        if ( lstats[i].canMerge && stats.nDeleted != 0 && dratio >= mtQueue.front().value && dratio > dlbest )
+          select = { i, i + 1 }, dlbest = dratio;
+      }
+    }
+    return true;
+  }
 
-      return float(s_factor * l_factor * n_factor);
-    };
+ /*
+  * CheckMaintenance()
+  *
+  * Finishes the maintenance requests done.  The request is done if no merges
+  * are run and no more layers are to be merged for it, including the layers
+  * being committed; so the merges started by the policy are also waited for.
+  */
+  void  ContentsIndex::CheckMaintenance()
+  {
+    auto  shlock = mtc::make_shared_lock( ixlock );
+    auto  lstats = GetLayerStats();
+    auto  exlock = mtc::make_unique_lock( mtMutex );
+    auto  nfixed = lstats.size() - 1;
+
+    shlock.unlock();
+
+    while ( nmerges == 0 && !mtQueue.empty() )
+    {
+      auto& mtnext = mtQueue.front();
+
+      if ( mtnext.kind == Maintenance::forceMerge && nfixed > size_t(mtnext.value) )
+        return;
+
+      if ( mtnext.kind == Maintenance::expungeDeletes )
+      {
+        for ( size_t i = 0; i != nfixed; ++i )
+          if ( lstats[i].stats.nDeleted != 0 && lstats[i].stats.nDeleted >= mtnext.value * lstats[i].stats.nCount )
+            return;
+      }
+
+      mtnext.result.set_value();
+        mtQueue.pop_front();
+    }
+  }
 
-    if ( merging )
-      return select;
+ /*
+  * PutMaintenance( kind, value )
+  *
+  * Queues the maintenance request and wakes up the monitor to process it.
+  */
+  auto  ContentsIndex::PutMaintenance( Maintenance::Kind kind, double value ) -> std::future<void>
+  {
+    auto  result = std::promise<void>();
+    auto  future = result.get_future();
+
+    if ( !monitored || rdOnly )
+    {
+      result.set_exception( std::make_exception_ptr(
+        std::logic_error( "index maintenance needs the index storage" ) ) );
+      return future;
+    }
+
+    mtc::interlocked( mtc::make_unique_lock( mtMutex ), [&]()
+      {  mtQueue.push_back( { kind, value, std::move( result ) } );  } );
+
+    PutNewEvent( nullptr, Notify::Event::None );
+    return future;
+  }
+
+  auto  ContentsIndex::GetLayerStats() const -> std::vector<IMergePolicy::Layer>
+  {
+    auto  lstats = std::vector<IMergePolicy::Layer>();
 
     for ( auto& next: layers )
-      asizes.push_back( next.dwSets == 0 ? next.pIndex->GetMaxIndex() : 0 );
+      lstats.push_back( { next.pIndex->GetIndexStats(), next.dwSets == 0 } );
 
-    for ( size_t from = 0; from != asizes.size(); ++from )
-      if ( asizes[from] != 0 )
-        for ( size_t to = from + 1; to <= asizes.size() && asizes[to - 1] != 0; ++to )
-          if ( to - from > 1 )
-          {
-            float crange = Ranker( from, to );
+    return lstats;
+  }
 
-            if ( select.first == select.second || crange > srange || (crange == srange && size_t(to - from) > size_t(select.second - select.first)) )
-            {
-              select = { layers.begin() + from, layers.begin() + to };
-              srange = crange;
-            }
-          }
-    return select;
+ /*
+  * StartMerge()
+  *
+  * Replaces the layers selected with the merger placeholder and starts the merge;
+  * returns false if nothing is selected.
+  */
+  bool  ContentsIndex::StartMerge()
+  {
+    auto  shlock = mtc::make_shared_lock( ixlock );
+    auto  exlock = mtc::make_unique_lock( ixlock, std::defer_lock );
+    auto  limits = SelectLimits();
+    auto  cbsize = uint64_t(0);
+
+  // select the limits, check and select again the limits for merger
+    if ( limits.first == limits.second )
+      return false;
+
+    shlock.unlock();  exlock.lock();
+
+    if ( (limits = SelectLimits()).first == limits.second )
+      return false;
+
+    for ( auto p = limits.first; p != limits.second; ++p )
+      cbsize += p->pIndex->GetIndexStats().cbStored;
+
+    auto  mStore = io::Throttle( istore->CreateStore(), ioLimits.merge );
+    auto  xMaker = fusion::Contents()
+      .Set( [this, cbsize]( void* to, Notify::Event event )
+        {
+          cbmerge -= cbsize;
+          --nmerges;
+          PutNewEvent( to, event );
+        } )
+//      .Set( canContinue )
+      .Set( ioLimits.merge )
+      .Set( mStore )
+      .SetThreads( mrgSet.maxThreads );
+
+  // the layers merged are static, so Commit() just returns their serialized
+  // sources to be superseded by the merge result
+    for ( auto p = limits.first; p != limits.second; ++p )
+    {
+      mStore->Supersede( p->pIndex->Commit() );
+      xMaker.Add( p->pIndex );
+      limits.first->backup.push_back( IndexEntry{ p->uLower, p->pIndex, p->lLayer } );
+    }
+
+  // account the merge before it is started, the merger may finish at once
+    ++nmerges;
+    cbmerge += cbsize;
+
+    limits.first->uUpper = limits.first->backup.back().uUpper;
+    limits.first->pIndex = xMaker.Create();
+    limits.first->dwSets = 1;
+
+    layers.erase( limits.first + 1, limits.second );
+
+    PublishLayers();
+    return true;
   }
 
 // check if any events occured; process events first
 // for each processed event, either reduce the index sent the event,
 // or simply remove the empty index
 // or process the errors
-  auto  ContentsIndex::WaitGetEvent( const std::chrono::seconds& timeout ) -> EventRec
+  bool  ContentsIndex::GetNewEvent( EventRec& evNext )
   {
     auto  exwait = mtc::make_unique_lock( evMutex );
-    auto  fEvent = [this](){  return !canRun || !evQueue.empty();  };
 
-    if ( evEvent.wait_for( exwait, timeout, fEvent ) && canRun )
+    if ( canRun && !evQueue.empty() )
     {
-      auto  ev_get = evQueue.front();
+      evNext = evQueue.front();
         evQueue.pop_front();
-      return ev_get;
+      return true;
+    }
+
+  // finish the task under the lock, Detach() waits for it
+    evQueued = false;
+      evEvent.notify_all();
+    return false;
+  }
+
+  void  ContentsIndex::PutNewEvent( void* to, Notify::Event event )
+  {
+    mtc::interlocked( mtc::make_unique_lock( evMutex ), [&]()
+      {
+        evQueue.emplace_back( to, event );
+
+        if ( monitored && canRun && !evQueued )
+        {
+          evQueued = true;
+          Executor::Get().Run( Executor::housekeeping, this, [this](){  MonitorTask();  } );
+        }
+      } );
+  }
+
+ /*
+  * OpenLayers( serials, listed )
+  *
+  * Opens the static layers by the executor threads, each one loading the entities
+  * and building the entities map independently, and returns them in the order of
+  * the serials passed.  Each thread also lists the entities of its layer for the
+  * entity directory.
+  */
+  auto  ContentsIndex::OpenLayers( const std::vector<mtc::api<IStorage::ISerialized>>& serials,
+    std::vector<EntityDirectory::Listing>& listed ) -> std::vector<mtc::api<IContentsIndex>>
+  {
+    auto  opened = std::vector<mtc::api<IContentsIndex>>( serials.size() );
+
+    startup.tmLayers.resize( serials.size() );
+    listed.resize( serials.size() );
+
+    RunParallel( serials.size(), [&]( size_t i )
+      {
+        auto  tstart = std::chrono::steady_clock::now();
+
+        opened[i] = static_::Index().Create( serials[i] );
+        listed[i] = EntityDirectory::List( *opened[i] );
+
+        startup.tmLayers[i] = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - tstart );
+      } );
+
+    return opened;
+  }
+
+ /*
+  * RunParallel( count, func )
+  *
+  * Calls func( 0 ) ... func( count - 1 ) by the executor threads and the caller,
+  * each one taking the calls not started yet, so the caller never waits for the
+  * helpers queued behind the other tasks, e.g. when called by the executor task.
+  * The first exception caught is rethrown when all the calls are finished.
+  */
+  void  ContentsIndex::RunParallel( size_t count, const std::function<void( size_t )>& func )
+  {
+    auto                    except = std::exception_ptr();
+    auto                    nextCall = std::atomic<size_t>( 0 );
+    auto                    nhelpers = count - std::min( count, size_t(1) );
+    auto                    nstopped = size_t(0);
+    std::mutex              mxlock;
+    std::condition_variable mxwait;
+    auto                    runCalls = [&]()
+      {
+        auto  failed = std::exception_ptr();
+
+        for ( auto i = nextCall++; i < count && failed == nullptr; i = nextCall++ )
+        {
+          try
+            {  func( i );  }
+          catch ( ... )
+            {  failed = std::current_exception();  }
+        }
+
+        if ( failed != nullptr )
+          mtc::interlocked( mtc::make_unique_lock( mxlock ), [&]()
+            {
+              if ( except == nullptr )
+                except = failed;
+            } );
+      };
+
+  // the helpers are owned by the call, so the monitor task queued for the index
+  // is not canceled with them
+    for ( size_t i = 0; i != nhelpers; ++i )
+    {
+      Executor::Get().Run( Executor::commit, &nextCall, [&]()
+        {
+          runCalls();
+
+        // notify under the lock, the waiter destroys the syncro on return
+          mtc::interlocked( mtc::make_unique_lock( mxlock ), [&]()
+            {
+              ++nstopped;
+                mxwait.notify_all();
+            } );
+        } );
+    }
+
+    runCalls();
+
+  // the helpers not started have nothing to do, the others finish their calls
+    nhelpers -= Executor::Get().Cancel( &nextCall );
+
+    {
+      auto  exwait = mtc::make_unique_lock( mxlock );
+
+      mxwait.wait( exwait, [&](){  return nstopped == nhelpers;  } );
     }
-    return { nullptr, Notify::Event::None };
+
+    if ( except != nullptr )
+      std::rethrow_exception( except );
+  }
+
+ /*
+  * CreateDynamic()
+  *
+  * Creates new dynamic index in a new storage.  Does not need any locks and is
+  * called by the monitor before the rotation.
+  */
+  auto  ContentsIndex::CreateDynamic() -> mtc::api<IContentsIndex>
+  {
+    return dynamic::Index()
+      .Set( dynSet )
+      .Set( io::Throttle( istore->CreateStore(), ioLimits.commit ) )
+      .Set( [this]( void* to ){  PutNewEvent( to, Notify::Event::Filled );  } ).Create();
+  }
+
+ /*
+  * TakeStandby()
+  *
+  * Returns the standby dynamic index created in advance, or creates new one
+  * if the standby is not ready yet.
+  */
+  auto  ContentsIndex::TakeStandby() -> mtc::api<IContentsIndex>
+  {
+    auto  dynamic = mtc::interlocked( mtc::make_unique_lock( sbMutex ), [&]()
+      {
+        auto  getptr = standby;
+        return standby = nullptr, getptr;
+      } );
+
+    return dynamic != nullptr ? dynamic : CreateDynamic();
+  }
+
+ /*
+  * MakeStandby()
+  *
+  * Creates the standby dynamic index if there is no one; the creation (storage
+  * files, hash tables and keys indexer thread) is done without any locks.
+  */
+  void  ContentsIndex::MakeStandby()
+  {
+    auto  dynamic = mtc::api<IContentsIndex>();
+
+    if ( mtc::interlocked( mtc::make_unique_lock( sbMutex ), [&](){  return standby != nullptr;  } ) )
+      return;
+
+    dynamic = CreateDynamic();
+
+    mtc::interlocked( mtc::make_unique_lock( sbMutex ), [&]()
+      {  if ( standby == nullptr ) standby = dynamic;  } );
+  }
+
+ /*
+  * RotateLayers( dynamic )
+  *
+  * Replaces the last (dynamic) index with the commiter and appends the new dynamic
+  * index passed.  Is called under exclusive lock.
+  */
+  void  ContentsIndex::RotateLayers( mtc::api<IContentsIndex> dynamic )
+  {
+    layers.back().uUpper = layers.back().uLower
+      + layers.back().pIndex->GetMaxIndex() - 1;
+
+  // count the commit first, the callback may come before Create() returns; the
+  // index rotated by the writer is not deferred any more
+    mtc::interlocked( mtc::make_unique_lock( rtMutex ), [&]()
+      {
+        if ( deferred == layers.back().pIndex.ptr() )
+          deferred = nullptr;
+        ++ncommits;
+      } );
+
+    layers.back().pIndex = commit::Contents().Create( layers.back().pIndex, [this]( void* to, Notify::Event event )
+      {
+        auto  filled = mtc::interlocked( mtc::make_unique_lock( rtMutex ), [&]()
+          {  return --ncommits, std::exchange( deferred, nullptr );  } );
+
+        rtEvent.notify_all();
+        PutNewEvent( to, event );
+
+      // the index filled while the commits were full is rotated now
+        if ( filled != nullptr )
+          PutNewEvent( filled, Notify::Event::Filled );
+      } );
+
+    addContents( dynamic );
+    layers.back().uUpper = (uint32_t)-1;
+    layers.back().dwSets = 1;
+
+    PublishLayers();
+
+  // wake up the writers waiting for the rotation
+    mtc::interlocked( mtc::make_unique_lock( rtMutex ), [&]()
+      {  ++rotated;  } );
+    rtEvent.notify_all();
+  }
+
+ /*
+  * CommitsFull()
+  *
+  * Checks if the count of full dynamic indices being committed reached the limit
+  * set, so the next one may not be rotated.
+  */
+  bool  ContentsIndex::CommitsFull() const
+  {
+    return dynSet.maxCommits != 0 && ncommits >= dynSet.maxCommits;
+  }
+
+ /*
+  * DeferFilled( index )
+  *
+  * Checks if the commits are full and remembers the dynamic index passed the
+  * soft mark, so the event is posted again by the first commit finished; the
+  * dynamic index notifies the soft mark only once.
+  */
+  bool  ContentsIndex::DeferFilled( void* filled )
+  {
+    auto  exlock = mtc::make_unique_lock( rtMutex );
+
+    if ( !CommitsFull() )
+      return false;
+
+    return deferred = filled, true;
+  }
+
+ /*
+  * WaitCommits()
+  *
+  * Waits for the count of commits to fall below the limit; throws index_busy
+  * on timeout, so the writers get the back pressure instead of the memory
+  * growing with the full indices queued.
+  */
+  void  ContentsIndex::WaitCommits()
+  {
+    auto  rtwait = mtc::make_unique_lock( rtMutex );
+
+    if ( !rtEvent.wait_for( rtwait, dynSet.commitWait, [this](){  return !CommitsFull();  } ) )
+      throw index_busy( "too many index commits pending" );
+  }
+
+  /*
+   * PublishLayers()
+   *
+   * Publishes the copy of the layers to the readers; is called on creation and
+   * under exclusive lock each time the layers are changed.
+   */
+  void  ContentsIndex::PublishLayers()
+  {
+    rdLayers.Set( new LayerSet( *this ) );
   }
 
   // Index implementation
@@ -441,11 +1288,40 @@ namespace layered {
     return dynamicSettings = settings, *this;
   }
 
+  auto Index::Set( mtc::api<IMergePolicy> policy ) -> Index&
+  {
+    return mergePolicy = policy, *this;
+  }
+
+  auto Index::Set( const merge::Schedule& schedule ) -> Index&
+  {
+    return mergeSchedule = schedule, *this;
+  }
+
+  auto Index::Set( const io::Limits& limits ) -> Index&
+  {
+    return ioLimits = limits, *this;
+  }
+
+  auto Index::Set( OnStartup report ) -> Index&
+  {
+    return startupReport = report, *this;
+  }
+
   auto Index::Create() -> mtc::api<IContentsIndex>
   {
+    auto  pindex = mtc::api<ContentsIndex>();
+
     if ( contentsStorage == nullptr )
       throw std::logic_error( "layered index storage is not defined" );
-    return (new ContentsIndex( contentsStorage, dynamicSettings ))->StartMonitor( runMonitorDelay );
+
+    pindex = new ContentsIndex( contentsStorage, dynamicSettings, mergePolicy != nullptr ?
+      mergePolicy : merge::Tiered().Create(), mergeSchedule, ioLimits );
+
+    if ( startupReport != nullptr )
+      startupReport( pindex->GetStartup() );
+
+    return pindex->StartMonitor( runMonitorDelay );
   }
 
   auto  Index::Create( const mtc::api<IContentsIndex>* indices, size_t size ) -> mtc::api<IContentsIndex>
@@ -458,4 +1334,12 @@ namespace layered {
     return Create( indices.data(), indices.size() );
   }
 
+  auto  Index::Partition( const mtc::api<IContentsIndex>& index, unsigned nparts ) -> std::vector<mtc::api<IContentsIndex>>
+  {
+    auto  layered = dynamic_cast<ContentsIndex*>( index.ptr() );
+
+    return layered != nullptr ? layered->Partition( nparts ) :
+      std::vector<mtc::api<IContentsIndex>>{ index };
+  }
+
 }}}
@@ -0,0 +1,122 @@
+# if !defined( __DelphiX_src_indexer_loser_tree_hxx__ )
+# define __DelphiX_src_indexer_loser_tree_hxx__
+# include <cstddef>
+# include <utility>
+# include <vector>
+
+namespace DelphiX {
+namespace indexer {
+
+ /*
+  * LoserTree is the tournament tree selecting the lowest of the sources being
+  * merged: the inner nodes keep the losers of the matches, so the source which
+  * value was changed replays only the matches on its path to the root, which
+  * takes log(n) comparisons instead of n ones by the linear scan.
+  *
+  * For a few sources the linear scan is faster than replaying the matches, so
+  * up to linearMax sources are scanned and the tree is not built.
+  *
+  * Less( i, j ) compares the current values of the sources i and j; it has to
+  * place the exhausted sources after all the other ones.  The sources with the
+  * equal values are selected in the order of their indices.
+  */
+  template <class Less>
+  class LoserTree
+  {
+    enum: size_t {  linearMax = 4  };
+
+  public:
+    LoserTree( size_t count, Less less );
+
+    auto  Top() const -> size_t {  return losers.front();  }
+    void  Update();
+
+  protected:
+    bool  Beats( size_t a, size_t b ) const
+      {  return lessThan( a, b ) || (!lessThan( b, a ) && a < b);  }
+    auto  Scan() const -> size_t;
+
+  protected:
+    Less                lessThan;
+    std::vector<size_t> losers;     // [0] is the winner, [1..n) are the matches
+
+  };
+
+  // LoserTree implementation
+
+  template <class Less>
+  LoserTree<Less>::LoserTree( size_t count, Less less ):
+    lessThan( less ),
+    losers( count != 0 ? count : 1, 0 )
+  {
+    auto  winner = std::vector<size_t>();
+
+    if ( count <= linearMax )
+    {
+      losers.front() = Scan();
+      return;
+    }
+
+    winner.resize( 2 * count );
+
+  // the leaves are placed to [count..2*count), the matches are played bottom-up
+    for ( size_t i = 0; i != count; ++i )
+      winner[count + i] = i;
+
+    for ( auto node = count - 1; node != 0 && node < count; --node )
+    {
+      auto  l = winner[node * 2];
+      auto  r = winner[node * 2 + 1];
+
+      if ( Beats( r, l ) ) winner[node] = r, losers[node] = l;
+        else winner[node] = l, losers[node] = r;
+    }
+
+    if ( count > 1 )
+      losers.front() = winner[1];
+  }
+
+ /*
+  * Update()
+  *
+  * Replays the matches of the current winner after its value was changed.
+  */
+  template <class Less>
+  void  LoserTree<Less>::Update()
+  {
+    auto  winner = losers.front();
+
+    if ( losers.size() <= linearMax )
+    {
+      losers.front() = Scan();
+      return;
+    }
+
+    for ( auto node = (winner + losers.size()) / 2; node != 0; node /= 2 )
+      if ( Beats( losers[node], winner ) )
+        std::swap( losers[node], winner );
+
+    losers.front() = winner;
+  }
+
+ /*
+  * Scan()
+  *
+  * Returns the lowest source by the linear scan; the first one of the equal
+  * sources is kept, so one comparison per source is enough.
+  */
+  template <class Less>
+  auto  LoserTree<Less>::Scan() const -> size_t
+  {
+    auto  winner = size_t(0);
+
+    for ( size_t i = 1; i < losers.size(); ++i )
+      if ( lessThan( i, winner ) )
+        winner = i;
+
+    return winner;
+  }
+
+}}
+
+# endif   // !__DelphiX_src_indexer_loser_tree_hxx__
@@ -0,0 +1,223 @@
+# include "../../indexer/merge-policy.hpp"
+# include <algorithm>
+# include <vector>
+
+namespace DelphiX {
+namespace indexer {
+namespace merge {
+
+  using Layer = IMergePolicy::Layer;
+  using Range = std::pair<size_t, size_t>;
+
+  class TieredPolicy final: public IMergePolicy
+  {
+    implement_lifetime_control
+
+  public:
+    TieredPolicy( const Tiered& tiered ): settings( tiered ) {}
+
+  public:
+    auto  Select( const Layer*, size_t ) const -> Range override;
+    auto  WriteAmplification() const -> double override;
+
+  protected:
+    auto  GetSize( const Layer& layer ) const -> uint64_t
+      {  return std::max( layer.stats.cbStored, settings.floorSize );  }
+    auto  GetTier( const Layer& ) const -> uint32_t;
+
+  protected:
+    const Tiered  settings;
+
+  };
+
+  class LeveledPolicy final: public IMergePolicy
+  {
+    implement_lifetime_control
+
+  public:
+    LeveledPolicy( const Leveled& leveled ): settings( leveled ) {}
+
+  public:
+    auto  Select( const Layer*, size_t ) const -> Range override;
+    auto  WriteAmplification() const -> double override;
+
+  protected:
+    auto  GetSize( const Layer& layer ) const -> uint64_t
+      {  return std::max( layer.stats.cbStored, settings.floorSize );  }
+
+  protected:
+    const Leveled settings;
+
+  };
+
+ /*
+  * SelectReclaim( layers, count, percent )
+  *
+  * Selects the layer having the largest share of deleted entities if the share
+  * reaches the percent passed.
+  */
+  static  auto  SelectReclaim( const Layer* layers, size_t count, uint32_t percent ) -> Range
+  {
+    auto  select = Range{ 0, 0 };
+    auto  srange = 0.0;
+
+    if ( percent != 0 )
+      for ( size_t i = 0; i != count; ++i )
+        if ( layers[i].canMerge && layers[i].stats.nCount != 0 )
+        {
+          auto  crange = layers[i].stats.nDeleted * 100.0 / layers[i].stats.nCount;
+
+          if ( crange >= percent && crange > srange )
+            select = { i, i + 1 }, srange = crange;
+        }
+
+    return select;
+  }
+
+ /*
+  * GetLevels( floor, target, ratio )
+  *
+  * Returns the count of levels between the floor and the target sizes growing
+  * by ratio times.
+  */
+  static  auto  GetLevels( uint64_t floor, uint64_t target, uint32_t ratio ) -> uint32_t
+  {
+    auto  nlevel = uint32_t(0);
+
+    for ( auto size = std::max( floor, uint64_t(1) ); size < target; size *= std::max( ratio, 2U ) )
+      ++nlevel;
+
+    return nlevel;
+  }
+
+  // TieredPolicy implementation
+
+ /*
+  * Select()
+  *
+  * Reclaims the layer with too many deleted entities, else searches the tiers
+  * having maxSegments or more adjacent layers and merges up to maxMergeAtOnce
+  * smallest layers of the lowest tier found.
+  */
+  auto  TieredPolicy::Select( const Layer* layers, size_t count ) const -> Range
+  {
+    auto  select = SelectReclaim( layers, count, settings.deletedPercent );
+    auto  stier = uint32_t(-1);
+    auto  ltiers = std::vector<uint32_t>();
+
+    if ( select.first != select.second )
+      return select;
+
+  // the layers too large to be merged are out of tiers
+    for ( size_t i = 0; i != count; ++i )
+    {
+      ltiers.push_back( layers[i].canMerge && GetSize( layers[i] ) < settings.targetSize / 2 ?
+        GetTier( layers[i] ) : uint32_t(-1) );
+    }
+
+    for ( size_t from = 0, to; from != count; from = to )
+    {
+      auto  nfirst = size_t(0);
+      auto  ntotal = uint64_t(0);
+
+      for ( to = from + 1; to != count && ltiers[to] == ltiers[from]; ++to )
+        (void)NULL;
+
+      if ( ltiers[from] == uint32_t(-1) || ltiers[from] >= stier || to - from < std::max( settings.maxSegments, 2U ) )
+        continue;
+
+      for ( nfirst = to; nfirst != from && to - nfirst < settings.maxMergeAtOnce
+        && ntotal + GetSize( layers[nfirst - 1] ) <= settings.targetSize; )
+          ntotal += GetSize( layers[--nfirst] );
+
+      if ( to - nfirst >= 2 )
+        select = { nfirst, to }, stier = ltiers[from];
+    }
+    return select;
+  }
+
+  auto  TieredPolicy::WriteAmplification() const -> double
+  {
+    return 1.0 + GetLevels( settings.floorSize, settings.targetSize, settings.maxSegments );
+  }
+
+  auto  TieredPolicy::GetTier( const Layer& layer ) const -> uint32_t
+  {
+    auto  ltsize = GetSize( layer );
+    auto  lratio = std::max( settings.maxSegments, 2U );
+    auto  ntier = uint32_t(0);
+
+    for ( auto upper = settings.floorSize * lratio; ltsize >= upper && ntier != 63; upper *= lratio )
+      ++ntier;
+
+    return ntier;
+  }
+
+  // LeveledPolicy implementation
+
+ /*
+  * Select()
+  *
+  * Reclaims the layer with too many deleted entities, else for each run of the
+  * adjacent layers to be merged collects the smallest ones violating the level
+  * ratio, i.e. each layer larger than fanout times all the smaller together.
+  *
+  * The collected layers are merged if there are more than maxSegments ones or
+  * if a layer above the first level is violated; the cheapest merge is selected.
+  */
+  auto  LeveledPolicy::Select( const Layer* layers, size_t count ) const -> Range
+  {
+    auto  select = SelectReclaim( layers, count, settings.deletedPercent );
+    auto  stotal = uint64_t(-1);
+    auto  canMerge = [&]( size_t i ){  return layers[i].canMerge && GetSize( layers[i] ) < settings.targetSize;  };
+
+    if ( select.first != select.second )
+      return select;
+
+    for ( size_t from = 0, to; from != count; from = to )
+    {
+      auto  nfirst = size_t(0);
+      auto  ntotal = uint64_t(0);
+
+      if ( !canMerge( to = from ) )
+        {  ++to;  continue;  }
+
+      while ( to != count && canMerge( to ) )
+        ++to;
+
+      for ( nfirst = to; nfirst != from && (ntotal == 0 || GetSize( layers[nfirst - 1] ) < ntotal * settings.fanout); )
+        ntotal += GetSize( layers[--nfirst] );
+
+      while ( to - nfirst > 1 && ntotal > settings.targetSize )
+        ntotal -= GetSize( layers[nfirst++] );
+
+      if ( to - nfirst < 2 || ntotal >= stotal )
+        continue;
+
+      if ( to - nfirst > settings.maxSegments || GetSize( layers[nfirst] ) >= settings.floorSize * settings.fanout )
+        select = { nfirst, to }, stotal = ntotal;
+    }
+    return select;
+  }
+
+  auto  LeveledPolicy::WriteAmplification() const -> double
+  {
+    return 1.0 + GetLevels( settings.floorSize, settings.targetSize, settings.fanout )
+      * (std::max( settings.fanout, 2U ) + 1) / 2.0;
+  }
+
+  // Tiered implementation
+
+  auto  Tiered::Create() const -> mtc::api<IMergePolicy>
+  {
+    return new TieredPolicy( *this );
+  }
+
+  // Leveled implementation
+
+  auto  Leveled::Create() const -> mtc::api<IMergePolicy>
+  {
+    return new LeveledPolicy( *this );
+  }
+
+}}}
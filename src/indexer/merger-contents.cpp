@@ -1,6 +1,7 @@
 # include "merger-contents.hpp"
 # include "contents-index-merger.hpp"
 # include "../../indexer/static-contents.hpp"
+# include "../../indexer/executor.hpp"
 # include "override-entities.hpp"
 # include "index-layers.hpp"
 # include "patch-table.hpp"
@@ -9,7 +10,7 @@
 # include <condition_variable>
 # include <shared_mutex>
 # include <stdexcept>
-# include <thread>
+# include <atomic>
 
 namespace DelphiX {
 namespace indexer {
@@ -45,10 +46,8 @@ namespace fusion  {
     auto  GetKeyBlock( const std::string_view& ) const -> mtc::api<IEntities> override;
     auto  GetKeyStats( const std::string_view& ) const -> BlockInfo override;
 
-    auto  ListEntities( EntityId ) -> mtc::api<IEntitiesList> override
-      {  throw std::runtime_error( "not implemented @" __FILE__ ":" LINE_STRING );  }
-    auto  ListEntities( uint32_t ) -> mtc::api<IEntitiesList> override
-      {  throw std::runtime_error( "not implemented @" __FILE__ ":" LINE_STRING );  }
+    auto  ListEntities( EntityId ) -> mtc::api<IEntitiesList> override;
+    auto  ListEntities( uint32_t ) -> mtc::api<IEntitiesList> override;
     auto  ListContents( const std::string_view& ) -> mtc::api<IContentsList> override;
 
     auto  Commit() -> mtc::api<IStorage::ISerialized> override;
@@ -57,7 +56,7 @@ namespace fusion  {
     void  Stash( EntityId ) override  {}
 
   protected:
-    void  MergerThreadFunc();
+    void  MergerTask();
 
   protected:
     mutable std::shared_mutex     swLock;   // switch mutex
@@ -72,7 +71,8 @@ namespace fusion  {
     Bitmap<>                      banset;
     mutable PatchTable<>          hpatch;
 
-    std::thread                   thread;
+    bool                          active = false;   // the merger task is queued or run
+    std::atomic<bool>             patched = false;  // the entities changed while merged
     std::exception_ptr            except;
 
   };
@@ -90,20 +90,27 @@ namespace fusion  {
 
   ContentsIndex::~ContentsIndex()
   {
-    if ( thread.joinable() )
-      thread.join();
+    auto  exlock = mtc::make_unique_lock( s_lock );
+
+    if ( Executor::Get().Cancel( this ) == 0 )
+      s_wait.wait( exlock, [&](){  return !active;  } );
   }
 
   auto  ContentsIndex::StartMerger() -> mtc::api<IContentsIndex>
   {
-    thread = std::thread( &ContentsIndex::MergerThreadFunc, this );
+    active = true;
+    Executor::Get().Run( Executor::merge, this, [this](){  MergerTask();  } );
     return this;
   }
 
-  void  ContentsIndex::MergerThreadFunc()
+ /*
+  * MergerTask()
+  *
+  * Merges the layers to the new static index in the executor thread and then
+  * notifies the owner; the destructor waits until the task is marked finished.
+  */
+  void  ContentsIndex::MergerTask()
   {
-    pthread_setname_np( pthread_self(), "merger::Thread" );
-
     for ( auto& next: layers )
       merger.Add( next.pIndex );
 
@@ -128,14 +135,26 @@ namespace fusion  {
       if ( notify != nullptr )
         notify( this, Notify::Event::OK );
     }
+  // the sources are not changed by the merge; if the entities were not patched
+  // either, the merge is canceled and the owner may restore the sources
     catch ( ... )
     {
+      auto  exlock = mtc::make_unique_lock( swLock );
+      auto  pevent = patched ? Notify::Event::Failed : Notify::Event::Canceled;
+
       except = std::current_exception();
-        s_wait.notify_all();
+        exlock.unlock();
+      s_wait.notify_all();
 
       if ( notify != nullptr )
-        notify( this, Notify::Event::Failed );
+        notify( this, pevent );
     }
+
+    mtc::interlocked( mtc::make_unique_lock( s_lock ), [&]()
+      {
+        active = false;
+        s_wait.notify_all();
+      } );
   }
 
   auto  ContentsIndex::GetEntity( EntityId id ) const -> mtc::api<const IEntity>
@@ -202,6 +221,7 @@ namespace fusion  {
       if ( (ppatch = hpatch.Search( { id.data(), id.size() } )) == nullptr || ppatch->GetLen() != size_t(-1) )
       {
         hpatch.Delete( { id.data(), id.size() }, entity->GetIndex() );
+        patched = true;
         banset.Set( entity->GetIndex() );
         return true;
       }
@@ -234,6 +254,8 @@ namespace fusion  {
       if ( (ppatch = hpatch.Search( { id.data(), id.size() } )) != nullptr && ppatch->GetLen() == size_t(-1) )
         return nullptr;
 
+      patched = true;
+
       return hpatch.Update( { id.data(), id.size() }, entity->GetIndex(), xtra )->GetLen() != size_t(-1) ?
         GetEntity( id ) : nullptr;
     }
@@ -277,6 +299,32 @@ namespace fusion  {
     return output != nullptr ? output->GetKeyStats( key ) : getKeyStats( key );
   }
 
+  auto  ContentsIndex::ListEntities( EntityId id ) -> mtc::api<IEntitiesList>
+  {
+    auto  shlock = mtc::make_shared_lock( swLock );
+
+    if ( except != nullptr )
+      std::rethrow_exception( except );
+
+    if ( output != nullptr )
+      return output->ListEntities( id );
+
+    return new Override::EntitiesList<PatchTable<>>( listEntities( id, this ), hpatch, this );
+  }
+
+  auto  ContentsIndex::ListEntities( uint32_t ix ) -> mtc::api<IEntitiesList>
+  {
+    auto  shlock = mtc::make_shared_lock( swLock );
+
+    if ( except != nullptr )
+      std::rethrow_exception( except );
+
+    if ( output != nullptr )
+      return output->ListEntities( ix );
+
+    return new Override::EntitiesList<PatchTable<>>( listEntities( ix, this ), hpatch, this );
+  }
+
   auto  ContentsIndex::ListContents( const std::string_view& key ) -> mtc::api<IContentsList>
   {
     return listContents( key, MakeObjectHolder( mtc::api( (const Iface*)this ),
@@ -299,8 +347,9 @@ namespace fusion  {
   auto  ContentsIndex::Reduce() -> mtc::api<IContentsIndex>
   {
   // wait until the merger completes
-    if ( thread.joinable() )
-      thread.join();
+    auto  exlock = mtc::make_unique_lock( s_lock );
+      s_wait.wait( exlock, [&](){  return !active;  } );
+    exlock.unlock();
 
     if ( except != nullptr )
       std::rethrow_exception( except );
@@ -335,6 +384,11 @@ namespace fusion  {
     outputStore = px;  return *this;
   }
 
+  auto  Contents::Set( mtc::api<IRateLimiter> pl ) -> Contents&
+  {
+    ioLimiter = pl;  return *this;
+  }
+
   auto  Contents::Set( const mtc::api<IContentsIndex>* pp, size_t cc ) -> Contents&
   {
     indexVector.clear();
@@ -356,12 +410,19 @@ namespace fusion  {
     return *this;
   }
 
+  auto  Contents::SetThreads( unsigned nt ) -> Contents&
+  {
+    nThreads = nt;  return *this;
+  }
+
   auto  Contents::Create() -> mtc::api<IContentsIndex>
   {
     return (new ContentsIndex( indexVector, std::move( ContentsMerger()
       .Set( indexVector )
       .Set( canContinue )
-      .Set( outputStore ) ), notifyEvent ))->StartMerger();
+      .Set( ioLimiter )
+      .Set( outputStore )
+      .SetThreads( nThreads ) ), notifyEvent ))->StartMerger();
   }
 
 }}}
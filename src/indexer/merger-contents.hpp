@@ -1,6 +1,7 @@
 # if !defined( __DelphiX_src_indexer_merger_contents_hxx__ )
 # define __DelphiX_src_indexer_merger_contents_hxx__
 # include "../../contents.hpp"
+# include "../../indexer/rate-limiter.hpp"
 # include "notify-events.hpp"
 
 namespace DelphiX {
@@ -13,6 +14,8 @@ namespace fusion {
     Notify::Func                          notifyEvent;
     std::function<bool()>                 canContinue;
     mtc::api<IStorage::IIndexStore>       outputStore;
+    mtc::api<IRateLimiter>                ioLimiter;
+    unsigned                              nThreads = 1;
 
   public:
     auto  Add( const mtc::api<IContentsIndex> ) -> Contents&;
@@ -20,9 +23,11 @@ namespace fusion {
     auto  Set( Notify::Func ) -> Contents&;
     auto  Set( std::function<bool()> ) -> Contents&;
     auto  Set( mtc::api<IStorage::IIndexStore> ) -> Contents&;
+    auto  Set( mtc::api<IRateLimiter> ) -> Contents&;
     auto  Set( const mtc::api<IContentsIndex>*, size_t ) -> Contents&;
     auto  Set( const std::vector<mtc::api<IContentsIndex>>& ) -> Contents&;
     auto  Set( const std::initializer_list<mtc::api<IContentsIndex>>& ) -> Contents&;
+    auto  SetThreads( unsigned ) -> Contents&;
 
     auto  Create() -> mtc::api<IContentsIndex>;
   };
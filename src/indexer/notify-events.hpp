@@ -12,7 +12,8 @@ namespace DelphiX {
       OK = 1,
       Empty = 2,
       Canceled = 3,
-      Failed = 4
+      Failed = 4,
+      Filled = 5      // dynamic index has passed the soft mark
     };
 
     using Func = std::function<void(void*, Event)>;
@@ -21,6 +21,7 @@ namespace indexer {
     auto  GetExtra() const -> mtc::api<const mtc::IByteBuffer> override {  return entity->GetExtra();  }
     auto  GetBundle() const -> mtc::api<const mtc::IByteBuffer> override {  return entity->GetBundle();  }
     auto  GetVersion() const -> uint64_t override {  return entity->GetVersion();  }
+    auto  GetPackage() const -> std::pair<mtc::api<IStorage::IDumpStore>, int64_t> override {  return entity->GetPackage();  }
 
   };
 
@@ -42,6 +43,7 @@ namespace indexer {
     auto  GetExtra() const -> mtc::api<const mtc::IByteBuffer> override {  return aprops;  }
     auto  GetBundle() const -> mtc::api<const mtc::IByteBuffer> override {  return entity->GetBundle();  }
     auto  GetVersion() const -> uint64_t override {  return entity->GetVersion();  }
+    auto  GetPackage() const -> std::pair<mtc::api<IStorage::IDumpStore>, int64_t> override {  return entity->GetPackage();  }
 
   };
 
@@ -65,6 +67,7 @@ namespace indexer {
     auto  GetExtra() const -> mtc::api<const mtc::IByteBuffer> override {  return entity->GetExtra();  }
     auto  GetBundle() const -> mtc::api<const mtc::IByteBuffer> override {  return istore->Get( getpos );  }
     auto  GetVersion() const -> uint64_t override {  return entity->GetVersion();  }
+    auto  GetPackage() const -> std::pair<mtc::api<IStorage::IDumpStore>, int64_t> override {  return { istore, getpos };  }
 
   };
 
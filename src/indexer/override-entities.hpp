@@ -10,6 +10,8 @@ namespace indexer {
   {
     class Entity;
     class Entities;
+    template <class Patches>
+    class EntitiesList;
   };
 
   class Override::Entity
@@ -42,6 +44,45 @@ namespace indexer {
 
   };
 
+ /*
+  * Override::EntitiesList applies the patches of the entities changed while the
+  * index is committed or merged to the entities listed: the deleted ones are
+  * skipped, the extras of the other ones are replaced.
+  */
+  template <class Patches>
+  class Override::EntitiesList final: public IContentsIndex::IEntitiesList
+  {
+    mtc::api<IContentsIndex::IEntitiesList> entities;
+    const Patches&                          patchTab;
+    mtc::api<const mtc::Iface>              lifetime;
+
+    implement_lifetime_control
+
+  public:
+    EntitiesList( mtc::api<IContentsIndex::IEntitiesList> list, const Patches& patches, const mtc::Iface* owner ):
+      entities( list ),
+      patchTab( patches ),
+      lifetime( owner ) {}
+
+  public:
+    auto  Curr() -> mtc::api<const IEntity> override  {  return Select( entities->Curr() );  }
+    auto  Next() -> mtc::api<const IEntity> override  {  return Select( entities->Next() );  }
+
+  protected:
+    auto  Select( mtc::api<const IEntity> entity ) -> mtc::api<const IEntity>
+    {
+      for ( auto ppatch = mtc::api<const mtc::IByteBuffer>(); entity != nullptr; entity = entities->Next() )
+      {
+        if ( (ppatch = patchTab.Search( entity->GetIndex() )) == nullptr )
+          return entity;
+        if ( ppatch->GetLen() != size_t(-1) )
+          return Override::Entity( entity ).Extra( ppatch );
+      }
+      return nullptr;
+    }
+
+  };
+
 }}
 
 # endif   // !__DelphiX_src_indexer_override_entities_hxx__
@@ -0,0 +1,205 @@
+# include "../../indexer/rate-limiter.hpp"
+# include "io-throttle.hpp"
+# include <algorithm>
+# include <thread>
+# include <mutex>
+
+namespace DelphiX {
+namespace indexer {
+namespace io {
+
+  class TokenBucketLimiter final: public IRateLimiter
+  {
+    using Clock = std::chrono::steady_clock;
+    using Micros = std::chrono::duration<double, std::micro>;
+
+    implement_lifetime_control
+
+  public:
+    TokenBucketLimiter( const TokenBucket& );
+
+  public:
+    void  Acquire( size_t ) override;
+    void  Feedback( std::chrono::microseconds ) override;
+    auto  GetStats() const -> Stats override;
+
+  protected:
+    const TokenBucket settings;
+    const double      minrate;
+
+    mutable std::mutex  mxlock;
+    double              cbrate;       // current rate, bytes per second
+    double              cbavail;      // tokens available, negative while in debt
+    Clock::time_point   tmfill;       // last refill of tokens
+    double              avglat = 0;   // averaged latency reported, microseconds
+    Clock::time_point   tmtune;       // last rate change
+
+    uint64_t            cbtotal = 0;
+    uint64_t            cbwnext = 0;  // bytes passed in the current window
+    Clock::time_point   tmwnext;      // current window start
+    uint64_t            cbwlast = 0;  // throughput of the last window
+
+  };
+
+  class ThrottledStream final: public mtc::IByteStream
+  {
+    implement_lifetime_control
+
+  public:
+    ThrottledStream( mtc::api<mtc::IByteStream> s, mtc::api<IRateLimiter> l ):
+      stream( s ),
+      charge( l ) {}
+
+  public:
+    uint32_t  Get( void* p, uint32_t l ) override
+      {  return charge( l ), stream->Get( p, l );  }
+    uint32_t  Put( const void* p, uint32_t l ) override
+      {  return charge( l ), stream->Put( p, l );  }
+
+  protected:
+    mtc::api<mtc::IByteStream>  stream;
+    Charger                     charge;
+
+  };
+
+  class ThrottledStore final: public IStorage::IIndexStore
+  {
+    implement_lifetime_control
+
+  public:
+    ThrottledStore( mtc::api<IStorage::IIndexStore> s, mtc::api<IRateLimiter> l ):
+      store( s ),
+      rlimit( l ) {}
+
+  public:
+    auto  Entities() -> mtc::api<mtc::IByteStream> override {  return Wrap( store->Entities() );  }
+    auto  Contents() -> mtc::api<mtc::IByteStream> override {  return Wrap( store->Contents() );  }
+    auto  Linkages() -> mtc::api<mtc::IByteStream> override {  return Wrap( store->Linkages() );  }
+    auto  Packages() -> mtc::api<IStorage::IDumpStore> override {  return store->Packages();  }
+    auto  Spillage() -> mtc::api<IStorage::IDumpStore> override {  return store->Spillage();  }
+    void  Supersede( mtc::api<IStorage::ISerialized> s ) override {  store->Supersede( s );  }
+
+    auto  Commit() -> mtc::api<IStorage::ISerialized> override {  return store->Commit();  }
+    void  Remove() override {  store->Remove();  }
+
+  protected:
+    auto  Wrap( mtc::api<mtc::IByteStream> stream ) -> mtc::api<mtc::IByteStream>
+      {  return stream != nullptr ? new ThrottledStream( stream, rlimit ) : nullptr;  }
+
+  protected:
+    mtc::api<IStorage::IIndexStore> store;
+    mtc::api<IRateLimiter>          rlimit;
+
+  };
+
+  // TokenBucketLimiter implementation
+
+  TokenBucketLimiter::TokenBucketLimiter( const TokenBucket& bucket ):
+    settings( bucket ),
+    minrate( std::max( bucket.minBytesPerSec != 0 ? bucket.minBytesPerSec : bucket.bytesPerSec / 16, uint64_t(1) ) ),
+    cbrate( double(bucket.bytesPerSec) ),
+    cbavail( double(bucket.burstSize) ),
+    tmfill( Clock::now() ),
+    tmtune( Clock::time_point() ),
+    tmwnext( tmfill ) {}
+
+ /*
+  * Acquire( cbsize )
+  *
+  * Takes the tokens for the bytes passed; if there is not enough tokens, the
+  * debt is taken and the caller sleeps until it is paid, so the concurrent
+  * callers are queued by the debt taken before them.
+  */
+  void  TokenBucketLimiter::Acquire( size_t cbsize )
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxlock );
+    auto  tmnow = Clock::now();
+
+  // count the throughput by one-second windows
+    if ( tmnow - tmwnext >= std::chrono::seconds( 1 ) )
+    {
+      cbwlast = uint64_t(cbwnext * 1000000.0 / Micros( tmnow - tmwnext ).count());
+      cbwnext = 0;
+      tmwnext = tmnow;
+    }
+    cbtotal += cbsize;
+    cbwnext += cbsize;
+
+    if ( settings.bytesPerSec == 0 )
+      return;
+
+  // no latency reported for a second means no foreground load, so restore the
+  // rate by the steps Feedback() would make, and forget the latency averaged
+    if ( settings.targetLatency.count() != 0 && cbrate < settings.bytesPerSec && tmnow - tmtune >= std::chrono::seconds( 1 ) )
+    {
+      auto  nsteps = (tmnow - tmtune) / std::chrono::milliseconds( 100 );
+
+      cbrate = std::min( cbrate + nsteps * settings.bytesPerSec / 16.0, double(settings.bytesPerSec) );
+      avglat = 0;
+      tmtune = tmnow;
+    }
+
+  // refill the bucket and take the tokens
+    cbavail = std::min( double(settings.burstSize), cbavail + cbrate * Micros( tmnow - tmfill ).count() / 1000000.0 );
+    tmfill = tmnow;
+
+    if ( (cbavail -= cbsize) >= 0 )
+      return;
+
+    auto  tmwait = Micros( -cbavail * 1000000.0 / cbrate );
+
+    exlock.unlock();
+      std::this_thread::sleep_for( tmwait );
+  }
+
+  void  TokenBucketLimiter::Feedback( std::chrono::microseconds latency )
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxlock );
+    auto  tmnow = Clock::now();
+
+    if ( settings.bytesPerSec == 0 || settings.targetLatency.count() == 0 )
+      return;
+
+    avglat = avglat > 0 ? avglat + (latency.count() - avglat) / 8 : double(latency.count());
+
+  // change the rate not more often than 10 times per second, so the latency
+  // has time to react
+    if ( tmnow - tmtune < std::chrono::milliseconds( 100 ) )
+      return;
+
+    if ( avglat > settings.targetLatency.count() )
+      cbrate = std::max( cbrate / 2, minrate );
+    else
+      cbrate = std::min( cbrate + settings.bytesPerSec / 16.0, double(settings.bytesPerSec) );
+
+    tmtune = tmnow;
+  }
+
+  auto  TokenBucketLimiter::GetStats() const -> Stats
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxlock );
+    auto  tmnow = Clock::now();
+    auto  cbrecent = cbwlast;
+
+  // the current window is complete if nothing passed for a second
+    if ( tmnow - tmwnext >= std::chrono::seconds( 1 ) )
+      cbrecent = uint64_t(cbwnext * 1000000.0 / Micros( tmnow - tmwnext ).count());
+
+    return { cbtotal, cbrecent, uint64_t(settings.bytesPerSec != 0 ? cbrate : 0) };
+  }
+
+  // TokenBucket implementation
+
+  auto  TokenBucket::Create() const -> mtc::api<IRateLimiter>
+  {
+    return new TokenBucketLimiter( *this );
+  }
+
+  auto  Throttle( mtc::api<IStorage::IIndexStore> store, mtc::api<IRateLimiter> limiter ) -> mtc::api<IStorage::IIndexStore>
+  {
+    if ( store != nullptr && limiter != nullptr )
+      return new ThrottledStore( store, limiter );
+    return store;
+  }
+
+}}}
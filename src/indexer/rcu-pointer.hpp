@@ -0,0 +1,112 @@
+# if !defined( __DelphiX_src_indexer_rcu_pointer_hxx__ )
+# define __DelphiX_src_indexer_rcu_pointer_hxx__
+# include <mtc/interfaces.h>
+# include <cstddef>
+# include <atomic>
+# include <thread>
+# include <mutex>
+
+namespace DelphiX {
+namespace indexer {
+
+ /*
+  * RcuPointer publishes the reference-counted object to the readers without
+  * any locks: the reader enters the current generation in its own slot, takes
+  * the reference and leaves, so no cache line is shared by all the readers.
+  *
+  * The writer replaces the object, switches the generation and waits for the
+  * readers that could have loaded the previous pointer but have not referenced
+  * it yet; then the previous object is released.  The writers are serialized.
+  */
+  template <class T>
+  class RcuPointer
+  {
+    enum: size_t
+    {
+      slot_count = 64
+    };
+
+    struct alignas(64) ReadSlot
+    {
+      std::atomic<uint32_t> active[2] = { 0, 0 };
+    };
+
+  public:
+    RcuPointer( mtc::api<T> p = nullptr ):
+      holder( p ),
+      pvalue( p.ptr() ) {}
+    RcuPointer( const RcuPointer& ) = delete;
+    RcuPointer& operator=( const RcuPointer& ) = delete;
+
+  public:
+    auto  Get() const -> mtc::api<T>;
+    void  Set( mtc::api<T> );
+
+  protected:
+    static  auto  ThreadSlot() -> size_t;
+
+  protected:
+    mtc::api<T>               holder;       // the reference of the published object
+    std::atomic<T*>           pvalue;
+    std::atomic<uint64_t>     rcugen = 0;
+    mutable ReadSlot          readers[slot_count];
+    std::mutex                wrlock;
+
+  };
+
+  // RcuPointer template implementation
+
+ /*
+  * RcuPointer::Get()
+  *
+  * Enters the generation and checks it did not change before the pointer is
+  * loaded, else the writer may not see the reader in the slot.
+  */
+  template <class T>
+  auto  RcuPointer<T>::Get() const -> mtc::api<T>
+  {
+    auto& rdslot = readers[ThreadSlot()];
+    auto  result = mtc::api<T>();
+
+    for ( auto rcgen = rcugen.load(); ; rcgen = rcugen.load() )
+    {
+      auto& active = rdslot.active[rcgen & 1];
+
+      ++active;
+
+      if ( rcugen.load() == rcgen )
+        return result = pvalue.load(), --active, result;
+
+      --active;
+    }
+  }
+
+  template <class T>
+  void  RcuPointer<T>::Set( mtc::api<T> p )
+  {
+    auto  exlock = std::unique_lock<std::mutex>( wrlock );
+    auto  expire = holder;
+    auto  rcgen = uint64_t{};
+
+    pvalue.store( (holder = p).ptr() );
+
+  // switch the generation and wait for the readers of the previous one
+    rcgen = rcugen++;
+
+    for ( auto& next: readers )
+      while ( next.active[rcgen & 1].load() != 0 )
+        std::this_thread::yield();
+  }
+
+  template <class T>
+  auto  RcuPointer<T>::ThreadSlot() -> size_t
+  {
+    static std::atomic<size_t>  nslots = 0;
+    thread_local size_t         myslot = nslots++ % slot_count;
+
+    return myslot;
+  }
+
+}}
+
+# endif   // !__DelphiX_src_indexer_rcu_pointer_hxx__
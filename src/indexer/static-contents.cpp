@@ -62,6 +62,9 @@ namespace static_ {
 
     void  Stash( EntityId ) override;
 
+    auto  GetIndexStats() const -> IndexStats override
+      {  return { entities.GetEntityCount(), nDeleted.load(), cbStored };  }
+
   protected:
     bool  delEntity( EntityId, uint32_t );
 
@@ -75,6 +78,8 @@ namespace static_ {
     mtc::api<IFlatStream>       blockBox;
     PatchHolder                 patchTab;
     Bitmap<Allocator>           shadowed;       // deleted documents identifiers
+    std::atomic<uint32_t>       nDeleted = 0;
+    uint64_t                    cbStored;
 
   };
 
@@ -86,6 +91,7 @@ namespace static_ {
   public:     // overridables
     auto  Size() const -> uint32_t override {  return ncount;  }
     auto  Type() const -> uint32_t override {  return bkType;  }
+    auto  GetBlock() const -> std::string_view override;
 
   protected:
     const uint32_t                    bkType;
@@ -165,7 +171,8 @@ namespace static_ {
     contents( radixBuf->GetPtr() ),
     blockBox( storage->Linkages() ),
     patchTab( std::max( 1000U, entities.GetEntityCount() ), memArena.get_allocator<char>() ),
-    shadowed( entities.GetEntityCount(), memArena.get_allocator<char>() )
+    shadowed( entities.GetEntityCount(), memArena.get_allocator<char>() ),
+    cbStored( tableBuf->GetLen() + radixBuf->GetLen() + blockBox->Size() )
   {
   }
 
@@ -305,14 +312,16 @@ namespace static_ {
   {
     auto  getdoc = entities.GetEntity( id );
 
-    if ( getdoc != nullptr )
-      shadowed.Set( getdoc->index );
+    if ( getdoc != nullptr && !shadowed.Get( getdoc->index ) )
+      shadowed.Set( getdoc->index ), ++nDeleted;
   }
 
   bool  ContentsIndex::delEntity( EntityId id, uint32_t index )
   {
     patchTab.Delete( { id.data(), id.size() }, index );
-    shadowed.Set( index );
+
+    if ( !shadowed.Get( index ) )
+      shadowed.Set( index ), ++nDeleted;
     return true;
   }
 
@@ -332,6 +341,19 @@ namespace static_ {
   {
   }
 
+ /*
+  * GetBlock()
+  *
+  * The rich blocks skip the deleted entities in Find(), so the blocks are
+  * returned as is only by the index having no deletions.
+  */
+  auto  ContentsIndex::EntitiesBase::GetBlock() const -> std::string_view
+  {
+    if ( parent->nDeleted.load() != 0 )
+      return {};
+    return { iblock->GetPtr(), iblock->GetLen() };
+  }
+
   // ContentsIndex::EntitiesLite implementation
 
   auto  ContentsIndex::EntitiesLite::Find( uint32_t tofind ) -> Reference
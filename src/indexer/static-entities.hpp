@@ -69,6 +69,8 @@ namespace static_ {
         {  return packPos != -1 && dumpStore != nullptr ? dumpStore->Get( packPos ) : nullptr;  }
       auto  GetVersion() const -> uint64_t override
         {  return version;  }
+      auto  GetPackage() const -> std::pair<mtc::api<IStorage::IDumpStore>, int64_t> override
+        {  return { packPos != -1 ? dumpStore : nullptr, packPos };  }
 
       bool  ValidIndex() const noexcept {  return index != 0 && index != uint32_t(-1);  }
       auto  GetPackPos() const -> int64_t  {  return packPos;  }
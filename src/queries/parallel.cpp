@@ -0,0 +1,129 @@
+# include "../../queries/parallel.hpp"
+# include <mtc/recursive_shared_mutex.hpp>
+# include <algorithm>
+# include <exception>
+# include <atomic>
+
+namespace DelphiX {
+namespace queries {
+
+  static  bool  RankedHigher( const Scored& s1, const Scored& s2 )
+  {
+    return s1.fRange > s2.fRange || (!(s1.fRange < s2.fRange) && s1.uEntity < s2.uEntity);
+  }
+
+ /*
+  * SearchPart( query, rank, topK )
+  *
+  * Keeps the best topK entities found by the query in the heap having the
+  * worst of them on the top.
+  */
+  static  auto  SearchPart( mtc::api<IQuery> query, const RankQuery& rank, size_t topK ) -> std::vector<Scored>
+  {
+    auto  scored = std::vector<Scored>();
+
+    if ( query == nullptr || topK == 0 )
+      return scored;
+
+    for ( auto docId = query->SearchDoc( 1 ); docId != uint32_t(-1); docId = query->SearchDoc( docId + 1 ) )
+    {
+      auto  result = Scored{ docId, rank( docId, query->GetTuples( docId ) ) };
+
+      if ( scored.size() < topK )
+      {
+        scored.push_back( result );
+        std::push_heap( scored.begin(), scored.end(), RankedHigher );
+      }
+        else
+      if ( RankedHigher( result, scored.front() ) )
+      {
+        std::pop_heap( scored.begin(), scored.end(), RankedHigher );
+        scored.back() = result;
+        std::push_heap( scored.begin(), scored.end(), RankedHigher );
+      }
+    }
+    return scored;
+  }
+
+  auto  SearchTopK(
+    const std::vector<mtc::api<IContentsIndex>>&  parts,
+    const MakeQuery&                              make,
+    const RankQuery&                              rank,
+    size_t                                        topK,
+    indexer::Executor&                            executor ) -> std::vector<Scored>
+  {
+    auto                    scored = std::vector<std::vector<Scored>>( parts.size() );
+    auto                    except = std::exception_ptr();
+    auto                    nextPart = std::atomic<size_t>( 0 );
+    auto                    nhelpers = parts.size() - std::min( parts.size(), size_t(1) );
+    auto                    nstopped = size_t(0);
+    auto                    output = std::vector<Scored>();
+    std::mutex              mxlock;
+    std::condition_variable mxwait;
+    auto                    search = [&]()
+      {
+        auto  failed = std::exception_ptr();
+
+        for ( auto i = nextPart++; i < parts.size() && failed == nullptr; i = nextPart++ )
+        {
+          try
+            {  scored[i] = SearchPart( make( parts[i] ), rank, topK );  }
+          catch ( ... )
+            {  failed = std::current_exception();  }
+        }
+
+        if ( failed != nullptr )
+          mtc::interlocked( mtc::make_unique_lock( mxlock ), [&]()
+            {
+              if ( except == nullptr )
+                except = failed;
+            } );
+      };
+
+    if ( parts.empty() )
+      return output;
+
+  // the helpers and the caller take the parts not started yet one by one, so
+  // the caller never waits for the helpers queued behind the other tasks
+    for ( size_t i = 0; i != nhelpers; ++i )
+    {
+      executor.Run( indexer::Executor::commit, &scored, [&]()
+        {
+          search();
+
+        // notify under the lock, the waiter destroys the syncro on return
+          mtc::interlocked( mtc::make_unique_lock( mxlock ), [&]()
+            {
+              ++nstopped;
+                mxwait.notify_all();
+            } );
+        } );
+    }
+
+    search();
+
+  // the helpers not started have nothing to do, the others finish their parts
+    nhelpers -= executor.Cancel( &scored );
+
+    {
+      auto  exwait = mtc::make_unique_lock( mxlock );
+
+      mxwait.wait( exwait, [&](){  return nstopped == nhelpers;  } );
+    }
+
+    if ( except != nullptr )
+      std::rethrow_exception( except );
+
+  // merge the results of the parts
+    for ( auto& next: scored )
+      output.insert( output.end(), next.begin(), next.end() );
+
+    std::sort( output.begin(), output.end(), RankedHigher );
+
+    if ( output.size() > topK )
+      output.resize( topK );
+
+    return output;
+  }
+
+}}
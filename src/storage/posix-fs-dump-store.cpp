@@ -1,6 +1,11 @@
 # include "posix-fs-dump-store.hpp"
+# include "../../compat.hpp"
 # include <mtc/recursive_shared_mutex.hpp>
 # include <mtc/byteBuffer.h>
+# include <stdexcept>
+# include <atomic>
+# include <cerrno>
+# include <fcntl.h>
 
 namespace DelphiX {
 namespace storage {
@@ -11,24 +16,41 @@ namespace posixFS {
     implement_lifetime_control
 
   public:
-    DumpStore( const mtc::api<mtc::IFlatStream>& fl ): file( fl ) {}
+    DumpStore( const mtc::api<mtc::IFlatStream>& fl, const std::string& fp ): file( fl ), path( fp ) {}
+   ~DumpStore();
 
     auto  Get( int64_t ) const -> mtc::api<const mtc::IByteBuffer> override;
     auto  Put( const void*, size_t ) -> int64_t override;
+    auto  Copy( const IDumpStore*, int64_t ) -> std::pair<int64_t, size_t> override;
+
+  protected:
+    auto  GetHandle( int&, int ) const -> int;
 
   protected:
     mtc::api<mtc::IFlatStream>  file;
     std::mutex                  lock;
+    std::string                 path;       // the file opened by the handles copying the records
+    mutable std::mutex          hdlock;
+    mutable int                 rdHandle = -1;
+    mutable int                 wrHandle = -1;
+    std::atomic<bool>           copyRange = true;   // copy_file_range() is not failed
 
   };
 
-  auto  CreateDumpStore( const mtc::api<mtc::IFlatStream>& st ) -> mtc::api<IStorage::IDumpStore>
+  auto  CreateDumpStore( const mtc::api<mtc::IFlatStream>& st, const std::string& fp ) -> mtc::api<IStorage::IDumpStore>
   {
-    return st != nullptr ? new DumpStore( st ) : nullptr;
+    return st != nullptr ? new DumpStore( st, fp ) : nullptr;
   }
 
   // DumpStore implementation
 
+  DumpStore::~DumpStore()
+  {
+    for ( auto handle: { rdHandle, wrHandle } )
+      if ( handle >= 0 )
+        close( handle );
+  }
+
   auto  DumpStore::Get( int64_t po ) const -> mtc::api<const mtc::IByteBuffer>
   {
     char  blkbuf[0x1000];
@@ -64,4 +86,76 @@ namespace posixFS {
     return putpos;
   }
 
+ /*
+  * Copy( source, pos )
+  *
+  * Copies the records of the other files of the storage by copy_file_range(),
+  * so the data is not passed through the user space and may be shared by the
+  * filesystems supporting reflinks; falls back to the default copy otherwise.
+  *
+  * The failure of copy_file_range() not supported for the files is remembered
+  * not to retry it for each record.
+  */
+  auto  DumpStore::Copy( const IDumpStore* source, int64_t pos ) -> std::pair<int64_t, size_t>
+  {
+# if defined( __linux__ )
+    auto  dumpSrc = dynamic_cast<const DumpStore*>( source );
+
+    if ( dumpSrc != nullptr && !dumpSrc->path.empty() && !path.empty() && copyRange.load() )
+    {
+      char    blkbuf[0x10];
+      auto    cbread = dumpSrc->file->PGet( blkbuf, pos, sizeof(blkbuf) );
+      auto    rdfile = dumpSrc->GetHandle( dumpSrc->rdHandle, O_RDONLY );
+      auto    wrfile = GetHandle( wrHandle, O_WRONLY );
+      size_t  buflen;
+
+      if ( cbread == 0 )
+        return { -1, 0 };
+
+      auto  bufptr = ::FetchFrom( const_cast<const char*>( blkbuf ), buflen );
+
+      if ( rdfile >= 0 && wrfile >= 0 && bufptr != nullptr && bufptr <= blkbuf + cbread )
+      {
+        auto    exlock = mtc::make_unique_lock( lock );
+        auto    putpos = file->Size();
+        auto    srcpos = loff_t(pos);
+        auto    outpos = loff_t(putpos);
+        size_t  toCopy = (bufptr - blkbuf) + buflen;
+        ssize_t copied;
+
+        while ( toCopy != 0 && (copied = copy_file_range( rdfile, &srcpos, wrfile, &outpos, toCopy, 0 )) > 0 )
+          toCopy -= copied;
+
+        if ( toCopy == 0 )
+          return { putpos, buflen };
+
+        if ( copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) )
+          copyRange = false;
+
+      // drop the record copied partially, e.g. by the filesystems not supporting
+      // the copy across the files, and append the record the default way
+        if ( outpos != loff_t(putpos) && ftruncate( wrfile, putpos ) != 0 )
+          throw std::runtime_error( "Failed to truncate the packages file" );
+      }
+    }
+# endif   // __linux__
+    return IDumpStore::Copy( source, pos );
+  }
+
+ /*
+  * GetHandle( handle, flags )
+  *
+  * Opens the file for copying on the first call; the failure is remembered as
+  * -2 not to retry the open for each record.
+  */
+  auto  DumpStore::GetHandle( int& handle, int flags ) const -> int
+  {
+    return mtc::interlocked( mtc::make_unique_lock( hdlock ), [&]()
+      {
+        if ( handle == -1 && !path.empty() && (handle = open( path.c_str(), flags )) < 0 )
+          handle = -2;
+        return handle;
+      } );
+  }
+
 }}}
@@ -6,6 +6,6 @@ namespace DelphiX {
 namespace storage {
 namespace posixFS {
 
-  auto  CreateDumpStore( const mtc::api<mtc::IFlatStream>& ) -> mtc::api<IStorage::IDumpStore>;
+  auto  CreateDumpStore( const mtc::api<mtc::IFlatStream>&, const std::string& = {} ) -> mtc::api<IStorage::IDumpStore>;
 
 }}}
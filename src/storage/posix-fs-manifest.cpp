@@ -0,0 +1,293 @@
+# include "posix-fs-manifest.hpp"
+# include "../../compat.hpp"
+# include <mtc/exceptions.h>
+# include <mtc/directory.h>
+# include <mtc/recursive_shared_mutex.hpp>
+# include <mtc/wcsstr.h>
+# include <algorithm>
+# include <stdexcept>
+# include <cstring>
+# include <cstdio>
+# include <fcntl.h>
+
+namespace DelphiX {
+namespace storage {
+namespace posixFS {
+
+  static  const char  manifestHeader[] = "DelphiX index manifest 1";
+
+  static  auto  GetManifestPath( const StoragePolicies& policies ) -> std::string
+  {
+    auto  policy = policies.GetPolicy( Unit::bulletin );
+
+    if ( policy == nullptr )
+      throw std::invalid_argument( "policy does not contain record for '.bulletin' file" );
+
+    return mtc::strprintf( policy->path.c_str(), "manifest" );
+  }
+
+ /*
+  * ListFiles( policies, unit )
+  *
+  * Lists the files of the unit in the storage with the stamps of the indices
+  * they belong to.
+  */
+  static  auto  ListFiles( const StoragePolicies& policies, Unit unit ) -> std::vector<std::pair<std::string, std::string>>
+  {
+    auto  unitPolicy = policies.GetPolicy( unit );
+    auto  stampedFiles = std::vector<std::pair<std::string, std::string>>();
+
+    if ( unitPolicy == nullptr )
+      return stampedFiles;
+
+    auto  pathTemplate = unitPolicy->GetFilePath( unit, "*" );
+    auto  asteriskOffs = pathTemplate.find_last_of( '*' );
+    auto  theDirectory = mtc::directory::Open( pathTemplate.c_str(), mtc::directory::attr_file );
+
+    if ( !theDirectory.defined() )
+      return stampedFiles;
+
+    for ( auto dirEntry = theDirectory.Get(); dirEntry.defined(); dirEntry = theDirectory.Get() )
+    {
+      auto  filePath = mtc::strprintf( "%s%s", dirEntry.folder(), dirEntry.string() );
+      auto  pointPos = filePath.find_first_of( '.', asteriskOffs );
+      auto  theStamp = filePath.substr( asteriskOffs, pointPos - asteriskOffs );
+
+      stampedFiles.emplace_back( std::move( theStamp ), std::move( filePath ) );
+    }
+    return stampedFiles;
+  }
+
+ /*
+  * IsNewer( stamp, ordinal )
+  *
+  * Compares the stamps as the numbers; the empty ordinal of the segment listed
+  * on open precedes any stamp.
+  */
+  static  bool  IsNewer( const std::string& ordinal, const std::string& stamp )
+  {
+    return ordinal.size() != stamp.size() ? ordinal.size() > stamp.size() : ordinal > stamp;
+  }
+
+  // Manifest implementation
+
+  Manifest::Manifest( const StoragePolicies& pols ):
+    policies( pols ),
+    filePath( GetManifestPath( pols ) ) {}
+
+  auto  Manifest::List() -> std::vector<Segment>
+  {
+    auto  exlock = mtc::make_unique_lock( mxLock );
+
+    return Load(), segments;
+  }
+
+ /*
+  * Publish( stamp, superseded )
+  *
+  * Places the index committed instead of the first index superseded found, and
+  * removes the other ones.  The index may already be listed if the storage was
+  * scanned after its bulletin was written.
+  *
+  * The new index is inserted in the order of the stamps, i.e. before the indices
+  * created later but committed earlier, so the concurrent commits are listed in
+  * the order of layers.  The index committed by the merge inherits the ordinal of
+  * the first index superseded, as it takes its place.
+  */
+  void  Manifest::Publish( const std::string& stamp, const std::vector<std::string>& superseded )
+  {
+    auto  exlock = mtc::make_unique_lock( mxLock );
+    auto  inserted = false;
+
+    Load();
+
+    for ( auto it = segments.begin(); it != segments.end(); )
+    {
+      if ( it->stamp != stamp && std::find( superseded.begin(), superseded.end(), it->stamp ) == superseded.end() )
+        ++it;
+      else if ( !inserted )
+        it->stamp = stamp, it->generation = nVersion + 1, ++it, inserted = true;
+      else
+        it = segments.erase( it );
+    }
+
+    if ( !inserted )
+    {
+      auto  it = segments.end();
+
+      while ( it != segments.begin() && IsNewer( (it - 1)->ordinal, stamp ) )
+        --it;
+
+      segments.insert( it, { stamp, nVersion + 1, stamp } );
+    }
+
+    ++nVersion;
+      Save();
+  }
+
+  /*
+  * Sweep()
+  *
+  * Deletes the files of the indices not listed: the ones superseded or removed
+  * before the files were deleted, and the ones not committed, left by the
+  * process failed.  Is called on the storage open, before any index is stored.
+  */
+  void  Manifest::Sweep()
+  {
+    auto  exlock = mtc::make_unique_lock( mxLock );
+
+    Load();
+
+    for ( auto unit: { Unit::entities, Unit::contents, Unit::linkages, Unit::packages, Unit::bulletin } )
+      for ( auto& next: ListFiles( policies, unit ) )
+      {
+        auto  pfound = std::find_if( segments.begin(), segments.end(), [&]( const Segment& s )
+          {  return s.stamp == next.first;  } );
+
+        if ( pfound == segments.end() )
+          remove( next.second.c_str() );
+      }
+
+    remove( (filePath + ".tmp").c_str() );
+  }
+
+  void  Manifest::Remove( const std::string& stamp )
+  {
+    auto  exlock = mtc::make_unique_lock( mxLock );
+    auto  pfound = decltype(segments.begin())();
+
+    Load();
+
+    pfound = std::find_if( segments.begin(), segments.end(), [&]( const Segment& s )
+      {  return s.stamp == stamp;  } );
+
+    if ( pfound != segments.end() )
+    {
+      segments.erase( pfound );
+      ++nVersion;
+        Save();
+    }
+  }
+
+ /*
+  * Load()
+  *
+  * Reads the manifest once; the storage having no manifest is scanned for the
+  * indices completed.  Is called under the lock.
+  */
+  void  Manifest::Load()
+  {
+    auto  infile = (FILE*)nullptr;
+    char  buffer[0x100];
+
+    if ( isLoaded )
+      return;
+
+    if ( (infile = fopen( filePath.c_str(), "r" )) == nullptr )
+    {
+      Scan();
+      isLoaded = true;
+      return;
+    }
+
+    try
+    {
+      if ( fgets( buffer, sizeof(buffer), infile ) == nullptr || strncmp( buffer, manifestHeader, sizeof(manifestHeader) - 1 ) != 0 )
+        throw mtc::file_error( mtc::strprintf( "invalid index manifest '%s'", filePath.c_str() ) );
+
+      if ( fgets( buffer, sizeof(buffer), infile ) == nullptr || sscanf( buffer, "generation %lu", &nVersion ) != 1 )
+        throw mtc::file_error( mtc::strprintf( "invalid index manifest '%s'", filePath.c_str() ) );
+
+      while ( fgets( buffer, sizeof(buffer), infile ) != nullptr )
+      {
+        char      stamp[0x40];
+        uint64_t  generation;
+
+        if ( sscanf( buffer, "%63s %lu", stamp, &generation ) != 2 )
+          throw mtc::file_error( mtc::strprintf( "invalid index manifest '%s'", filePath.c_str() ) );
+
+        segments.push_back( { stamp, generation } );
+      }
+      fclose( infile );
+    }
+    catch ( ... )
+    {
+      fclose( infile );
+      segments.clear();
+      throw;
+    }
+    isLoaded = true;
+  }
+
+ /*
+  * Scan()
+  *
+  * Lists the indices by the bulletin files, ordered by the stamps.
+  */
+  void  Manifest::Scan()
+  {
+    auto  sortedSuffix = std::vector<std::string>();
+
+    for ( auto& next: ListFiles( policies, Unit::bulletin ) )
+      sortedSuffix.push_back( std::move( next.first ) );
+
+    std::sort( sortedSuffix.begin(), sortedSuffix.end() );
+
+    for ( auto& suffix: sortedSuffix )
+      segments.push_back( { std::move( suffix ), 0 } );
+  }
+
+ /*
+  * Save()
+  *
+  * Writes the manifest to the temporary file, flushes it to the disk and renames
+  * over the existing one, then flushes the directory to make the rename durable.
+  * Is called under the lock.
+  */
+  void  Manifest::Save()
+  {
+    auto  tempPath = filePath + ".tmp";
+    auto  dirSlash = filePath.find_last_of( '/' );
+    auto  dirsPath = dirSlash != std::string::npos ? filePath.substr( 0, dirSlash + 1 ) : std::string( "." );
+    auto  contents = mtc::strprintf( "%s\ngeneration %lu\n", manifestHeader, nVersion );
+    auto  f_handle = int(-1);
+    int   nerror;
+
+    for ( auto& next: segments )
+      contents += mtc::strprintf( "%s %lu\n", next.stamp.c_str(), next.generation );
+
+    if ( (f_handle = open( tempPath.c_str(), O_CREAT + O_RDWR + O_TRUNC, 0644 )) < 0 )
+    {
+      nerror = errno;
+      throw mtc::file_error( mtc::strprintf( "could not create file '%s', error %d (%s)",
+        tempPath.c_str(), nerror, strerror( nerror ) ) );
+    }
+
+    if ( write( f_handle, contents.data(), contents.size() ) != ssize_t(contents.size()) || fsync( f_handle ) != 0 )
+    {
+      nerror = errno;
+      close( f_handle );
+      remove( tempPath.c_str() );
+      throw mtc::file_error( mtc::strprintf( "could not write file '%s', error %d (%s)",
+        tempPath.c_str(), nerror, strerror( nerror ) ) );
+    } else close( f_handle );
+
+    if ( rename( tempPath.c_str(), filePath.c_str() ) != 0 )
+    {
+      nerror = errno;
+      remove( tempPath.c_str() );
+      throw mtc::file_error( mtc::strprintf( "could not rename '%s' to '%s', error %d (%s)",
+        tempPath.c_str(), filePath.c_str(), nerror, strerror( nerror ) ) );
+    }
+
+    if ( (f_handle = open( dirsPath.c_str(), O_RDONLY | O_DIRECTORY )) < 0 || fsync( f_handle ) != 0 )
+    {
+      nerror = errno;
+      if ( f_handle >= 0 )
+        close( f_handle );
+      throw mtc::file_error( mtc::strprintf( "could not flush directory '%s', error %d (%s)",
+        dirsPath.c_str(), nerror, strerror( nerror ) ) );
+    } else close( f_handle );
+  }
+
+}}}
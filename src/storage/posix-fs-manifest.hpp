@@ -0,0 +1,73 @@
+# if !defined( __DelphiX_src_storage_posix_fs_manifest_hpp__ )
+# define __DelphiX_src_storage_posix_fs_manifest_hpp__
+# include "../../storage/posix-fs.hpp"
+# include <mutex>
+# include <vector>
+# include <string>
+
+namespace DelphiX {
+namespace storage {
+namespace posixFS {
+
+ /*
+  * Manifest is the list of the live indices of the storage in the order of
+  * layers; it is rewritten to the temporary file and renamed over the old one
+  * each time the list is changed, so the indices committed by the merge and
+  * superseded by it are replaced at once.
+  *
+  * The storage created before the manifest is listed by the completion markers
+  * (bulletins) found, and the manifest is written on the first change.
+  *
+  * The files of the indices not listed are deleted by Sweep() when the storage
+  * is opened.
+  */
+  class Manifest final: public mtc::Iface
+  {
+    implement_lifetime_control
+
+  public:
+    struct Segment
+    {
+      std::string stamp;
+      uint64_t    generation;   // manifest generation the index was published at
+      std::string ordinal = {}; // stamp the segment is ordered by, empty if loaded
+    };
+
+  public:
+    Manifest( const StoragePolicies& );
+
+    auto  List() -> std::vector<Segment>;
+    void  Publish( const std::string&, const std::vector<std::string>& );
+    void  Remove( const std::string& );
+    void  Sweep();
+
+  protected:
+    void  Load();
+    void  Scan();
+    void  Save();
+
+  protected:
+    const StoragePolicies policies;
+    const std::string     filePath;
+
+    std::mutex            mxLock;
+    bool                  isLoaded = false;
+    uint64_t              nVersion = 0;
+    std::vector<Segment>  segments;
+
+  };
+
+  auto  CreateSink( const StoragePolicies&, mtc::api<Manifest> ) -> mtc::api<IStorage::IIndexStore>;
+  auto  OpenSerial( const StoragePolicies&, const std::string&, mtc::api<Manifest> ) -> mtc::api<IStorage::ISerialized>;
+
+ /*
+  * GetStamp( serial )
+  *
+  * Returns the stamp of the index serialized by this storage, or empty string for
+  * the other ones.
+  */
+  auto  GetStamp( const mtc::api<IStorage::ISerialized>& ) -> std::string;
+
+}}}
+
+# endif   // !__DelphiX_src_storage_posix_fs_manifest_hpp__
@@ -1,6 +1,7 @@
 # include "../../storage/posix-fs.hpp"
 # include "../../compat.hpp"
 # include "posix-fs-dump-store.hpp"
+# include "posix-fs-manifest.hpp"
 # include <mtc/exceptions.h>
 # include <mtc/fileStream.h>
 # include <mtc/bufStream.h>
@@ -9,6 +10,7 @@
 # include <stdexcept>
 # include <chrono>
 # include <thread>
+# include <mutex>
 
 namespace DelphiX {
 namespace storage {
@@ -18,13 +20,17 @@ namespace posixFS {
   {
     std::atomic_long  referenceCounter = 0;
 
-    friend auto CreateSink( const StoragePolicies& ) -> mtc::api<IIndexStore>;
+    friend auto CreateSink( const StoragePolicies&, mtc::api<Manifest> ) -> mtc::api<IIndexStore>;
 
   public:
-    Sink( const StoragePolicies& s ):
-      policies( s )  {}
+    Sink( const StoragePolicies& s, const std::string& t, mtc::api<Manifest> m ):
+      policies( s ),
+      stamp( t ),
+      manifest( m )  {}
     Sink( Sink&& sink ):
       policies( std::move( sink.policies ) ),
+      stamp( std::move( sink.stamp ) ),
+      manifest( std::move( sink.manifest ) ),
       doRemove( std::move( sink.doRemove ) ),
       entities( std::move( sink.entities ) ),
       contents( std::move( sink.contents ) ),
@@ -41,12 +47,17 @@ namespace posixFS {
     auto  Contents() -> mtc::api<mtc::IByteStream> override {  return contents;  }
     auto  Linkages() -> mtc::api<mtc::IByteStream> override {  return linkages;  }
     auto  Packages() -> mtc::api<IStorage::IDumpStore> override {  return packages;  }
+    auto  Spillage() -> mtc::api<IStorage::IDumpStore> override;
+    void  Supersede( mtc::api<IStorage::ISerialized> ) override;
 
     auto  Commit() -> mtc::api<IStorage::ISerialized> override;
     void  Remove() override;
 
   protected:
     StoragePolicies                 policies;
+    std::string                     stamp;
+    mtc::api<Manifest>              manifest;     // nullptr for the sink created alone
+    std::vector<std::string>        outdated;     // stamps of the indices superseded
     bool                            doRemove = true;
 
     mtc::api<mtc::IByteStream>      entities;
@@ -54,6 +65,9 @@ namespace posixFS {
     mtc::api<mtc::IByteStream>      linkages;
     mtc::api<IStorage::IDumpStore>  packages;
 
+    std::mutex                      spilLock;
+    mtc::api<IStorage::IDumpStore>  spillage;
+
   };
 
   // Sink implementation
@@ -68,6 +82,7 @@ namespace posixFS {
       linkages = nullptr;
       contents = nullptr;
       packages = nullptr;
+      spillage = nullptr;
 
       if ( doRemove )
         Sink::Remove();
@@ -77,6 +92,61 @@ namespace posixFS {
     return rcount;
   }
 
+  /*
+   * Sink::Spillage()
+   *
+   * Creates the spill file beside the contents on the first call; the file is
+   * unlinked at once, so it never outlives the sink even if the process fails.
+   */
+  auto  Sink::Spillage() -> mtc::api<IStorage::IDumpStore>
+  {
+    auto  exlock = mtc::make_unique_lock( spilLock );
+
+    if ( spillage == nullptr )
+    {
+      auto  policy = policies.GetPolicy( Unit::contents );
+      auto  unitPath = policy->GetFilePath( Unit::contents ) + ".spill";
+      auto  f_handle = open( unitPath.c_str(), O_CREAT + O_RDWR + O_TRUNC, 0644 );
+      auto  fstream = mtc::api<mtc::IFlatStream>();
+      int   nerror;
+
+      if ( f_handle < 0 )
+      {
+        nerror = errno;
+        throw mtc::file_error( mtc::strprintf( "could not create file '%s', error %d (%s)",
+          unitPath.c_str(), nerror, strerror( nerror ) ) );
+      } else close( f_handle );
+
+      try
+      {
+        fstream = mtc::OpenFileStream( unitPath.c_str(), O_RDWR, mtc::enable_exceptions );
+      }
+      catch ( ... )
+      {
+        remove( unitPath.c_str() );
+        throw;
+      }
+
+      remove( unitPath.c_str() );
+      spillage = CreateDumpStore( fstream );
+    }
+    return spillage;
+  }
+
+  void  Sink::Supersede( mtc::api<IStorage::ISerialized> serial )
+  {
+    auto  sstamp = GetStamp( serial );
+
+    if ( !sstamp.empty() )
+      outdated.push_back( std::move( sstamp ) );
+  }
+
+ /*
+  * Sink::Commit()
+  *
+  * Writes the completion marker and publishes the index in the manifest; the
+  * index is not listed by the storage until the manifest is renamed.
+  */
   auto  Sink::Commit() -> mtc::api<IStorage::ISerialized>
   {
     auto  policy = policies.GetPolicy( bulletin );
@@ -89,14 +159,18 @@ namespace posixFS {
     contents = nullptr;
     linkages = nullptr;
     packages = nullptr;
+    spillage = nullptr;
 
     handle = open( policy->GetFilePath( Unit::bulletin ).c_str(), O_CREAT + O_RDWR, 0644 );
       write( handle, "index completion marker\n", 24 );
     close( handle );
 
+    if ( manifest != nullptr )
+      manifest->Publish( stamp, outdated );
+
     doRemove = false;
 
-    return OpenSerial( policies );
+    return OpenSerial( policies, stamp, manifest );
   }
 
   void  Sink::Remove()
@@ -105,6 +179,7 @@ namespace posixFS {
     contents = nullptr;
     linkages = nullptr;
     packages = nullptr;
+    spillage = nullptr;
 
     for ( auto unit: { Unit::packages, Unit::linkages, Unit::contents, Unit::entities, Unit::bulletin } )
     {
@@ -169,11 +244,11 @@ namespace posixFS {
     }
   }
 
-  auto  CreateSink( const StoragePolicies& policies ) -> mtc::api<IStorage::IIndexStore>
+  auto  CreateSink( const StoragePolicies& policies, mtc::api<Manifest> manifest ) -> mtc::api<IStorage::IIndexStore>
   {
     auto  units = std::initializer_list<Unit>{ entities, contents, linkages, packages };
     auto  stamp = CaptureIndex( units, policies, policies.IsInstance() );
-    Sink  aSink( policies.GetInstance( stamp ) );
+    Sink  aSink( policies.GetInstance( stamp ), stamp, manifest );
 
   // OK, the list of files is captured; create the sink
     aSink.entities = mtc::OpenBufStream( aSink.policies.GetPolicy( entities )
@@ -183,9 +258,15 @@ namespace posixFS {
     aSink.linkages   = mtc::OpenBufStream( aSink.policies.GetPolicy( linkages )
       ->GetFilePath( linkages ).c_str(), O_RDWR, 0x8000, mtc::enable_exceptions );
     aSink.packages   = CreateDumpStore( mtc::OpenFileStream( aSink.policies.GetPolicy( packages )
-      ->GetFilePath( packages ).c_str(), O_RDWR ).ptr() );
+      ->GetFilePath( packages ).c_str(), O_RDWR ).ptr(),
+        aSink.policies.GetPolicy( packages )->GetFilePath( packages ) );
 
     return new Sink( std::move( aSink ) );
   }
 
+  auto  CreateSink( const StoragePolicies& policies ) -> mtc::api<IStorage::IIndexStore>
+  {
+    return CreateSink( policies, nullptr );
+  }
+
 }}}
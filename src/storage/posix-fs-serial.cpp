@@ -1,6 +1,7 @@
 # include "../../storage/posix-fs.hpp"
 # include "../../compat.hpp"
 # include "posix-fs-dump-store.hpp"
+# include "posix-fs-manifest.hpp"
 # include <mtc/fileStream.h>
 # include <mtc/wcsstr.h>
 # include <stdexcept>
@@ -14,8 +15,10 @@ namespace posixFS {
     implement_lifetime_control
 
   public:
-    Serialized( const StoragePolicies& pol ):
-      policies( pol ) {}
+    Serialized( const StoragePolicies& pol, const std::string& st, mtc::api<Manifest> mf ):
+      policies( pol ),
+      stamp( st ),
+      manifest( mf ) {}
 
   public:
     auto  Entities() -> mtc::api<const mtc::IByteBuffer> override;
@@ -27,8 +30,12 @@ namespace posixFS {
 
     auto  NewPatch() -> mtc::api<IPatch> override;
 
+    auto  GetStamp() const -> const std::string&  {  return stamp;  }
+
   protected:
     const StoragePolicies                 policies;
+    const std::string                     stamp;
+    mtc::api<Manifest>                    manifest;
 
     mtc::api<const mtc::IByteBuffer>      entities;
     mtc::api<const mtc::IByteBuffer>      contents;
@@ -97,8 +104,10 @@ namespace posixFS {
   {
     if ( packages == nullptr )
     {
-      packages = CreateDumpStore( mtc::OpenFileStream( policies.GetPolicy( Unit::packages )->GetFilePath( Unit::packages ).c_str(),
-        O_RDONLY, mtc::disable_exceptions ).ptr() );
+      auto  unitPath = policies.GetPolicy( Unit::packages )->GetFilePath( Unit::packages );
+
+      packages = CreateDumpStore( mtc::OpenFileStream( unitPath.c_str(),
+        O_RDONLY, mtc::disable_exceptions ).ptr(), unitPath );
     }
     return packages;
   }
@@ -110,6 +119,10 @@ namespace posixFS {
 
   void  Serialized::Remove()
   {
+  // first unlist the index, so the files are never listed after the failure
+    if ( manifest != nullptr )
+      manifest->Remove( stamp );
+
     entities = nullptr;
     linkages = nullptr;
     contents = nullptr;
@@ -129,9 +142,21 @@ namespace posixFS {
     return nullptr;
   }
 
+  auto  OpenSerial( const StoragePolicies& policies, const std::string& stamp, mtc::api<Manifest> manifest ) -> mtc::api<IStorage::ISerialized>
+  {
+    return new Serialized( policies, stamp, manifest );
+  }
+
   auto  OpenSerial( const StoragePolicies& policies ) -> mtc::api<IStorage::ISerialized>
   {
-    return new Serialized( policies );
+    return new Serialized( policies, {}, nullptr );
+  }
+
+  auto  GetStamp( const mtc::api<IStorage::ISerialized>& serial ) -> std::string
+  {
+    auto  pserial = dynamic_cast<const Serialized*>( serial.ptr() );
+
+    return pserial != nullptr ? pserial->GetStamp() : std::string();
   }
 
 }}}
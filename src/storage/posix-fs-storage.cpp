@@ -1,6 +1,5 @@
 # include "../../storage/posix-fs.hpp"
-# include <mtc/directory.h>
-# include <algorithm>
+# include "posix-fs-manifest.hpp"
 
 namespace DelphiX {
 namespace storage {
@@ -14,19 +13,25 @@ namespace posixFS {
 
   public:
     Storage( const StoragePolicies& pols ):
-      policies( pols )  {}
+      policies( pols ),
+      manifest( pols.IsInstance() || pols.GetPolicy( Unit::bulletin ) == nullptr ? nullptr : new Manifest( pols ) )
+    {
+      if ( manifest != nullptr )
+        manifest->Sweep();
+    }
   public:
     auto  ListIndices() -> mtc::api<ISourceList> override;
     auto  CreateStore() -> mtc::api<IIndexStore> override;
 
   protected:
-    StoragePolicies policies;
+    StoragePolicies     policies;
+    mtc::api<Manifest>  manifest;     // the list of indices, nullptr for the instance
 
   };
 
   class Storage::SourceList final: public ISourceList
   {
-    using PolicyElements = std::vector<StoragePolicies>;
+    using PolicyElements = std::vector<std::pair<StoragePolicies, std::string>>;
     using PolicyIterator = PolicyElements::const_iterator;
 
     implement_lifetime_control
@@ -35,13 +40,15 @@ namespace posixFS {
     auto  Get() -> mtc::api<ISerialized> override;
 
   public:
-    SourceList( std::vector<StoragePolicies>&& instances ):
+    SourceList( PolicyElements&& instances, mtc::api<Manifest> mf ):
       policies( std::move( instances ) ),
-      iterator( policies.begin() )  {}
+      iterator( policies.begin() ),
+      manifest( mf )  {}
 
   protected:
-    PolicyElements  policies;
-    PolicyIterator  iterator;
+    PolicyElements      policies;
+    PolicyIterator      iterator;
+    mtc::api<Manifest>  manifest;
 
   };
 
@@ -50,7 +57,11 @@ namespace posixFS {
   auto Storage::SourceList::Get() -> mtc::api<ISerialized>
   {
     if ( iterator != policies.end() )
-      return OpenSerial( *iterator++ );
+    {
+      auto& next = *iterator++;
+
+      return OpenSerial( next.first, next.second, manifest );
+    }
     return nullptr;
   }
 
@@ -58,47 +69,27 @@ namespace posixFS {
 
   auto  Storage::ListIndices() -> mtc::api<ISourceList>
   {
-    auto  theInstances = std::vector<StoragePolicies>();
-    auto  statusPolicy = policies.GetPolicy( Unit::bulletin );
-    auto  pathTemplate = std::string();
-    auto  theDirectory = mtc::directory();
+    auto  theInstances = std::vector<std::pair<StoragePolicies, std::string>>();
 
-    if ( statusPolicy == nullptr )
+    if ( policies.GetPolicy( Unit::bulletin ) == nullptr )
       return nullptr;
 
-    pathTemplate = statusPolicy->GetFilePath( Unit::bulletin, "*" );
-    theDirectory = mtc::directory::Open( pathTemplate.c_str(), mtc::directory::attr_file );
-
     if ( policies.IsInstance() )
     {
-      theInstances.emplace_back( policies );
+      theInstances.emplace_back( policies, std::string() );
     }
       else
     {
-      auto  asteriskOffs = pathTemplate.find_last_of( '*' );
-      auto  sortedSuffix = std::vector<std::string>();
-
-      if ( theDirectory.defined() )
-        for ( auto dirEntry = theDirectory.Get(); dirEntry.defined(); dirEntry = theDirectory.Get() )
-        {
-          auto  filePath = mtc::strprintf( "%s%s", dirEntry.folder(), dirEntry.string() );
-          auto  pointPos = filePath.find_first_of( '.', asteriskOffs );
-          auto  toSuffix = filePath.substr( asteriskOffs, pointPos - asteriskOffs );
-
-          sortedSuffix.push_back( std::move( toSuffix) );
-        }
-      std::sort( sortedSuffix.begin(), sortedSuffix.end() );
-
-      for ( auto& suffix: sortedSuffix )
-        theInstances.emplace_back( policies.GetInstance( suffix ) );
+      for ( auto& next: manifest->List() )
+        theInstances.emplace_back( policies.GetInstance( next.stamp ), next.stamp );
     }
 
-    return !theInstances.empty() ? new SourceList( std::move( theInstances ) ) : nullptr;
+    return !theInstances.empty() ? new SourceList( std::move( theInstances ), manifest ) : nullptr;
   }
 
   auto  Storage::CreateStore() -> mtc::api<IIndexStore>
   {
-    return CreateSink( policies );
+    return CreateSink( policies, manifest );
   }
 
   auto  Open( const StoragePolicies& policies ) -> mtc::api<IStorage>
@@ -0,0 +1,511 @@
+# include "../../src/indexer/contents-index-merger.hpp"
+# include "../../indexer/dynamic-contents.hpp"
+# include "../../indexer/static-contents.hpp"
+# include "../../storage/posix-fs.hpp"
+# include "../toolbox/tmppath.h"
+# include <mtc/test-it-easy.hpp>
+# include <mtc/wcsstr.h>
+# include <algorithm>
+# include <cstring>
+
+using namespace DelphiX;
+using namespace DelphiX::indexer;
+
+/*
+ * MergedKeys - the keys of the entity: the lite ones of Type() == 0 and the rich
+ * ones keeping the tag of the source with the entity id as the details
+ */
+class MergedKeys: public IContents
+{
+  implement_lifetime_stub
+
+public:
+  MergedKeys( const std::string& src, const std::string& eid, unsigned num ):
+    tag( src + ':' + eid ), source( src ), serial( num )  {}
+
+  auto  ptr() const -> const IContents*
+  {  return this;  }
+
+  void  Enum( IContentsIndex::IIndexAPI* to ) const override
+  {
+    to->Insert( "lite", {}, 0 );
+    to->Insert( "lite-" + std::to_string( serial % 3 ), {}, 0 );
+    to->Insert( "lite-" + source, {}, 0 );
+    to->Insert( "rich", tag, 1 );
+    to->Insert( "rich-" + std::to_string( serial % 3 ), tag, 1 );
+    to->Insert( "rich-" + source, tag, 1 );
+  }
+
+protected:
+  std::string tag;
+  std::string source;
+  unsigned    serial;
+};
+
+/*
+ * RangeKeys - the keys numbered from first to limit with the step, the even
+ * ones are lite and the odd ones are rich
+ */
+class RangeKeys: public IContents
+{
+  implement_lifetime_stub
+
+public:
+  RangeKeys( const std::string& eid, unsigned first, unsigned step, unsigned limit ):
+    detail( eid ), uFirst( first ), uStep( step ), uLimit( limit )  {}
+
+  auto  ptr() const -> const IContents*
+  {  return this;  }
+
+  void  Enum( IContentsIndex::IIndexAPI* to ) const override
+  {
+    for ( auto key = uFirst; key < uLimit; key += uStep )
+    {
+      to->Insert( mtc::strprintf( "key%05u", key ), (key & 1) != 0 ?
+        std::string_view( detail ) : std::string_view(), key & 1 );
+    }
+  }
+
+protected:
+  std::string detail;
+  unsigned    uFirst;
+  unsigned    uStep;
+  unsigned    uLimit;
+};
+
+/*
+ * PlainBlocks - the index listing the blocks of the source index reference by
+ * reference, without the serialized blocks copied as is by the merger; the key
+ * failed, if set, throws on GetKeyBlock()
+ */
+class PlainBlocks final: public IContentsIndex
+{
+  implement_lifetime_control
+
+  class Entities final: public IEntities
+  {
+    implement_lifetime_control
+
+  public:
+    Entities( mtc::api<IEntities> src ):
+      source( src ) {}
+
+    auto  Find( uint32_t id ) -> Reference override {  return source->Find( id );  }
+    auto  Size() const -> uint32_t override {  return source->Size();  }
+    auto  Type() const -> uint32_t override {  return source->Type();  }
+
+  protected:
+    mtc::api<IEntities> source;
+  };
+
+public:
+  PlainBlocks( mtc::api<IContentsIndex> src, const std::string& key = {} ):
+    source( src ), failed( key ) {}
+
+  auto  GetEntity( EntityId id ) const -> mtc::api<const IEntity> override
+    {  return source->GetEntity( id );  }
+  auto  GetEntity( uint32_t ix ) const -> mtc::api<const IEntity> override
+    {  return source->GetEntity( ix );  }
+  bool  DelEntity( EntityId id ) override
+    {  return source->DelEntity( id );  }
+  auto  SetEntity( EntityId id, mtc::api<const IContents> keys, const std::string_view& xtra, const std::string_view& beef ) -> mtc::api<const IEntity> override
+    {  return source->SetEntity( id, keys, xtra, beef );  }
+  auto  SetExtras( EntityId id, const std::string_view& xtra ) -> mtc::api<const IEntity> override
+    {  return source->SetExtras( id, xtra );  }
+  auto  GetMaxIndex() const -> uint32_t override
+    {  return source->GetMaxIndex();  }
+  auto  GetKeyBlock( const std::string_view& key ) const -> mtc::api<IEntities> override
+    {
+      auto  block = mtc::api<IEntities>();
+
+      if ( !failed.empty() && key == failed )
+        throw std::runtime_error( "failed to read the key block" );
+
+      block = source->GetKeyBlock( key );
+
+      return block != nullptr ? new Entities( block ) : nullptr;
+    }
+  auto  GetKeyStats( const std::string_view& key ) const -> BlockInfo override
+    {  return source->GetKeyStats( key );  }
+  auto  ListEntities( EntityId id ) -> mtc::api<IEntitiesList> override
+    {  return source->ListEntities( id );  }
+  auto  ListEntities( uint32_t ix ) -> mtc::api<IEntitiesList> override
+    {  return source->ListEntities( ix );  }
+  auto  ListContents( const std::string_view& key ) -> mtc::api<IContentsList> override
+    {  return source->ListContents( key );  }
+  auto  Commit() -> mtc::api<IStorage::ISerialized> override
+    {  return source->Commit();  }
+  auto  Reduce() -> mtc::api<IContentsIndex> override
+    {  return this;  }
+  void  Remove() override
+    {  return source->Remove();  }
+  void  Stash( EntityId id ) override
+    {  return source->Stash( id );  }
+
+protected:
+  mtc::api<IContentsIndex>  source;
+  std::string               failed;
+
+};
+
+/*
+ * CreateMergerSource( tag, ids )
+ *
+ * Creates the static index with the entities indexed in the order listed, with
+ * the tag of the source set as the extras.
+ */
+static  auto  CreateMergerSource( const std::string& tag, const std::vector<std::string>& ids ) -> mtc::api<IContentsIndex>
+{
+  auto  pindex = dynamic::Index()
+    .Set( dynamic::Settings()
+      .SetMaxEntities( 0x4000 )
+      .SetMaxAllocate( 64 * 1024 * 1024 ) )
+    .Set( storage::posixFS::CreateSink( storage::posixFS::StoragePolicies::Open(
+      GetTmpPath() + "k2" ) ) )
+    .Create();
+
+  for ( auto& next: ids )
+    pindex->SetEntity( next, MergedKeys( tag, next, unsigned(&next - ids.data()) ).ptr(), tag );
+
+  return static_::Index().Create( pindex->Commit() );
+}
+
+/*
+ * CreateRangeSource( tag, count, limit )
+ *
+ * Creates the static index of count entities sharing the keys below limit:
+ * each key is held by one entity of the source.
+ */
+static  auto  CreateRangeSource( const std::string& tag, unsigned count, unsigned limit ) -> mtc::api<IContentsIndex>
+{
+  auto  pindex = dynamic::Index()
+    .Set( dynamic::Settings()
+      .SetMaxEntities( 0x4000 )
+      .SetMaxAllocate( 64 * 1024 * 1024 ) )
+    .Set( storage::posixFS::CreateSink( storage::posixFS::StoragePolicies::Open(
+      GetTmpPath() + "k2" ) ) )
+    .Create();
+
+  for ( unsigned i = 0; i != count; ++i )
+  {
+    auto  id = mtc::strprintf( "%s%05u", tag.c_str(), i );
+
+    pindex->SetEntity( id, RangeKeys( id, i, count, limit ).ptr() );
+  }
+
+  return static_::Index().Create( pindex->Commit() );
+}
+
+static  auto  GetMergerIds( const char* prefix, unsigned count ) -> std::vector<std::string>
+{
+  auto  ids = std::vector<std::string>();
+
+  for ( unsigned i = 0; i != count; ++i )
+    ids.push_back( mtc::strprintf( "%s%05u", prefix, i ) );
+
+  return ids;
+}
+
+static  auto  MergeSerial( const std::vector<mtc::api<IContentsIndex>>& sources, unsigned nthreads = 1 ) -> mtc::api<IStorage::ISerialized>
+{
+  return fusion::ContentsMerger()
+    .Set( sources )
+    .Set( storage::posixFS::CreateSink( storage::posixFS::StoragePolicies::Open(
+      GetTmpPath() + "m2" ) ) )
+    .SetThreads( nthreads )();
+}
+
+static  auto  MergeSources( const std::vector<mtc::api<IContentsIndex>>& sources, unsigned nthreads = 1 ) -> mtc::api<IContentsIndex>
+{
+  return static_::Index().Create( MergeSerial( sources, nthreads ) );
+}
+
+/*
+ * SameSerials( a, b )
+ *
+ * Compares the radix trees of the key records and the linkages of the merged
+ * indices byte by byte.
+ */
+static  bool  SameSerials( const mtc::api<IStorage::ISerialized>& a, const mtc::api<IStorage::ISerialized>& b )
+{
+  auto  acontents = a->Contents();
+  auto  bcontents = b->Contents();
+  auto  alinkages = a->Linkages();
+  auto  blinkages = b->Linkages();
+
+  if ( acontents->GetLen() != bcontents->GetLen()
+    || memcmp( acontents->GetPtr(), bcontents->GetPtr(), acontents->GetLen() ) != 0 )
+      return false;
+
+  if ( alinkages->Size() != blinkages->Size() )
+    return false;
+
+  if ( alinkages->Size() == 0 )
+    return true;
+
+  auto  ablocks = mtc::api<const mtc::IByteBuffer>( alinkages->PGet( 0, uint32_t(alinkages->Size()) ).ptr() );
+  auto  bblocks = mtc::api<const mtc::IByteBuffer>( blinkages->PGet( 0, uint32_t(blinkages->Size()) ).ptr() );
+
+  return ablocks != nullptr && bblocks != nullptr
+      && ablocks->GetLen() == bblocks->GetLen()
+      && memcmp( ablocks->GetPtr(), bblocks->GetPtr(), ablocks->GetLen() ) == 0;
+}
+
+static  auto  ListMergedKeys( const mtc::api<IContentsIndex>& index ) -> std::vector<std::string>
+{
+  auto  keys = std::vector<std::string>();
+  auto  list = index->ListContents();
+
+  for ( auto key = list->Curr(); !key.empty(); key = list->Next() )
+    keys.push_back( key );
+
+  return keys;
+}
+
+/*
+ * SameBlocks( a, b, key )
+ *
+ * Compares the references of the key blocks one by one, with the details of
+ * the rich blocks.
+ */
+static  bool  SameBlocks( const mtc::api<IContentsIndex>& a, const mtc::api<IContentsIndex>& b, const std::string& key )
+{
+  auto  ablock = a->GetKeyBlock( key );
+  auto  bblock = b->GetKeyBlock( key );
+
+  if ( ablock == nullptr || bblock == nullptr )
+    return ablock == bblock;
+
+  if ( ablock->Type() != bblock->Type() )
+    return false;
+
+  for ( auto aref = ablock->Find( 0 ), bref = bblock->Find( 0 ); ;
+    aref = ablock->Find( aref.uEntity + 1 ), bref = bblock->Find( bref.uEntity + 1 ) )
+  {
+    if ( aref.uEntity != bref.uEntity )
+      return false;
+    if ( aref.uEntity == uint32_t(-1) )
+      return true;
+    if ( ablock->Type() != 0 && aref.details != bref.details )
+      return false;
+  }
+}
+
+/*
+ * GetPostings( index, key )
+ *
+ * Lists the ids of the entities referenced by the lite block, or the details
+ * of the rich block, in the order of the references.
+ */
+static  auto  GetPostings( const mtc::api<IContentsIndex>& index, const std::string& key ) -> std::vector<std::string>
+{
+  auto  block = index->GetKeyBlock( key );
+  auto  output = std::vector<std::string>();
+
+  if ( block != nullptr )
+    for ( auto ref = block->Find( 0 ); ref.uEntity != uint32_t(-1); ref = block->Find( ref.uEntity + 1 ) )
+    {
+      auto  entity = index->GetEntity( ref.uEntity );
+
+      output.push_back( block->Type() != 0 ? std::string( ref.details ) :
+        entity != nullptr ? std::string( entity->GetId() ) : std::string() );
+    }
+
+  return output;
+}
+
+static  bool  HasPostings( const mtc::api<IContentsIndex>& index, const std::string& key, const std::vector<std::string>& expect )
+{
+  return GetPostings( index, key ) == expect;
+}
+
+static  auto  GetSourceTag( const mtc::api<IContentsIndex>& index, const std::string& id ) -> std::string
+{
+  auto  entity = index->GetEntity( id );
+  auto  extras = entity != nullptr ? entity->GetExtra() : nullptr;
+
+  return extras != nullptr ? std::string( extras->GetPtr(), extras->GetLen() ) : std::string();
+}
+
+/*
+ * RefersIds( index, key )
+ *
+ * Checks if the details of the rich block name the entities referenced.
+ */
+static  bool  RefersIds( const mtc::api<IContentsIndex>& index, const std::string& key )
+{
+  auto  block = index->GetKeyBlock( key );
+
+  if ( block == nullptr )
+    return false;
+
+  for ( auto ref = block->Find( 0 ); ref.uEntity != uint32_t(-1); ref = block->Find( ref.uEntity + 1 ) )
+  {
+    auto  entity = index->GetEntity( ref.uEntity );
+    auto  detail = std::string( ref.details );
+
+    if ( entity == nullptr || detail.substr( detail.find( ':' ) + 1 ) != std::string( entity->GetId() ) )
+      return false;
+  }
+  return true;
+}
+
+TestItEasy::RegisterFunc  contents_merger( []()
+  {
+    TEST_CASE( "index/contents-merger" )
+    {
+      SECTION( "ContentsMerger copies the blocks of the sources renumbered contiguously as is" )
+      {
+        auto  aIds = GetMergerIds( "a", 40 );
+        auto  bIds = GetMergerIds( "b", 40 );
+        auto  cIds = GetMergerIds( "c", 30 );
+
+      // the source 'b' is indexed in the reverse order and shares the entity with 'a',
+      // so it is neither monotone nor contiguous; 'c' is kept contiguous
+        std::reverse( bIds.begin(), bIds.end() );
+          bIds.push_back( aIds[10] );
+
+        auto  sources = std::vector<mtc::api<IContentsIndex>>{
+          CreateMergerSource( "a", aIds ),
+          CreateMergerSource( "b", bIds ),
+          CreateMergerSource( "c", cIds ) };
+        auto  plain = std::vector<mtc::api<IContentsIndex>>();
+        auto  merged = mtc::api<IContentsIndex>();
+        auto  merref = mtc::api<IContentsIndex>();
+
+        for ( auto& next: sources )
+          plain.push_back( new PlainBlocks( next ) );
+
+        if ( REQUIRE_NOTHROW( merged = MergeSources( sources ) ) && REQUIRE( merged != nullptr )
+          && REQUIRE_NOTHROW( merref = MergeSources( plain ) ) && REQUIRE( merref != nullptr ) )
+        {
+          SECTION( "the entities are merged with the shared id kept once" )
+          {
+            REQUIRE( merged->GetMaxIndex() == 110 );
+            REQUIRE( merged->GetKeyStats( "lite" ).nCount == 110 );
+            REQUIRE( merged->GetKeyStats( "rich" ).nCount == 110 );
+            REQUIRE( merged->GetKeyStats( "lite-c" ).nCount == 30 );
+            REQUIRE( merged->GetKeyStats( "rich-c" ).nCount == 30 );
+          }
+          SECTION( "the blocks are the same as merged reference by reference" )
+          {
+            auto  keys = ListMergedKeys( merged );
+
+            REQUIRE( keys == ListMergedKeys( merref ) );
+
+            for ( auto& key: keys )
+              REQUIRE( SameBlocks( merged, merref, key ) );
+          }
+          SECTION( "the rich blocks refer the entities renumbered" )
+          {
+            REQUIRE( RefersIds( merged, "rich" ) );
+            REQUIRE( RefersIds( merged, "rich-0" ) );
+            REQUIRE( RefersIds( merged, "rich-c" ) );
+          }
+        }
+      }
+      SECTION( "ContentsMerger merges the references of the sources ordered by the entities renumbered" )
+      {
+        auto  merged = mtc::api<IContentsIndex>();
+
+        SECTION( "* the sources renumbered monotonously are merged as is" )
+        {
+          if ( REQUIRE_NOTHROW( merged = MergeSources( {
+            CreateMergerSource( "a", { "a", "c", "e", "g" } ),
+            CreateMergerSource( "b", { "b", "d", "f" } ) } ) ) && REQUIRE( merged != nullptr ) )
+          {
+            REQUIRE( HasPostings( merged, "lite", { "a", "b", "c", "d", "e", "f", "g" } ) );
+            REQUIRE( HasPostings( merged, "lite-b", { "b", "d", "f" } ) );
+            REQUIRE( HasPostings( merged, "rich", {
+              "a:a", "b:b", "a:c", "b:d", "a:e", "b:f", "a:g" } ) );
+            REQUIRE( HasPostings( merged, "rich-a", { "a:a", "a:c", "a:e", "a:g" } ) );
+          }
+        }
+        SECTION( "* the sources renumbered in the other order are buffered and sorted" )
+        {
+          if ( REQUIRE_NOTHROW( merged = MergeSources( {
+            CreateMergerSource( "a", { "a", "c", "e", "g" } ),
+            CreateMergerSource( "b", { "f", "d", "b" } ) } ) ) && REQUIRE( merged != nullptr ) )
+          {
+            REQUIRE( HasPostings( merged, "lite", { "a", "b", "c", "d", "e", "f", "g" } ) );
+            REQUIRE( HasPostings( merged, "lite-b", { "b", "d", "f" } ) );
+            REQUIRE( HasPostings( merged, "rich", {
+              "a:a", "b:b", "a:c", "b:d", "a:e", "b:f", "a:g" } ) );
+            REQUIRE( HasPostings( merged, "rich-b", { "b:b", "b:d", "b:f" } ) );
+          }
+        }
+        SECTION( "* the references to the entities deleted or outdated are dropped" )
+        {
+          auto  source = CreateMergerSource( "a", { "a", "c", "e", "g" } );
+
+          REQUIRE( source->DelEntity( "c" ) );
+
+          if ( REQUIRE_NOTHROW( merged = MergeSources( {
+            source,
+            CreateMergerSource( "b", { "e", "d", "b" } ) } ) ) && REQUIRE( merged != nullptr ) )
+          {
+            auto  winner = GetSourceTag( merged, "e" );
+            auto  loser = std::string( winner == "a" ? "b" : "a" );
+
+          // the entity 'e' is kept by both sources, the version merged is selected
+          // by the merger and the other one is outdated
+            REQUIRE( (winner == "a" || winner == "b") );
+
+            REQUIRE( merged->GetMaxIndex() == 5 );
+            REQUIRE( HasPostings( merged, "lite", { "a", "b", "d", "e", "g" } ) );
+            REQUIRE( HasPostings( merged, "rich", {
+              "a:a", "b:b", "b:d", winner + ":e", "a:g" } ) );
+            REQUIRE( HasPostings( merged, "rich-" + winner, winner == "a" ?
+              std::vector<std::string>{ "a:a", "a:e", "a:g" } :
+              std::vector<std::string>{ "b:b", "b:d", "b:e" } ) );
+            REQUIRE( HasPostings( merged, "lite-" + loser, loser == "a" ?
+              std::vector<std::string>{ "a", "g" } :
+              std::vector<std::string>{ "b", "d" } ) );
+          }
+        }
+      }
+      SECTION( "ContentsMerger merges the key ranges in parallel with the same result" )
+      {
+        auto  serial1 = mtc::api<IStorage::ISerialized>();
+        auto  serial4 = mtc::api<IStorage::ISerialized>();
+        auto  merged = mtc::api<IContentsIndex>();
+
+      // the keys are cut to the ranges of 0x1000 keys merged by the workers
+        for ( auto nkeys: { 0x1000U, 0x1001U, 0x3005U } )
+        {
+          auto  sources = std::vector<mtc::api<IContentsIndex>>{
+            CreateRangeSource( "a", 32, nkeys ),
+            CreateRangeSource( "b", 17, nkeys / 2 ) };
+
+          if ( REQUIRE_NOTHROW( serial1 = MergeSerial( sources, 1 ) )
+            && REQUIRE_NOTHROW( serial4 = MergeSerial( sources, 4 ) ) )
+          {
+            REQUIRE( SameSerials( serial1, serial4 ) );
+
+            if ( REQUIRE_NOTHROW( merged = static_::Index().Create( serial4 ) ) && REQUIRE( merged != nullptr ) )
+            {
+              REQUIRE( ListMergedKeys( merged ).size() == nkeys );
+              REQUIRE( merged->GetKeyStats( "key00000" ).nCount == 2 );
+              REQUIRE( merged->GetKeyStats( mtc::strprintf( "key%05u", nkeys - 1 ) ).nCount == 1 );
+            }
+          }
+        }
+
+        SECTION( "* the exception thrown by a worker is passed to the caller" )
+        {
+          auto  sources = std::vector<mtc::api<IContentsIndex>>{
+            CreateRangeSource( "a", 32, 0x3005 ),
+            CreateRangeSource( "b", 17, 0x1000 ) };
+
+          for ( auto failed: { "key00010", "key05000", "key12292" } )
+          {
+            auto  failing = std::vector<mtc::api<IContentsIndex>>{
+              new PlainBlocks( sources[0], failed ),
+              sources[1] };
+
+            REQUIRE_EXCEPTION( MergeSerial( failing, 4 ), std::runtime_error );
+          }
+        }
+      }
+    }
+  } );
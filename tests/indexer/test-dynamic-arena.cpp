@@ -0,0 +1,108 @@
+# include "../../src/indexer/dynamic-arena.hpp"
+# include <mtc/test-it-easy.hpp>
+# include <algorithm>
+# include <vector>
+# include <thread>
+# include <memory>
+
+using namespace DelphiX::indexer::dynamic;
+
+TestItEasy::RegisterFunc  dynamic_arena( []()
+  {
+    TEST_CASE( "index/dynamic-arena" )
+    {
+      SECTION( "SlabArena allocates aligned blocks from thread slabs" )
+      {
+        SlabArena arena( 0x1000 );
+        auto      palloc = (char*)nullptr;
+
+        REQUIRE( arena.memusage() == 0 );
+
+        if ( REQUIRE_NOTHROW( palloc = (char*)arena.allocate( 3, 1 ) ) && REQUIRE( palloc != nullptr ) )
+        {
+          REQUIRE( arena.memusage() == 3 );
+
+          SECTION( "next blocks are aligned" )
+          {
+            auto  pnext = (char*)arena.allocate( 8, 8 );
+
+            REQUIRE( size_t(pnext) % 8 == 0 );
+            REQUIRE( pnext >= palloc + 3 );
+            REQUIRE( arena.memusage() == 11 );
+          }
+          SECTION( "large blocks are allocated directly and counted at once" )
+          {
+            REQUIRE_NOTHROW( arena.allocate( 0x1000, 8 ) );
+            REQUIRE( arena.memusage() == 11 + 0x1000 );
+          }
+        }
+      }
+      SECTION( "SlabArena::allocator may be used with containers" )
+      {
+        SlabArena arena;
+        auto      values = std::vector<int, SlabArena::allocator<int>>( arena.get_allocator<int>() );
+
+        for ( int i = 0; i != 1000; ++i )
+          values.push_back( i );
+
+        REQUIRE( values.size() == 1000 );
+        REQUIRE( values.back() == 999 );
+        REQUIRE( arena.memusage() >= 1000 * sizeof(int) );
+      }
+      SECTION( "SlabArena may be used by multiple threads, the counts are aggregated" )
+      {
+        SlabArena arena( 0x1000 );
+        auto      writers = std::vector<std::thread>();
+
+        for ( int i = 0; i != 4; ++i )
+          writers.emplace_back( [&]()
+            {
+              for ( int j = 0; j != 0x4000; ++j )
+                *(uint64_t*)arena.allocate( 8, 8 ) = j;
+            } );
+
+        for ( auto& next: writers )
+          next.join();
+
+        REQUIRE( arena.memusage() == 4 * 8 * 0x4000 );
+      }
+      SECTION( "SlabArena counts the space left in the slab replaced" )
+      {
+        SlabArena arena( 0x1000 );
+
+        for ( int i = 0; i != 15; ++i )
+          arena.allocate( 0x100, 8 );
+
+        REQUIRE( arena.memusage() == 0xf00 );
+
+        REQUIRE_NOTHROW( arena.allocate( 0x180, 8 ) );
+        REQUIRE( arena.memusage() == 0xf00 + 0x100 + 0x180 );
+      }
+      SECTION( "SlabArena slab evicted by the other arenas is counted by its owner" )
+      {
+        auto  arenas = std::vector<std::unique_ptr<SlabArena>>();
+        auto  counts = std::vector<size_t>();
+
+      // the thread has the slabs of four arenas, so the fifth one evicts a slab
+      // with the allocation not counted yet and the space left in it
+        std::thread( [&]()
+          {
+            for ( int i = 0; i != 5; ++i )
+              arenas.emplace_back( new SlabArena( 0x1000 ) );
+            for ( auto& next: arenas )
+              next->allocate( 8, 8 );
+            for ( auto& next: arenas )
+              counts.push_back( next->memusage() );
+          } ).join();
+
+        REQUIRE( std::count( counts.begin(), counts.end(), 8 ) == 4 );
+        REQUIRE( std::count( counts.begin(), counts.end(), 0x1000 ) == 1 );
+
+        SECTION( "the counts are flushed when the thread exits" )
+        {
+          for ( auto& next: arenas )
+            REQUIRE( next->memusage() == 0x1000 );
+        }
+      }
+    }
+  } );
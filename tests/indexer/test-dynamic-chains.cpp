@@ -1,11 +1,35 @@
 # include "../../src/indexer/dynamic-chains.hpp"
 # include <mtc/test-it-easy.hpp>
+# include <mtc/byteBuffer.h>
 # include <mtc/arena.hpp>
 # include <thread>
 
 using namespace DelphiX;
 using namespace DelphiX::indexer;
 
+class MockSpillage: public IStorage::IDumpStore
+{
+  implement_lifetime_stub
+
+public:
+  auto  Get( int64_t pos ) const -> mtc::api<const mtc::IByteBuffer> override
+  {
+    auto  getbuf = mtc::CreateByteBuffer( blocks[pos].size(), mtc::enable_exceptions );
+
+    memcpy( (void*)getbuf->GetPtr(), blocks[pos].data(), blocks[pos].size() );
+    return getbuf.ptr();
+  }
+  auto  Put( const void* pv, size_t cb ) -> int64_t override
+  {
+    blocks.emplace_back( (const char*)pv, cb );
+    return int64_t(blocks.size() - 1);
+  }
+
+public:
+  std::vector<std::string>  blocks;
+
+};
+
 TestItEasy::RegisterFunc  dynamic_chains( []()
   {
     TEST_CASE( "index/dynamic-chains" )
@@ -34,6 +58,24 @@ TestItEasy::RegisterFunc  dynamic_chains( []()
           if ( REQUIRE( chains.Lookup( "k2" ) != nullptr ) )
             REQUIRE( chains.Lookup( "k2" )->ncount == 1U );
         }
+        SECTION( "entities appended and inserted out of order are listed in increment order" )
+        {
+          if ( REQUIRE( chains.Lookup( "k1" ) != nullptr ) )
+          {
+            auto  cursor = dynamic::BlockChains<>::Cursor( chains.Lookup( "k1" ) );
+
+            REQUIRE( cursor.Curr().uEntity == 1U );
+            REQUIRE( cursor.Curr().details == "aaa" );
+            REQUIRE( cursor.Next().uEntity == 2U );
+            REQUIRE( cursor.Curr().details == "xxx" );
+            REQUIRE( cursor.Next().uEntity == 3U );
+            REQUIRE( cursor.Curr().details == "ttt" );
+            REQUIRE( cursor.Next().uEntity == 4U );
+            REQUIRE( cursor.Curr().details == "zzz" );
+            REQUIRE( cursor.Next().uEntity == uint32_t(-1) );
+          }
+          REQUIRE( chains.Verify() );
+        }
       }
       SECTION( "BlockChains may be created in Arena" )
       {
@@ -56,6 +98,51 @@ TestItEasy::RegisterFunc  dynamic_chains( []()
 
         chains->StopIt();
       }
+      SECTION( "the largest chains may be spilled to the dump store" )
+      {
+        auto  chains = dynamic::BlockChains<>();
+        auto  spills = MockSpillage();
+
+        for ( uint32_t entity = 1; entity <= 10000; ++entity )
+        {
+          chains.Insert( "large", entity, { "block", 5 }, -1 );
+
+          if ( entity % 100 == 0 )
+            chains.Insert( "small", entity, { "block", 5 }, -1 );
+        }
+
+        SECTION( "only the chains large enough are spilled, the pages read are not reused" )
+        {
+          auto  cursor = dynamic::BlockChains<>::Cursor( chains.Lookup( "large" ) );
+
+          REQUIRE( chains.Spill( &spills, 1 ) > 0 );
+          REQUIRE( spills.blocks.size() == 1 );
+          REQUIRE( chains.GetPooled() == 0 );
+
+          REQUIRE( cursor.Curr().uEntity == 1U );
+          REQUIRE( cursor.Curr().details == "block" );
+        }
+        SECTION( "the pages are reused after the cursors are closed" )
+        {
+          REQUIRE( chains.Spill( &spills, 0 ) == 0 );
+          REQUIRE( chains.GetPooled() > 0 );
+        }
+        SECTION( "spilled entities are listed before the pages" )
+        {
+          auto  nfound = uint32_t(0);
+
+          chains.Insert( "large", 10001, { "block", 5 }, -1 );
+
+          for ( auto cursor = dynamic::BlockChains<>::Cursor( chains.Lookup( "large" ) );
+            cursor.Curr().uEntity == nfound + 1 && cursor.Curr().details == "block"; cursor.Next() )
+              ++nfound;
+
+          REQUIRE( nfound == 10001U );
+          REQUIRE( chains.Lookup( "large" )->ncount == 10001U );
+          REQUIRE( chains.Lookup( "small" )->ncount == 100U );
+          REQUIRE( chains.Verify() );
+        }
+      }
       SECTION( "BlockChains provide correct inserion order in multithreaded environments" )
       {
         auto  chains = dynamic::BlockChains<>();
@@ -225,6 +225,80 @@ TestItEasy::RegisterFunc  dynamic_contents( []()
             { "bbb", 1161 } } ).ptr() ), index_overflow );
         }
       }
+      SECTION( "dynamic::contents notifies the owner once the soft mark is passed" )
+      {
+        auto  nfilled = 0;
+        auto  pfilled = (void*)nullptr;
+
+        REQUIRE_NOTHROW( contents = dynamic::Index()
+          .Set( dynamic::Settings()
+            .SetMaxEntities( 6 )
+            .SetSoftPercent( 50 ) )
+          .Set( [&]( void* to ){  ++nfilled, pfilled = to;  } )
+          .Create() );
+
+        REQUIRE_NOTHROW( contents->SetEntity( "aaa", KeyValues( { { "aaa", 1161 } } ).ptr() ) );
+          REQUIRE( nfilled == 0 );
+        REQUIRE_NOTHROW( contents->SetEntity( "bbb", KeyValues( { { "bbb", 1162 } } ).ptr() ) );
+          REQUIRE( nfilled == 0 );
+        REQUIRE_NOTHROW( contents->SetEntity( "ccc", KeyValues( { { "ccc", 1163 } } ).ptr() ) );
+          REQUIRE( nfilled == 1 );
+          REQUIRE( pfilled == (void*)contents.ptr() );
+        REQUIRE_NOTHROW( contents->SetEntity( "ddd", KeyValues( { { "ddd", 1164 } } ).ptr() ) );
+          REQUIRE( nfilled == 1 );
+      }
+      SECTION( "dynamic::contents snapshot is not affected by later changes" )
+      {
+        auto  snapshot = mtc::api<IContentsIndex>();
+        auto  entities = mtc::api<IContentsIndex::IEntities>();
+
+        REQUIRE_NOTHROW( contents = dynamic::Index().Create() );
+
+        REQUIRE_NOTHROW( contents->SetEntity( "aaa", KeyValues( { { "k1", 1161 } } ).ptr() ) );
+        REQUIRE_NOTHROW( contents->SetEntity( "bbb", KeyValues( { { "k1", 1162 } } ).ptr() ) );
+
+        REQUIRE_NOTHROW( snapshot = contents->Snapshot() );
+
+        REQUIRE_NOTHROW( contents->SetEntity( "ccc", KeyValues( { { "k1", 1163 } } ).ptr() ) );
+        REQUIRE_NOTHROW( contents->SetEntity( "bbb", KeyValues( { { "k1", 1164 } } ).ptr() ) );
+        REQUIRE_NOTHROW( contents->DelEntity( "aaa" ) );
+
+        SECTION( "snapshot keeps the max index" )
+        {
+          REQUIRE( snapshot->GetMaxIndex() == 2U );
+          REQUIRE( contents->GetMaxIndex() == 4U );
+        }
+        SECTION( "entities deleted or replaced later are visible in the snapshot, new ones are not" )
+        {
+          if ( REQUIRE_NOTHROW( entity = snapshot->GetEntity( "aaa" ) ) && REQUIRE( entity != nullptr ) )
+            REQUIRE( entity->GetIndex() == 1U );
+          if ( REQUIRE_NOTHROW( entity = snapshot->GetEntity( "bbb" ) ) && REQUIRE( entity != nullptr ) )
+            REQUIRE( entity->GetIndex() == 2U );
+          if ( REQUIRE_NOTHROW( entity = snapshot->GetEntity( 1U ) ) && REQUIRE( entity != nullptr ) )
+            REQUIRE( entity->GetId() == "aaa" );
+          REQUIRE( snapshot->GetEntity( "ccc" ) == nullptr );
+          REQUIRE( snapshot->GetEntity( 3U ) == nullptr );
+          REQUIRE( contents->GetEntity( "aaa" ) == nullptr );
+        }
+        SECTION( "key blocks are limited by the snapshot" )
+        {
+          if ( REQUIRE_NOTHROW( entities = snapshot->GetKeyBlock( "k1" ) ) && REQUIRE( entities != nullptr ) )
+          {
+            REQUIRE( entities->Find( 0 ).uEntity == 1U );
+            REQUIRE( entities->Find( 2 ).uEntity == 2U );
+            REQUIRE( entities->Find( 3 ).uEntity == uint32_t(-1) );
+          }
+          if ( REQUIRE_NOTHROW( entities = contents->GetKeyBlock( "k1" ) ) && REQUIRE( entities != nullptr ) )
+          {
+            REQUIRE( entities->Find( 0 ).uEntity == 3U );
+            REQUIRE( entities->Find( 4 ).uEntity == 4U );
+          }
+        }
+        SECTION( "snapshot is read-only" )
+        {
+          REQUIRE_EXCEPTION( snapshot->DelEntity( "bbb" ), std::logic_error );
+        }
+      }
       SECTION( "created with storage sink, it saves index as static" )
       {
         auto  sink = storage::posixFS::CreateSink( storage::posixFS::StoragePolicies::Open(
@@ -0,0 +1,168 @@
+# include "../../indexer/executor.hpp"
+# include <mtc/test-it-easy.hpp>
+# include <condition_variable>
+# include <atomic>
+# include <string>
+
+using namespace DelphiX::indexer;
+
+class Waiter
+{
+  std::mutex              mxlock;
+  std::condition_variable mxwait;
+  int                     ncount = 0;
+  bool                    opened = false;
+
+public:
+  void  Done()
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxlock );
+      ++ncount;
+    mxwait.notify_all();
+  }
+  bool  Wait( int count )
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxlock );
+
+    return mxwait.wait_for( exlock, std::chrono::seconds( 5 ), [&](){  return ncount >= count;  } );
+  }
+  void  Open()
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxlock );
+      opened = true;
+    mxwait.notify_all();
+  }
+  void  Gate()
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxlock );
+      mxwait.wait( exlock, [&](){  return opened;  } );
+  }
+  int   Count()
+  {
+    auto  exlock = std::unique_lock<std::mutex>( mxlock );
+      return ncount;
+  }
+};
+
+TestItEasy::RegisterFunc  executor( []()
+  {
+    TEST_CASE( "index/executor" )
+    {
+      SECTION( "Executor runs the tasks queued" )
+      {
+        auto  waiter = Waiter();
+        auto  runner = Executor( 2 );
+
+        for ( int i = 0; i != 10; ++i )
+          runner.Run( Executor::housekeeping, nullptr, [&](){  waiter.Done();  } );
+
+        REQUIRE( waiter.Wait( 10 ) );
+      }
+      SECTION( "the tasks are run by the priority classes" )
+      {
+        auto  waiter = Waiter();
+        auto  sorder = std::string();
+        auto  runner = Executor( 1 );
+
+        runner.Run( Executor::commit, nullptr, [&](){  waiter.Gate();  } );
+        runner.Run( Executor::housekeeping, nullptr, [&](){  sorder += 'h';  waiter.Done();  } );
+        runner.Run( Executor::merge, nullptr, [&](){  sorder += 'm';  waiter.Done();  } );
+        runner.Run( Executor::commit, nullptr, [&](){  sorder += 'c';  waiter.Done();  } );
+        waiter.Open();
+
+        if ( REQUIRE( waiter.Wait( 3 ) ) )
+          REQUIRE( sorder == "cmh" );
+      }
+      SECTION( "the merges do not take the last thread" )
+      {
+        auto  waiter = Waiter();
+        auto  merged = std::atomic_int( 0 );
+        auto  runner = Executor( 2 );
+
+        runner.Run( Executor::merge, nullptr, [&](){  waiter.Gate();  ++merged;  } );
+        runner.Run( Executor::merge, nullptr, [&](){  ++merged;  } );
+        runner.Run( Executor::commit, nullptr, [&](){  waiter.Done();  } );
+
+        REQUIRE( waiter.Wait( 1 ) );
+        REQUIRE( merged == 0 );
+
+        waiter.Open();
+        runner.Run( Executor::housekeeping, nullptr, [&](){  waiter.Done();  } );
+
+        if ( REQUIRE( waiter.Wait( 2 ) ) )
+          REQUIRE( runner.GetThreads() == 2U );
+      }
+      SECTION( "the merge run by the single thread does not block the commits" )
+      {
+        auto  waiter = Waiter();
+        auto  merged = std::atomic_int( 0 );
+        auto  runner = Executor( 1 );
+
+        runner.Run( Executor::merge, nullptr, [&](){  waiter.Gate();  ++merged;  } );
+        runner.Run( Executor::merge, nullptr, [&](){  ++merged;  } );
+        runner.Run( Executor::commit, nullptr, [&](){  waiter.Done();  } );
+        runner.Run( Executor::housekeeping, nullptr, [&](){  waiter.Done();  } );
+
+        REQUIRE( waiter.Wait( 2 ) );
+        REQUIRE( merged == 0 );
+
+        waiter.Open();
+        runner.Run( Executor::merge, nullptr, [&](){  ++merged;  waiter.Done();  } );
+
+        if ( REQUIRE( waiter.Wait( 3 ) ) )
+          REQUIRE( runner.GetThreads() == 1U );
+      }
+      SECTION( "the tasks not started may be cancelled by the owner" )
+      {
+        auto  waiter = Waiter();
+        int   owner;
+        auto  runner = Executor( 1 );
+
+        runner.Run( Executor::commit, nullptr, [&](){  waiter.Gate();  } );
+
+        for ( int i = 0; i != 3; ++i )
+          runner.Run( Executor::merge, &owner, [&](){  waiter.Done();  } );
+        runner.Run( Executor::merge, &owner, [&](){  waiter.Done();  }, std::chrono::milliseconds( 10 ) );
+
+        REQUIRE( runner.Cancel( &owner ) == 4U );
+
+        waiter.Open();
+        runner.Run( Executor::housekeeping, nullptr, [&](){  waiter.Done();  } );
+
+        if ( REQUIRE( waiter.Wait( 1 ) ) )
+          REQUIRE( waiter.Count() == 1 );
+      }
+      SECTION( "the delayed tasks are run after the delay" )
+      {
+        auto  waiter = Waiter();
+        auto  tstart = Executor::Clock::now();
+        auto  tfinal = tstart;
+        auto  runner = Executor( 1 );
+
+        runner.Run( Executor::housekeeping, nullptr, [&]()
+          {
+            tfinal = Executor::Clock::now();
+            waiter.Done();
+          }, std::chrono::milliseconds( 50 ) );
+
+        if ( REQUIRE( waiter.Wait( 1 ) ) )
+          REQUIRE( tfinal - tstart >= std::chrono::milliseconds( 50 ) );
+      }
+      SECTION( "the count of threads may be changed" )
+      {
+        auto  waiter = Waiter();
+        auto  runner = Executor( 1 );
+
+        runner.Run( Executor::commit, nullptr, [&](){  waiter.Gate();  waiter.Done();  } );
+        runner.SetThreads( 2 );
+        runner.Run( Executor::commit, nullptr, [&](){  waiter.Done();  } );
+
+        REQUIRE( waiter.Wait( 1 ) );
+
+        waiter.Open();
+
+        REQUIRE( waiter.Wait( 2 ) );
+        REQUIRE( runner.SetThreads( 1 ).GetThreads() == 1U );
+      }
+    }
+  } );
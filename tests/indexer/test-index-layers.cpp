@@ -56,6 +56,13 @@ auto  CreateStaticIndex( const mtc::zmap& ix ) -> mtc::api<IContentsIndex>
   return static_::Index().Create( serial );
 }
 
+class PlacedLayers: public IndexLayers
+{
+public:
+  using IndexLayers::layers;
+  using IndexLayers::setLayer;
+};
+
 TestItEasy::RegisterFunc  index_layers( []()
   {
     TEST_CASE( "index/index-layers" )
@@ -184,5 +191,101 @@ TestItEasy::RegisterFunc  index_layers( []()
           }
         }
       }
+      SECTION( "IndexLayers may map entities to the layers with the entity directory" )
+      {
+        IndexLayers  flakes;
+
+        REQUIRE_NOTHROW( flakes.addContents( CreateStaticIndex( {
+          { "i1", mtc::zmap{
+            { "aaa", "aaa" } } },
+          { "i2", mtc::zmap{
+            { "bbb", "bbb" } } },
+          { "i3", mtc::zmap{
+            { "ccc", "ccc" } } },
+        } ) ) );
+        REQUIRE_NOTHROW( flakes.addContents( CreateStaticIndex( {
+          { "i3", mtc::zmap{
+            { "ddd", "ddd" } } },
+          { "i4", mtc::zmap{
+            { "eee", "eee" } } },
+          } ) ) );
+
+        SECTION( "the shadowed versions of entities are hidden" )
+        {
+          auto  entities = mtc::api<IContentsIndex::IEntities>();
+
+          REQUIRE_NOTHROW( flakes.hideClashes() );
+
+          if ( REQUIRE( flakes.getEntity( "i3" ) != nullptr ) )
+            REQUIRE( flakes.getEntity( "i3" )->GetIndex() == 4 );
+
+          REQUIRE( flakes.getEntity( 3U ) == nullptr );
+
+          if ( (entities = flakes.getKeyBlock( "ccc" )) != nullptr )
+            REQUIRE( entities->Find( 1 ).uEntity == uint32_t(-1) );
+        }
+        SECTION( "the entities are found in the layers holding them" )
+        {
+          if ( REQUIRE( flakes.getEntity( "i1" ) != nullptr ) )
+            REQUIRE( flakes.getEntity( "i1" )->GetIndex() == 1 );
+          if ( REQUIRE( flakes.getEntity( "i4" ) != nullptr ) )
+            REQUIRE( flakes.getEntity( "i4" )->GetIndex() == 5 );
+
+          REQUIRE( flakes.getEntity( "i0" ) == nullptr );
+        }
+        SECTION( "the entities are deleted in the layers holding them" )
+        {
+          REQUIRE( flakes.delEntity( "i0" ) == false );
+          REQUIRE( flakes.delEntity( "i4" ) == true );
+          REQUIRE( flakes.delEntity( "i4" ) == false );
+          REQUIRE( flakes.getEntity( "i4" ) == nullptr );
+          REQUIRE( flakes.getEntity( "i3" ) != nullptr );
+        }
+        SECTION( "the extras are set in the layers holding the entities" )
+        {
+          REQUIRE( flakes.setExtras( "i4", "extras" ) == nullptr );
+
+          if ( REQUIRE( flakes.setExtras( "i3", "extras" ) != nullptr ) )
+            REQUIRE( flakes.getEntity( "i3" )->GetIndex() == 4 );
+        }
+      }
+      SECTION( "IndexLayers stashes the versions replaced by the newer layers" )
+      {
+        PlacedLayers flakes;
+
+        REQUIRE_NOTHROW( flakes.addContents( CreateStaticIndex( {
+          { "i1", mtc::zmap{
+            { "aaa", "aaa" } } },
+          { "i2", mtc::zmap{
+            { "bbb", "bbb" } } },
+        } ) ) );
+        REQUIRE_NOTHROW( flakes.addContents( CreateStaticIndex( {
+          { "i3", mtc::zmap{
+            { "ccc", "ccc" } } },
+          } ) ) );
+        REQUIRE_NOTHROW( flakes.hideClashes() );
+
+        SECTION( "the version replaced is stashed by the layer and counted deleted" )
+        {
+          auto  entities = mtc::api<IContentsIndex::IEntities>();
+
+          REQUIRE_NOTHROW( flakes.setLayer( "i1", flakes.layers[1] ) );
+
+          REQUIRE( flakes.layers[0].pIndex->GetEntity( "i1" ) == nullptr );
+          REQUIRE( flakes.layers[0].pIndex->GetIndexStats().nDeleted == 1 );
+          REQUIRE( flakes.layers[1].pIndex->GetIndexStats().nDeleted == 0 );
+          REQUIRE( flakes.getEntity( 1U ) == nullptr );
+
+          if ( REQUIRE( (entities = flakes.getKeyBlock( "aaa" )) != nullptr ) )
+            REQUIRE( entities->Find( 1 ).uEntity == uint32_t(-1) );
+          if ( REQUIRE( (entities = flakes.getKeyBlock( "bbb" )) != nullptr ) )
+            REQUIRE( entities->Find( 1 ).uEntity == 2 );
+        }
+        SECTION( "the entity replaced is deleted in all the layers" )
+        {
+          REQUIRE( flakes.delEntity( "i1" ) == true );
+          REQUIRE( flakes.layers[0].pIndex->GetEntity( "i1" ) == nullptr );
+        }
+      }
     }
   } );
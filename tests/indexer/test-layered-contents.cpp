@@ -71,7 +71,7 @@ public:
   auto  GetKeyBlock( const std::string_view& ) const -> mtc::api<IEntities> override
     {  return nullptr;  }
   auto  GetKeyStats( const std::string_view& ) const -> BlockInfo override
-    {  return { uint32_t(-1), 0 };  }
+    {  return ++nstats, BlockInfo{ 0, 1 };  }
   auto  ListEntities( EntityId ) -> mtc::api<IEntitiesList> override NOT_IMPLEMENTED
   auto  ListEntities( uint32_t ) -> mtc::api<IEntitiesList> override NOT_IMPLEMENTED
   auto  ListContents( const std::string_view& ) -> mtc::api<IContentsList> override NOT_IMPLEMENTED
@@ -83,6 +83,9 @@ public:
   void  Stash( EntityId ) override
     {}
 
+public:
+  mutable uint32_t  nstats = 0;
+
 };
 
 TestItEasy::RegisterFunc  layered_contents( []()
@@ -105,6 +108,7 @@ TestItEasy::RegisterFunc  layered_contents( []()
             REQUIRE( index->GetMaxIndex() == 0 );
             REQUIRE( index->Reduce().ptr() == index.ptr() );
             REQUIRE_EXCEPTION( index->SetEntity( "i1" ), std::logic_error );
+            REQUIRE_EXCEPTION( index->ForceMerge( 1 ).get(), std::logic_error );
             REQUIRE_NOTHROW( index->Commit() );
           }
         }
@@ -124,6 +128,45 @@ TestItEasy::RegisterFunc  layered_contents( []()
             REQUIRE( index->GetMaxIndex() == 1 );
           }
         }
+        SECTION( "key statistics of the layers not changed are cached" )
+        {
+          auto  mocked = mtc::api<MockDynamic>( new MockDynamic() );
+
+          if ( REQUIRE_NOTHROW( index = layered::Index::Create( std::vector<mtc::api<IContentsIndex>>{
+            mocked.ptr(), mocked.ptr() } ) ) )
+          {
+            REQUIRE( index->GetKeyStats( "aaa" ).nCount == 2 );
+            REQUIRE( index->GetKeyStats( "aaa" ).nCount == 2 );
+            REQUIRE( mocked->nstats == 2 );
+            REQUIRE( index->GetKeyStats( "bbb" ).nCount == 2 );
+            REQUIRE( mocked->nstats == 4 );
+          }
+        }
+        SECTION( "it may be split to the partitions by the layers" )
+        {
+          auto  mocked = mtc::api<MockDynamic>( new MockDynamic() );
+          auto  parted = std::vector<mtc::api<IContentsIndex>>();
+
+          if ( REQUIRE_NOTHROW( index = layered::Index::Create( std::vector<mtc::api<IContentsIndex>>{
+            mocked.ptr(), mocked.ptr() } ) ) )
+          {
+            REQUIRE( layered::Index::Partition( index, 1 ).size() == 1U );
+            REQUIRE( layered::Index::Partition( index, 5 ).size() == 2U );
+
+            if ( REQUIRE_NOTHROW( parted = layered::Index::Partition( index, 2 ) ) && REQUIRE( parted.size() == 2U ) )
+            {
+              REQUIRE( parted[0]->GetMaxIndex() == index->GetMaxIndex() );
+              REQUIRE( parted[1]->GetKeyStats( "aaa" ).nCount == 2 );
+
+              if ( REQUIRE( parted[1]->GetEntity( 2U ) != nullptr ) )
+                REQUIRE( parted[1]->GetEntity( 2U )->GetIndex() == 1U );
+
+              REQUIRE_EXCEPTION( parted[0]->SetEntity( "i1" ), std::logic_error );
+              REQUIRE_EXCEPTION( parted[0]->DelEntity( "i1" ), std::logic_error );
+            }
+          }
+          REQUIRE( layered::Index::Partition( mocked.ptr(), 2 ).size() == 1U );
+        }
       }
     }
   } );
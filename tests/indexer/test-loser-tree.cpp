@@ -0,0 +1,93 @@
+# include "../../src/indexer/loser-tree.hpp"
+# include <mtc/test-it-easy.hpp>
+# include <string>
+# include <vector>
+
+using namespace DelphiX::indexer;
+
+struct Source
+{
+  std::vector<std::string>  keys;
+  size_t                    ipos = 0;
+
+  auto  Curr() const -> std::string {  return ipos < keys.size() ? keys[ipos] : std::string();  }
+};
+
+static  auto  MergeAll( std::vector<Source>& sources ) -> std::vector<std::pair<std::string, size_t>>
+{
+  auto  merged = std::vector<std::pair<std::string, size_t>>();
+  auto  select = LoserTree( sources.size(), [&]( size_t a, size_t b )
+    {
+      return !sources[a].Curr().empty() && (sources[b].Curr().empty() || sources[a].Curr() < sources[b].Curr());
+    } );
+
+  while ( !sources[select.Top()].Curr().empty() )
+  {
+    merged.emplace_back( sources[select.Top()].Curr(), select.Top() );
+      ++sources[select.Top()].ipos;
+    select.Update();
+  }
+  return merged;
+}
+
+TestItEasy::RegisterFunc  loser_tree( []()
+  {
+    TEST_CASE( "index/loser-tree" )
+    {
+      SECTION( "LoserTree selects the lowest of the sources" )
+      {
+        auto  sources = std::vector<Source>{
+          { { "b", "e", "h" } },
+          { { "a", "d" } },
+          { {} },
+          { { "c", "e", "f", "g" } },
+          { { "e" } } };
+        auto  merged = MergeAll( sources );
+
+        if ( REQUIRE( merged.size() == 10U ) )
+        {
+          REQUIRE( merged[0].first == "a" );
+          REQUIRE( merged[1].first == "b" );
+          REQUIRE( merged[9].first == "h" );
+        }
+        SECTION( "the equal values are selected in the order of the sources" )
+        {
+          if ( REQUIRE( merged.size() > 6U ) )
+          {
+            REQUIRE( merged[4].first == "e" );
+              REQUIRE( merged[4].second == 0U );
+            REQUIRE( merged[5].first == "e" );
+              REQUIRE( merged[5].second == 3U );
+            REQUIRE( merged[6].first == "e" );
+              REQUIRE( merged[6].second == 4U );
+          }
+        }
+      }
+      SECTION( "LoserTree scans a few sources with the same order" )
+      {
+        auto  sources = std::vector<Source>{
+          { { "b", "e" } },
+          { { "a", "e" } },
+          { { "e", "f" } } };
+        auto  merged = MergeAll( sources );
+
+        if ( REQUIRE( merged.size() == 6U ) )
+        {
+          REQUIRE( merged[0].first == "a" );
+          REQUIRE( merged[2].first == "e" );
+            REQUIRE( merged[2].second == 0U );
+          REQUIRE( merged[3].first == "e" );
+            REQUIRE( merged[3].second == 1U );
+          REQUIRE( merged[4].first == "e" );
+            REQUIRE( merged[4].second == 2U );
+          REQUIRE( merged[5].first == "f" );
+        }
+      }
+      SECTION( "LoserTree works with the single source" )
+      {
+        auto  sources = std::vector<Source>{ { { "a", "b" } } };
+
+        REQUIRE( MergeAll( sources ).size() == 2U );
+      }
+    }
+  } );
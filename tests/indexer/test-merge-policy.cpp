@@ -0,0 +1,108 @@
+# include "../../indexer/merge-policy.hpp"
+# include <mtc/test-it-easy.hpp>
+# include <vector>
+# include <cmath>
+
+using namespace DelphiX;
+using namespace DelphiX::indexer;
+
+auto  MakeLayers( const std::vector<uint64_t>& sizes, size_t nbusy = 0 ) -> std::vector<IMergePolicy::Layer>
+{
+  auto  layers = std::vector<IMergePolicy::Layer>();
+
+  for ( auto size: sizes )
+    layers.push_back( { { 1000, 0, size }, layers.size() >= nbusy } );
+
+  return layers;
+}
+
+TestItEasy::RegisterFunc  merge_policy( []()
+  {
+    TEST_CASE( "index/merge-policy" )
+    {
+      const uint64_t  mb = 1024 * 1024;
+
+      SECTION( "Tiered policy merges the segments of one tier" )
+      {
+        auto  policy = merge::Tiered()
+          .SetMaxSegments( 4 )
+          .SetMaxMergeAtOnce( 3 )
+          .SetFloorSize( 1 * mb )
+          .SetTargetSize( 256 * mb ).Create();
+
+        SECTION( "while the tier is not full, nothing is merged" )
+        {
+          auto  layers = MakeLayers( { 100 * mb, 1 * mb, 1 * mb, 1 * mb } );
+          auto  select = policy->Select( layers.data(), layers.size() );
+
+          REQUIRE( select.first == select.second );
+        }
+        SECTION( "the smallest segments of a full tier are merged" )
+        {
+          auto  layers = MakeLayers( { 100 * mb, 1 * mb, 1 * mb, 1 * mb, 1 * mb } );
+          auto  select = policy->Select( layers.data(), layers.size() );
+
+          REQUIRE( select.first == 2U );
+          REQUIRE( select.second == 5U );
+        }
+        SECTION( "the segments not to be merged are skipped" )
+        {
+          auto  layers = MakeLayers( { 1 * mb, 1 * mb, 1 * mb, 1 * mb }, 1 );
+          auto  select = policy->Select( layers.data(), layers.size() );
+
+          REQUIRE( select.first == select.second );
+        }
+        SECTION( "the segment with many deleted entities is reclaimed" )
+        {
+          auto  layers = MakeLayers( { 100 * mb, 10 * mb } );
+          auto  select = std::pair<size_t, size_t>();
+
+          layers[0].stats.nDeleted = 300;
+          select = policy->Select( layers.data(), layers.size() );
+
+          REQUIRE( select.first == 0U );
+          REQUIRE( select.second == 1U );
+        }
+        SECTION( "the write amplification is reported by tiers count" )
+        {
+          REQUIRE( std::fabs( policy->WriteAmplification() - 5.0 ) < 0.001 );
+        }
+      }
+      SECTION( "Leveled policy merges the segments violating the level ratio" )
+      {
+        auto  policy = merge::Leveled()
+          .SetFanout( 10 )
+          .SetMaxSegments( 2 )
+          .SetFloorSize( 1 * mb )
+          .SetTargetSize( 1000 * mb ).Create();
+
+        SECTION( "small segments are tolerated up to the limit" )
+        {
+          auto  layers = MakeLayers( { 100 * mb, 1 * mb, 1 * mb } );
+          auto  select = policy->Select( layers.data(), layers.size() );
+
+          REQUIRE( select.first == select.second );
+        }
+        SECTION( "small segments over the limit are merged" )
+        {
+          auto  layers = MakeLayers( { 100 * mb, 1 * mb, 1 * mb, 1 * mb } );
+          auto  select = policy->Select( layers.data(), layers.size() );
+
+          REQUIRE( select.first == 1U );
+          REQUIRE( select.second == 4U );
+        }
+        SECTION( "the larger level is merged with the smaller ones violating it" )
+        {
+          auto  layers = MakeLayers( { 100 * mb, 9 * mb, 5 * mb } );
+          auto  select = policy->Select( layers.data(), layers.size() );
+
+          REQUIRE( select.first == 0U );
+          REQUIRE( select.second == 3U );
+        }
+        SECTION( "the write amplification grows with fanout" )
+        {
+          REQUIRE( std::fabs( policy->WriteAmplification() - 17.5 ) < 0.001 );
+        }
+      }
+    }
+  } );
@@ -0,0 +1,138 @@
+# include "../../indexer/rate-limiter.hpp"
+# include <mtc/test-it-easy.hpp>
+# include <string>
+# include <thread>
+
+using namespace DelphiX;
+using namespace DelphiX::indexer;
+
+class MockStream: public mtc::IByteStream
+{
+  implement_lifetime_stub
+
+public:
+  uint32_t  Get( void*, uint32_t ) override {  return 0;  }
+  uint32_t  Put( const void*, uint32_t l ) override {  return written += l, l;  }
+
+public:
+  uint64_t  written = 0;
+
+};
+
+class MockStore: public IStorage::IIndexStore
+{
+  implement_lifetime_stub
+
+public:
+  auto  Entities() -> mtc::api<mtc::IByteStream> override {  return &stream;  }
+  auto  Contents() -> mtc::api<mtc::IByteStream> override {  return nullptr;  }
+  auto  Linkages() -> mtc::api<mtc::IByteStream> override {  return nullptr;  }
+  auto  Packages() -> mtc::api<IStorage::IDumpStore> override {  return nullptr;  }
+
+  auto  Commit() -> mtc::api<IStorage::ISerialized> override {  return nullptr;  }
+  void  Remove() override {}
+
+public:
+  MockStream  stream;
+
+};
+
+TestItEasy::RegisterFunc  rate_limiter( []()
+  {
+    TEST_CASE( "index/rate-limiter" )
+    {
+      SECTION( "unlimited TokenBucket counts the bytes passed" )
+      {
+        auto  limiter = io::TokenBucket().Create();
+
+        for ( int i = 0; i != 10; ++i )
+          limiter->Acquire( 1000 );
+
+        REQUIRE( limiter->GetStats().cbTotal == 10000U );
+        REQUIRE( limiter->GetStats().cbLimit == 0U );
+      }
+      SECTION( "TokenBucket limits the rate after the burst" )
+      {
+        auto  limiter = io::TokenBucket()
+          .SetBytesPerSec( 1024 * 1024 )
+          .SetBurstSize( 64 * 1024 ).Create();
+        auto  tstart = std::chrono::steady_clock::now();
+
+        for ( int i = 0; i != 5; ++i )
+          limiter->Acquire( 64 * 1024 );
+
+        REQUIRE( std::chrono::steady_clock::now() - tstart >= std::chrono::milliseconds( 200 ) );
+        REQUIRE( limiter->GetStats().cbTotal == 5U * 64 * 1024 );
+      }
+      SECTION( "adaptive TokenBucket backs off on the latency and restores the rate" )
+      {
+        auto  limiter = io::TokenBucket()
+          .SetBytesPerSec( 1600 )
+          .SetTargetLatency( std::chrono::milliseconds( 1 ) ).Create();
+
+        limiter->Feedback( std::chrono::milliseconds( 5 ) );
+          REQUIRE( limiter->GetStats().cbLimit == 800U );
+        limiter->Feedback( std::chrono::milliseconds( 5 ) );
+          REQUIRE( limiter->GetStats().cbLimit == 800U );
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 110 ) );
+
+        limiter->Feedback( std::chrono::milliseconds( 5 ) );
+          REQUIRE( limiter->GetStats().cbLimit == 400U );
+
+        for ( int i = 0; i != 20; ++i )
+          limiter->Feedback( std::chrono::microseconds( 10 ) );
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 110 ) );
+
+        limiter->Feedback( std::chrono::microseconds( 10 ) );
+          REQUIRE( limiter->GetStats().cbLimit == 500U );
+      }
+      SECTION( "adaptive TokenBucket restores the rate when no latency is reported" )
+      {
+        auto  limiter = io::TokenBucket()
+          .SetBytesPerSec( 1600 )
+          .SetTargetLatency( std::chrono::milliseconds( 1 ) ).Create();
+
+        limiter->Feedback( std::chrono::milliseconds( 5 ) );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 110 ) );
+        limiter->Feedback( std::chrono::milliseconds( 5 ) );
+          REQUIRE( limiter->GetStats().cbLimit == 400U );
+
+        limiter->Acquire( 1 );
+          REQUIRE( limiter->GetStats().cbLimit == 400U );
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1050 ) );
+
+        limiter->Acquire( 1 );
+          REQUIRE( limiter->GetStats().cbLimit > 400U );
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1050 ) );
+
+        limiter->Acquire( 1 );
+          REQUIRE( limiter->GetStats().cbLimit == 1600U );
+      }
+      SECTION( "the store may be throttled" )
+      {
+        auto  limiter = io::TokenBucket().Create();
+        auto  istore = MockStore();
+        auto  output = io::Throttle( &istore, limiter );
+        auto  buffer = std::string( 0x10000, 'x' );
+
+        REQUIRE( io::Throttle( &istore, nullptr ).ptr() == &istore );
+        REQUIRE( output.ptr() != &istore );
+
+        if ( REQUIRE( output->Entities() != nullptr ) )
+        {
+          auto  stream = output->Entities();
+
+          stream->Put( buffer.data(), uint32_t(buffer.size()) );
+          stream->Put( buffer.data(), uint32_t(buffer.size()) );
+
+          REQUIRE( istore.stream.written == 0x20000U );
+          REQUIRE( limiter->GetStats().cbTotal == 0x20000U );
+        }
+        REQUIRE( output->Contents() == nullptr );
+      }
+    }
+  } );
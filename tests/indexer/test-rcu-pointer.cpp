@@ -0,0 +1,80 @@
+# include "../../src/indexer/rcu-pointer.hpp"
+# include <mtc/test-it-easy.hpp>
+# include <vector>
+# include <thread>
+
+using namespace DelphiX::indexer;
+
+class Counted: public mtc::Iface
+{
+  implement_lifetime_control
+
+public:
+  Counted( int v, std::atomic_int& n ): value( v ), nlive( n ) {  ++nlive;  }
+ ~Counted() {  value = -1;  --nlive;  }
+
+public:
+  int               value;
+  std::atomic_int&  nlive;
+
+};
+
+TestItEasy::RegisterFunc  rcu_pointer( []()
+  {
+    TEST_CASE( "index/rcu-pointer" )
+    {
+      SECTION( "RcuPointer publishes the reference-counted objects" )
+      {
+        std::atomic_int       nlive = 0;
+        RcuPointer<Counted>   rcuptr( new Counted( 1, nlive ) );
+
+        SECTION( "the published object may be got" )
+        {
+          if ( REQUIRE( rcuptr.Get() != nullptr ) )
+            REQUIRE( rcuptr.Get()->value == 1 );
+        }
+        SECTION( "the replaced object is released if not referenced" )
+        {
+          rcuptr.Set( new Counted( 2, nlive ) );
+
+          REQUIRE( rcuptr.Get()->value == 2 );
+          REQUIRE( nlive == 1 );
+        }
+        SECTION( "the replaced object is kept while referenced" )
+        {
+          auto  pvalue = rcuptr.Get();
+
+          rcuptr.Set( new Counted( 3, nlive ) );
+
+          REQUIRE( pvalue->value == 2 );
+          REQUIRE( rcuptr.Get()->value == 3 );
+          REQUIRE( nlive == 2 );
+        }
+        SECTION( "the objects may be replaced while read by multiple threads" )
+        {
+          auto  readers = std::vector<std::thread>();
+          auto  running = std::atomic_bool( true );
+          auto  nbroken = std::atomic_int( 0 );
+
+          for ( int i = 0; i != 4; ++i )
+            readers.emplace_back( [&]()
+              {
+                while ( running )
+                  if ( rcuptr.Get()->value < 3 )
+                    ++nbroken;
+              } );
+
+          for ( int i = 4; i != 10000; ++i )
+            rcuptr.Set( new Counted( i, nlive ) );
+
+          running = false;
+
+          for ( auto& next: readers )
+            next.join();
+
+          REQUIRE( nbroken == 0 );
+          REQUIRE( nlive == 1 );
+        }
+      }
+    }
+  } );
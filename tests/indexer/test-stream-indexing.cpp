@@ -1,11 +1,17 @@
 # include "../../indexer/layered-contents.hpp"
 # include "../../storage/posix-fs.hpp"
+# include "../../exceptions.hpp"
 # include "../../compat.hpp"
 # include "../toolbox/tmppath.h"
 # include "../toolbox/dirtool.h"
+# include <mtc/recursive_shared_mutex.hpp>
 # include <mtc/test-it-easy.hpp>
 # include <mtc/zmap.h>
+# include <condition_variable>
+# include <algorithm>
+# include <future>
 # include <thread>
+# include <set>
 
 using namespace DelphiX;
 using namespace DelphiX::indexer;
@@ -36,6 +42,327 @@ auto  CreateContents() -> Contents
   return out;
 }
 
+// the storage holding the index commits until the gate is opened; the merges
+// are passed to the hook with the count of layers merged, and are accounted
+
+class GatedStorage: public IStorage
+{
+  implement_lifetime_control
+
+  class GatedStore;
+
+public:
+  using OnMerge = std::function<void( size_t )>;
+
+  GatedStorage( mtc::api<IStorage> storage, OnMerge onmerge = nullptr ):
+    istore( storage ), onMerge( onmerge ), opened( gate.get_future().share() ) {}
+
+  auto  ListIndices() -> mtc::api<ISourceList> override {  return istore->ListIndices();  }
+  auto  CreateStore() -> mtc::api<IIndexStore> override;
+
+  void  Open() {  gate.set_value();  }
+
+ /*
+  * HasOverlaps()
+  *
+  * Checks if any layer was superseded by more than one merge.
+  */
+  bool  HasOverlaps() const
+  {
+    auto  exlock = mtc::make_unique_lock( mxlock );
+    auto  sorted = std::vector<const void*>();
+
+    for ( auto& next: superseded )
+      sorted.push_back( next.ptr() );
+
+    std::sort( sorted.begin(), sorted.end() );
+
+    return std::adjacent_find( sorted.begin(), sorted.end() ) != sorted.end();
+  }
+
+protected:
+  auto  Merge( size_t, const std::function<mtc::api<ISerialized>()>& ) -> mtc::api<ISerialized>;
+
+protected:
+  mtc::api<IStorage>        istore;
+  OnMerge                   onMerge;
+  std::promise<void>        gate;
+  std::shared_future<void>  opened;
+
+  mutable std::mutex                  mxlock;
+  std::vector<mtc::api<ISerialized>>  superseded;   // kept, so the pointers are not reused
+
+public:
+  std::atomic<unsigned>     npending = 0;     // merges committing now
+  std::atomic<unsigned>     nmaxrun = 0;      // merges committing at once, at most
+  std::atomic<unsigned>     nmerged = 0;      // merges committed
+
+};
+
+class GatedStorage::GatedStore: public IStorage::IIndexStore
+{
+  implement_lifetime_control
+
+public:
+  GatedStore( mtc::api<GatedStorage> owner, mtc::api<IStorage::IIndexStore> store ):
+    storage( owner ), istore( store ) {}
+
+  auto  Entities() -> mtc::api<mtc::IByteStream> override {  return istore->Entities();  }
+  auto  Contents() -> mtc::api<mtc::IByteStream> override {  return istore->Contents();  }
+  auto  Linkages() -> mtc::api<mtc::IByteStream> override {  return istore->Linkages();  }
+  auto  Packages() -> mtc::api<IStorage::IDumpStore> override {  return istore->Packages();  }
+  auto  Spillage() -> mtc::api<IStorage::IDumpStore> override {  return istore->Spillage();  }
+  void  Remove() override {  istore->Remove();  }
+
+  void  Supersede( mtc::api<IStorage::ISerialized> serial ) override
+  {
+    mtc::interlocked( mtc::make_unique_lock( storage->mxlock ), [&]()
+      {  storage->superseded.push_back( serial );  } );
+    istore->Supersede( serial );
+    ++nsource;
+  }
+  auto  Commit() -> mtc::api<IStorage::ISerialized> override
+  {
+    if ( nsource == 0 )
+      return storage->opened.wait(), istore->Commit();
+    return storage->Merge( nsource, [this](){  return istore->Commit();  } );
+  }
+
+protected:
+  mtc::api<GatedStorage>          storage;
+  mtc::api<IStorage::IIndexStore> istore;
+  size_t                          nsource = 0;
+};
+
+auto  GatedStorage::CreateStore() -> mtc::api<IIndexStore>
+{
+  return new GatedStore( this, istore->CreateStore() );
+}
+
+auto  GatedStorage::Merge( size_t count, const std::function<mtc::api<ISerialized>()>& commit ) -> mtc::api<ISerialized>
+{
+  mtc::interlocked( mtc::make_unique_lock( mxlock ), [&]()
+    {  nmaxrun = std::max( nmaxrun.load(), ++npending );  } );
+
+  try
+  {
+    if ( onMerge != nullptr )
+      onMerge( count );
+
+    auto  serial = commit();
+
+    return --npending, ++nmerged, serial;
+  }
+  catch ( ... )
+  {
+    --npending;
+    throw;
+  }
+}
+
+// the merge policy selecting the first range of the script with all the layers
+// to be merged; records the layers seen
+
+class ScriptedPolicy: public IMergePolicy
+{
+  implement_lifetime_control
+
+public:
+  ScriptedPolicy( const std::vector<std::pair<size_t, size_t>>& ranges ):
+    script( ranges ) {}
+
+  auto  Select( const Layer* layers, size_t count ) const -> std::pair<size_t, size_t> override
+  {
+    auto  exlock = mtc::make_unique_lock( mxlock );
+
+    lastSeen.assign( layers, layers + count );
+      seenEvent.notify_all();
+
+    for ( auto& range: script )
+      if ( enabled && range.second <= count && std::all_of( layers + range.first, layers + range.second,
+        []( const Layer& layer ){  return layer.canMerge;  } ) )
+      return range;
+
+    return { 0, 0 };
+  }
+  auto  WriteAmplification() const -> double override  {  return 1.0;  }
+
+  void  Disable()
+  {
+    mtc::interlocked( mtc::make_unique_lock( mxlock ), [&](){  enabled = false;  } );
+  }
+
+ /*
+  * WaitLayers( canMerge )
+  *
+  * Waits for the policy to be asked with the layers having the canMerge flags
+  * listed, i.e. for the layers changed.
+  */
+  bool  WaitLayers( const std::vector<bool>& canMerge ) const
+  {
+    auto  exlock = mtc::make_unique_lock( mxlock );
+
+    return seenEvent.wait_for( exlock, std::chrono::seconds( 30 ), [&]()
+      {
+        return lastSeen.size() == canMerge.size() && std::equal( canMerge.begin(), canMerge.end(),
+          lastSeen.begin(), []( bool flag, const Layer& layer ){  return flag == layer.canMerge;  } );
+      } );
+  }
+
+protected:
+  std::vector<std::pair<size_t, size_t>>  script;
+  bool                                    enabled = true;
+
+  mutable std::mutex                      mxlock;
+  mutable std::condition_variable         seenEvent;
+  mutable std::vector<Layer>              lastSeen;
+
+};
+
+// creates the static layers of the counts of entities passed in the storage
+
+void  CreateLayers( mtc::api<IStorage> storage, const std::vector<unsigned>& counts )
+{
+  for ( auto& count: counts )
+  {
+    auto  pindex = dynamic::Index()
+      .Set( dynamic::Settings()
+        .SetMaxEntities( 0x4000 ) )
+      .Set( storage->CreateStore() )
+      .Create();
+
+    for ( unsigned entId = 0; entId != count; ++entId )
+    {
+      auto  contents = CreateContents();
+
+      pindex->SetEntity( std::string_view( mtc::strprintf( "layer%u-ent%u", unsigned(&count - counts.data()), entId ) ),
+        &contents );
+    }
+    pindex->Commit();
+  }
+}
+
+// the layered index over the gated storage holding the static layers of the
+// counts passed; the merges wait for the gate unless the hook is passed, and the
+// commits of the dynamic indices are not held
+
+class GatedMerges
+{
+public:
+  GatedMerges( const std::string& path ): pathTo( path ) {}
+ ~GatedMerges() {  Close();  }
+
+  void  Open( const std::vector<unsigned>& counts, mtc::api<IMergePolicy> policy,
+    const merge::Schedule& schedule, GatedStorage::OnMerge onmerge = nullptr )
+  {
+    Close();
+
+    auto  posix = storage::posixFS::Open( storage::posixFS::StoragePolicies::Open( pathTo ) );
+
+    if ( onmerge == nullptr )
+      onmerge = [opened = gate.get_future().share()]( size_t ){  opened.wait();  };
+
+    CreateLayers( posix, counts );
+
+    storage = new GatedStorage( posix, onmerge );
+    storage->Open();
+
+    layered = layered::Index()
+      .Set( storage.ptr() )
+      .Set( policy )
+      .Set( schedule ).Create();
+  }
+  void  Pass()
+  {
+    gate.set_value();
+  }
+ /*
+  * Close()
+  *
+  * Releases the merges waiting for the gate, closes the index and removes the
+  * files of the storage.
+  */
+  void  Close()
+  {
+    gate = std::promise<void>();
+    layered = nullptr;
+    storage = nullptr;
+    RemoveFiles( pathTo + ".*" );
+  }
+
+public:
+  mtc::api<GatedStorage>    storage;
+  mtc::api<IContentsIndex>  layered;
+
+protected:
+  std::string         pathTo;
+  std::promise<void>  gate;
+
+};
+
+// checks if each entity is found by its index and by its id at the same index,
+// and the count of entities
+
+bool  CheckNumbering( mtc::api<IContentsIndex> index, size_t count )
+{
+  auto  listed = std::set<std::string>();
+  auto  maxind = index->GetMaxIndex();
+
+  for ( auto ix = 1U; ix <= maxind; ++ix )
+  {
+    auto  entity = index->GetEntity( ix );
+    auto  search = mtc::api<const IEntity>();
+
+    if ( entity == nullptr || (search = index->GetEntity( entity->GetId() )) == nullptr || search->GetIndex() != ix )
+      return false;
+
+    listed.insert( std::string( entity->GetId() ) );
+  }
+  return listed.size() == count;
+}
+
+template <class Pred>
+bool  WaitFor( Pred pred )
+{
+  for ( auto tstop = std::chrono::steady_clock::now() + std::chrono::seconds( 30 ); !pred(); )
+  {
+    if ( std::chrono::steady_clock::now() > tstop )
+      return false;
+    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+  }
+  return true;
+}
+
+// sets the new entities until the index reports it is busy; returns the count set
+
+auto  SetUntilBusy( mtc::api<IContentsIndex> index, unsigned limit ) -> unsigned
+{
+  for ( unsigned entId = 0; entId != limit; ++entId )
+  {
+    auto  contents = CreateContents();
+
+    try
+    {  index->SetEntity( std::string_view( mtc::strprintf( "ent%u", entId ) ), &contents );  }
+    catch ( const index_busy& )
+    {  return entId;  }
+  }
+  return limit;
+}
+
+// retries to set the entity while the index is busy, up to the limit of attempts
+
+bool  SetWhenReady( mtc::api<IContentsIndex> index, const std::string& entId, unsigned limit )
+{
+  for ( auto contents = CreateContents(); limit-- != 0; )
+  {
+    try
+    {  return index->SetEntity( std::string_view( entId ), &contents ) != nullptr;  }
+    catch ( const index_busy& )
+    {  std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );  }
+  }
+  return false;
+}
+
 TestItEasy::RegisterFunc  stream_indexing( []()
   {
     RemoveFiles( GetTmpPath() + "k2" );
@@ -48,7 +375,10 @@ TestItEasy::RegisterFunc  stream_indexing( []()
         .Set( storage )
         .Set( dynamic::Settings()
           .SetMaxEntities( 4096 )
-          .SetMaxAllocate( 256 * 1024 * 1024 ) )
+          .SetMaxAllocate( 256 * 1024 * 1024 )
+          .SetMaxCommits( 2 ) )
+        .Set( merge::Schedule()
+          .SetMaxThreads( 4 ) )
         .Create();
 
       SECTION( "indexing a set of entities generates a set of indices" )
@@ -71,10 +401,220 @@ TestItEasy::RegisterFunc  stream_indexing( []()
         for ( auto& th: threads )
           th.join();
       }
+      SECTION( "the layers may be merged and the deleted entities expunged on request" )
+      {
+        auto  merged = layered->ForceMerge( 1 );
+
+        if ( REQUIRE( merged.wait_for( std::chrono::seconds( 60 ) ) == std::future_status::ready ) )
+          REQUIRE_NOTHROW( merged.get() );
+
+      // one static segment and the dynamic layer at most
+        REQUIRE( layered::Index::Partition( layered, 0x100 ).size() <= 2 );
+
+        for ( auto entId = 0; entId != 100; ++entId )
+          layered->DelEntity( std::string_view( mtc::strprintf( "ent%u", entId ) ) );
+
+        auto  expunged = layered->ExpungeDeletes( 0.0 );
+
+        if ( REQUIRE( expunged.wait_for( std::chrono::seconds( 60 ) ) == std::future_status::ready ) )
+          REQUIRE_NOTHROW( expunged.get() );
+
+        REQUIRE( layered->GetIndexStats().nDeleted == 0 );
+      }
+      SECTION( "the index reopened reports the time of opening the layers" )
+      {
+        auto  startup = layered::StartupStats();
+
+        layered = nullptr;
+        layered = layered::Index()
+          .Set( storage )
+          .Set( [&]( const layered::StartupStats& stats ){  startup = stats;  } )
+          .Create();
+
+        if ( REQUIRE( startup.tmLayers.size() != 0 ) )
+          REQUIRE( startup.tmTotal >= startup.tmLayers.front() );
+        REQUIRE( layered->GetEntity( "ent100" ) != nullptr );
+      }
+      SECTION( "the entities of all the layers may be listed" )
+      {
+        auto  nexpect = std::thread::hardware_concurrency() * 1000 - 100;
+        auto  ordered = true;
+        auto  lastKey = std::string();
+        auto  lastPos = uint32_t(0);
+        auto  ncount = 0U;
+
+        for ( auto list = layered->ListEntities( "" ); list != nullptr && list->Curr() != nullptr; list->Next(), ++ncount )
+        {
+          ordered &= ncount == 0 || lastKey < std::string_view( list->Curr()->GetId() );
+            lastKey = std::string( list->Curr()->GetId() );
+        }
+        REQUIRE( ncount == nexpect );
+        REQUIRE( ordered );
+
+        ncount = 0;
+
+        for ( auto list = layered->ListEntities( 0U ); list != nullptr && list->Curr() != nullptr; list->Next(), ++ncount )
+        {
+          ordered &= lastPos < list->Curr()->GetIndex();
+            lastPos = list->Curr()->GetIndex();
+        }
+        REQUIRE( ncount == nexpect );
+        REQUIRE( ordered );
+      }
       layered = nullptr;
       storage = nullptr;
 
       REQUIRE( SearchFiles( GetTmpPath() + "k2.*" ) );
       RemoveFiles( GetTmpPath() + "k2.*" );
     }
+    TEST_CASE( "index/commit-backpressure" )
+    {
+      auto  dynset = dynamic::Settings()
+        .SetMaxEntities( 100 )
+        .SetMaxCommits( 1 );
+
+      RemoveFiles( GetTmpPath() + "k3.*" );
+
+      SECTION( "with no commit wait the writer passing the hard mark while the commit is pending fails at once" )
+      {
+        auto  storage = mtc::api<GatedStorage>( new GatedStorage( storage::posixFS::Open(
+          storage::posixFS::StoragePolicies::Open( GetTmpPath() + "k3" ) ) ) );
+        auto  layered = layered::Index()
+          .Set( storage.ptr() )
+          .Set( dynamic::Settings( dynset ).SetCommitWait( std::chrono::milliseconds( 0 ) ) )
+          .Create();
+        auto  tstart = std::chrono::steady_clock::now();
+        auto  nbusy = SetUntilBusy( layered, 1000 );
+        auto  tbusy = std::chrono::steady_clock::now() - tstart;
+
+      // the first index is rotated and committed, the second one fills up to the hard mark
+        REQUIRE( nbusy >= 100 );
+        REQUIRE( nbusy < 1000 );
+        REQUIRE( tbusy < std::chrono::seconds( 10 ) );
+
+        storage->Open();
+
+        REQUIRE( SetWhenReady( layered, "ent-after", 200 ) );
+
+        layered = nullptr;
+      }
+      SECTION( "with the commit wait set the writer fails after the timeout" )
+      {
+        auto  storage = mtc::api<GatedStorage>( new GatedStorage( storage::posixFS::Open(
+          storage::posixFS::StoragePolicies::Open( GetTmpPath() + "k3" ) ) ) );
+        auto  layered = layered::Index()
+          .Set( storage.ptr() )
+          .Set( dynamic::Settings( dynset ).SetCommitWait( std::chrono::milliseconds( 100 ) ) )
+          .Create();
+        auto  nbusy = SetUntilBusy( layered, 1000 );
+
+        REQUIRE( nbusy >= 100 );
+        REQUIRE( nbusy < 1000 );
+
+        if ( nbusy < 1000 )
+        {
+          auto  contents = CreateContents();
+          auto  tstart = std::chrono::steady_clock::now();
+
+          REQUIRE_EXCEPTION( layered->SetEntity( "ent-busy", &contents ), index_busy );
+          REQUIRE( std::chrono::steady_clock::now() - tstart >= std::chrono::milliseconds( 100 ) );
+        }
+
+        storage->Open();
+
+        REQUIRE( SetWhenReady( layered, "ent-after", 200 ) );
+
+        layered = nullptr;
+      }
+      RemoveFiles( GetTmpPath() + "k3.*" );
+    }
+    TEST_CASE( "index/concurrent-merges" )
+    {
+      auto  pairs = std::vector<std::pair<size_t, size_t>>{ { 0, 2 }, { 1, 3 }, { 2, 4 }, { 3, 5 }, { 4, 6 } };
+      auto  merges = GatedMerges( GetTmpPath() + "k4" );
+
+    // the limits are checked while the first merges wait for the gate, and again
+    // by the count of merges run at once when all of them are finished
+      SECTION( "the count of merges run at once is limited by maxMerges" )
+      {
+        merges.Open( { 20, 20, 20, 20, 20, 20 }, new ScriptedPolicy( pairs ), merge::Schedule()
+          .SetMaxMerges( 1 ) );
+
+        REQUIRE( WaitFor( [&](){  return merges.storage->npending == 1;  } ) );
+        REQUIRE( merges.storage->nmaxrun == 1 );
+        REQUIRE( CheckNumbering( merges.layered, 120 ) );
+
+        merges.Pass();
+
+        REQUIRE( WaitFor( [&](){  return merges.storage->nmerged == 5;  } ) );
+        REQUIRE( merges.storage->nmaxrun == 1 );
+        REQUIRE( !merges.storage->HasOverlaps() );
+        REQUIRE( CheckNumbering( merges.layered, 120 ) );
+      }
+      SECTION( "the merges run at once never take the same layers" )
+      {
+        merges.Open( { 20, 20, 20, 20, 20, 20 }, new ScriptedPolicy( pairs ), merge::Schedule()
+          .SetMaxMerges( 2 ) );
+
+        REQUIRE( WaitFor( [&](){  return merges.storage->npending == 2;  } ) );
+        REQUIRE( merges.storage->nmaxrun == 2 );
+        REQUIRE( !merges.storage->HasOverlaps() );
+        REQUIRE( CheckNumbering( merges.layered, 120 ) );
+
+        merges.Pass();
+
+        REQUIRE( WaitFor( [&](){  return merges.storage->nmerged == 5;  } ) );
+        REQUIRE( merges.storage->nmaxrun == 2 );
+        REQUIRE( !merges.storage->HasOverlaps() );
+        REQUIRE( CheckNumbering( merges.layered, 120 ) );
+      }
+      SECTION( "the size of the layers merged at once is limited by maxBytes, but the first merge is run" )
+      {
+        merges.Open( { 20, 20, 20, 20, 20, 20 }, new ScriptedPolicy( pairs ), merge::Schedule()
+          .SetMaxMerges( 3 )
+          .SetMaxBytes( 1 ) );
+
+        REQUIRE( WaitFor( [&](){  return merges.storage->npending == 1;  } ) );
+        REQUIRE( merges.storage->nmaxrun == 1 );
+
+        merges.Pass();
+
+        REQUIRE( WaitFor( [&](){  return merges.storage->nmerged == 5;  } ) );
+        REQUIRE( merges.storage->nmaxrun == 1 );
+        REQUIRE( CheckNumbering( merges.layered, 120 ) );
+      }
+      SECTION( "the merge canceled restores its layers where the placeholder is moved by another merge" )
+      {
+        auto  gates = std::vector<std::promise<void>>( 2 );
+        auto  opens = std::vector<std::shared_future<void>>{ gates[0].get_future().share(), gates[1].get_future().share() };
+        auto  policy = mtc::api<ScriptedPolicy>( new ScriptedPolicy( { { 0, 3 }, { 1, 3 } } ) );
+
+      // the merge of three layers waits for the first gate and succeeds, the merge
+      // of two layers waits for the second one and fails
+        merges.Open( { 20, 40, 60, 80, 100 }, policy.ptr(), merge::Schedule()
+          .SetMaxMerges( 2 ), [opens]( size_t count )
+          {
+            if ( count == 3 )
+              return opens[0].wait();
+            opens[1].wait();
+            throw std::runtime_error( "merge failed" );
+          } );
+
+        REQUIRE( WaitFor( [&](){  return merges.storage->npending == 2;  } ) );
+          policy->Disable();
+
+      // the merge finished moves the placeholder of the second one to the front
+        gates[0].set_value();
+
+        REQUIRE( policy->WaitLayers( { false, true, false } ) );
+        REQUIRE( CheckNumbering( merges.layered, 300 ) );
+
+      // the merge failed is canceled and its layers are renumbered from there
+        gates[1].set_value();
+
+        REQUIRE( policy->WaitLayers( { true, true, true, false } ) );
+        REQUIRE( CheckNumbering( merges.layered, 300 ) );
+        REQUIRE( merges.storage->nmerged == 1 );
+      }
+    }
   } );
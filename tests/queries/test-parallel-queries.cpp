@@ -0,0 +1,92 @@
+# include "../../queries/parallel.hpp"
+# include "../../indexer/dynamic-contents.hpp"
+# include <mtc/test-it-easy.hpp>
+# include <stdexcept>
+# include <future>
+
+using namespace DelphiX;
+using namespace DelphiX::queries;
+
+class MockQuery: public IQuery
+{
+  implement_lifetime_control
+
+public:
+  MockQuery( std::vector<uint32_t> ids ): entities( std::move( ids ) ) {}
+
+  uint32_t  SearchDoc( uint32_t id ) override
+  {
+    for ( auto next: entities )
+      if ( next >= id )
+        return next;
+    return uint32_t(-1);
+  }
+  Abstract  GetTuples( uint32_t ) override
+  {
+    return {};
+  }
+
+protected:
+  std::vector<uint32_t> entities;
+
+};
+
+TestItEasy::RegisterFunc  test_parallel_queries( []()
+{
+  TEST_CASE( "queries/parallel" )
+  {
+    auto  executor = indexer::Executor( 2 );
+    auto  parts = std::vector<mtc::api<IContentsIndex>>{
+      indexer::dynamic::Index().Create(),
+      indexer::dynamic::Index().Create(),
+      indexer::dynamic::Index().Create() };
+    auto  search = std::map<const IContentsIndex*, std::vector<uint32_t>>{
+      { parts[0].ptr(), { 1, 4, 7 } },
+      { parts[1].ptr(), { 2, 5, 8 } },
+      { parts[2].ptr(), { 3, 6, 9 } } };
+    auto  create = [&]( const mtc::api<IContentsIndex>& part ) -> mtc::api<IQuery>
+      {  return new MockQuery( search.at( part.ptr() ) );  };
+    auto  ranker = []( uint32_t id, const Abstract& ) -> double
+      {  return id % 4;  };
+
+    SECTION( "the best entities of all the parts are selected" )
+    {
+      auto  scored = SearchTopK( parts, create, ranker, 4, executor );
+
+      if ( REQUIRE( scored.size() == 4U ) )
+      {
+        REQUIRE( scored[0].uEntity == 3U );
+        REQUIRE( scored[1].uEntity == 7U );
+        REQUIRE( scored[2].uEntity == 2U );
+        REQUIRE( scored[3].uEntity == 6U );
+      }
+    }
+    SECTION( "all the entities found are returned if there are less than topK" )
+    {
+      REQUIRE( SearchTopK( parts, create, ranker, 100, executor ).size() == 9U );
+      REQUIRE( SearchTopK( { parts[1] }, create, ranker, 100, executor ).size() == 3U );
+      REQUIRE( SearchTopK( {}, create, ranker, 100, executor ).empty() );
+    }
+    SECTION( "the exception is passed to the caller" )
+    {
+      REQUIRE_EXCEPTION( SearchTopK( parts, create, []( uint32_t id, const Abstract& ) -> double
+        {
+          if ( id == 5 )
+            throw std::runtime_error( "rank failed" );
+          return id;
+        }, 4, executor ), std::runtime_error );
+    }
+    SECTION( "the parts are searched by the caller while the executor is busy" )
+    {
+      auto  release = std::promise<void>();
+      auto  blocked = release.get_future().share();
+
+      for ( int i = 0; i != 2; ++i )
+        executor.Run( indexer::Executor::commit, &release, [blocked](){  blocked.wait();  } );
+
+      REQUIRE( SearchTopK( parts, create, ranker, 100, executor ).size() == 9U );
+
+      release.set_value();
+    }
+  }
+} );
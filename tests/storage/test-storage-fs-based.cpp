@@ -6,6 +6,7 @@
 # include <mtc/exceptions.h>
 # include <mtc/directory.h>
 # include <thread>
+# include <cstdio>
 
 using namespace DelphiX;
 
@@ -65,5 +66,134 @@ TestItEasy::RegisterFunc  storage_fs( []()
           }
         }
       }
+      SECTION( "IStorage keeps the manifest of the indices committed" )
+      {
+        auto  CountIndices = []( mtc::api<IStorage> storage )
+          {
+            auto  sources = storage->ListIndices();
+            auto  nsource = 0;
+
+            if ( sources != nullptr )
+              for ( auto serial = sources->Get(); serial != nullptr; serial = sources->Get() )
+                ++nsource;
+            return nsource;
+          };
+
+        RemoveFiles( GetTmpPath() + "k2.*" );
+
+        auto  storage = storage::posixFS::Open( storage::posixFS::StoragePolicies::Open( GetTmpPath() + "k2" ) );
+        auto  serial1 = storage->CreateStore()->Commit();
+        auto  serial2 = storage->CreateStore()->Commit();
+        auto  serial3 = mtc::api<IStorage::ISerialized>();
+
+        SECTION( "the indices committed are listed by the manifest" )
+        {
+          REQUIRE( SearchFiles( GetTmpPath() + "k2.manifest" ) );
+          REQUIRE( CountIndices( storage::posixFS::Open( storage::posixFS::StoragePolicies::Open( GetTmpPath() + "k2" ) ) ) == 2 );
+        }
+        SECTION( "the files of the indices not listed are deleted when the storage is opened" )
+        {
+          for ( auto suffix: { ".entities", ".contents", ".bulletin" } )
+            fclose( fopen( (GetTmpPath() + "k2.1" + suffix).c_str(), "w" ) );
+
+          REQUIRE( SearchFiles( GetTmpPath() + "k2.1.*" ) );
+          REQUIRE( CountIndices( storage::posixFS::Open( storage::posixFS::StoragePolicies::Open( GetTmpPath() + "k2" ) ) ) == 2 );
+          REQUIRE( SearchFiles( GetTmpPath() + "k2.1.*" ) == false );
+        }
+        SECTION( "the index committed by merge supersedes the sources at once" )
+        {
+          auto  sink = storage->CreateStore();
+
+          sink->Supersede( serial1 );
+          sink->Supersede( serial2 );
+
+          if ( REQUIRE_NOTHROW( serial3 = sink->Commit() ) )
+            REQUIRE( CountIndices( storage::posixFS::Open( storage::posixFS::StoragePolicies::Open( GetTmpPath() + "k2" ) ) ) == 1 );
+        }
+        SECTION( "the index removed is unlisted" )
+        {
+          serial1->Remove();
+          serial2->Remove();
+          serial3->Remove();
+
+          REQUIRE( CountIndices( storage::posixFS::Open( storage::posixFS::StoragePolicies::Open( GetTmpPath() + "k2" ) ) ) == 0 );
+        }
+        SECTION( "the packages of the index committed may be copied to the new one" )
+        {
+          auto  source = storage->CreateStore();
+          auto  output = storage->CreateStore();
+          auto  record = std::string( 0x2000, 'x' );
+          auto  srcpos = source->Packages()->Put( record.data(), record.size() );
+          auto  serial = source->Commit();
+          auto  copied = output->Packages()->Copy( serial->Packages().ptr(), srcpos );
+          auto  bundle = mtc::api<const mtc::IByteBuffer>();
+
+          if ( REQUIRE( copied.second == record.size() ) && REQUIRE( (bundle = output->Packages()->Get( copied.first )) != nullptr ) )
+            REQUIRE( std::string( bundle->GetPtr(), bundle->GetLen() ) == record );
+
+          output = nullptr;
+          serial->Remove();
+        }
+        SECTION( "the packages may be put and copied to the same store in turn" )
+        {
+          auto  source = storage->CreateStore();
+          auto  output = storage->CreateStore();
+          auto  srcpos = std::vector<int64_t>();
+          auto  outpos = std::vector<std::pair<int64_t, std::string>>();
+          auto  serial = mtc::api<IStorage::ISerialized>();
+          auto  bundle = mtc::api<const mtc::IByteBuffer>();
+
+          for ( int i = 0; i != 16; ++i )
+          {
+            auto  record = std::string( 0x100 + i * 0x301, char('a' + i) );
+
+            srcpos.push_back( source->Packages()->Put( record.data(), record.size() ) );
+          }
+
+          serial = source->Commit();
+
+          for ( int i = 0; i != 16; ++i )
+          {
+            auto  record = std::string( 0x80 + i * 0x11, char('A' + i) );
+
+            outpos.emplace_back( output->Packages()->Put( record.data(), record.size() ), record );
+            outpos.emplace_back( output->Packages()->Copy( serial->Packages().ptr(), srcpos[i] ).first,
+              std::string( 0x100 + i * 0x301, char('a' + i) ) );
+          }
+
+          for ( auto& next: outpos )
+            if ( REQUIRE( (bundle = output->Packages()->Get( next.first )) != nullptr ) )
+              REQUIRE( std::string( bundle->GetPtr(), bundle->GetLen() ) == next.second );
+
+          output = nullptr;
+          serial->Remove();
+        }
+        SECTION( "the indices committed out of order are listed in the order created" )
+        {
+          auto  older = storage->CreateStore();
+          auto  newer = storage->CreateStore();
+          auto  oldpos = older->Packages()->Put( "older", 5 );
+          auto  newpos = newer->Packages()->Put( "newer", 5 );
+          auto  serial = std::vector<mtc::api<IStorage::ISerialized>>();
+          auto  listed = mtc::api<IStorage::ISourceList>();
+          auto  bundle = mtc::api<const mtc::IByteBuffer>();
+
+          serial.push_back( newer->Commit() );
+          serial.push_back( older->Commit() );
+
+          if ( REQUIRE_NOTHROW( listed = storage::posixFS::Open( storage::posixFS::StoragePolicies::Open( GetTmpPath() + "k2" ) )->ListIndices() ) )
+          {
+            if ( REQUIRE( (bundle = listed->Get()->Packages()->Get( oldpos )) != nullptr ) )
+              REQUIRE( std::string( bundle->GetPtr(), bundle->GetLen() ) == "older" );
+            if ( REQUIRE( (bundle = listed->Get()->Packages()->Get( newpos )) != nullptr ) )
+              REQUIRE( std::string( bundle->GetPtr(), bundle->GetLen() ) == "newer" );
+          }
+          listed = nullptr;
+
+          for ( auto& next: serial )
+            next->Remove();
+        }
+        RemoveFiles( GetTmpPath() + "k2.*" );
+      }
     }
   } );